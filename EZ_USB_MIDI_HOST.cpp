@@ -30,27 +30,117 @@
  * link these functions to the usb_midi_host library if they are defined in
  * the sketch directory. This adds a single function call overhead to the
  * callbacks over using the raw usb_midi_host library.
+ *
+ * Each EZ_USB_MIDI_HOST object registers its callbacks here for the root
+ * port it was started on. A device belongs to the object registered for
+ * the root port it is attached to; the mount callback looks that up once
+ * and the other callbacks use a table indexed by device address.
  */
 #include <cstdint>
+#if ARDUINO
+#include "Adafruit_TinyUSB.h"
+#else
+#include "tusb.h"
+#endif
+#include "host/hcd.h"
+#include "EZ_USB_MIDI_HOST_Config.h"
+
+/// The maximum number of EZ_USB_MIDI_HOST objects, each on its own root port
+#ifndef RPPICOMIDI_EZ_USB_MIDI_HOST_MAX_INSTANCES
+#define RPPICOMIDI_EZ_USB_MIDI_HOST_MAX_INSTANCES 2
+#endif
+
+/// Return the root port the device at devAddr is attached to. To find
+/// it another way, define this macro on the compiler command line.
+#ifndef RPPICOMIDI_EZ_USB_MIDI_HOST_GET_RHPORT
+#define RPPICOMIDI_EZ_USB_MIDI_HOST_GET_RHPORT(devAddr) get_rhport(devAddr)
+static uint8_t get_rhport(uint8_t devAddr)
+{
+  hcd_devtree_info_t info;
+  hcd_devtree_get_info(devAddr, &info);
+  return info.rhport;
+}
+#endif
+
+/* The callback functions implemented in the EZ_USB_MIDI_HOST class and the object to pass them */
+struct ez_usb_midi_host_instance {
+  uint8_t rhport;
+  void (*mount_cb_fp)(uint8_t devAddr, uint8_t nInCables, uint16_t nOutCables, void* inst);
+  void (*umount_cb_fp)(uint8_t devAddr, void* inst);
+  void (*rx_cb_fp)(uint8_t devAddr, uint32_t numPackets, void* inst);
+  void* inst_ptr; //!< nullptr if the entry is free
+};
 
-static void* inst_ptr = nullptr; //!< a pointer to the instance of the EZ_USB_MIDI_HOST class that the application created
-/* The following are pointers to the callback functions implemented in the EZ_USB_MIDI_HOST class */
-static void (*mount_cb_fp)(uint8_t devAddr, uint8_t nInCables, uint16_t nOutCables, void* inst)=nullptr;
-static void (*umount_cb_fp)(uint8_t devAddr, void* inst)=nullptr;
-static void (*rx_cb_fp)(uint8_t devAddr, uint32_t numPackets, void* inst)=nullptr;
+static ez_usb_midi_host_instance instances[RPPICOMIDI_EZ_USB_MIDI_HOST_MAX_INSTANCES];
+static ez_usb_midi_host_instance* dev_owner[RPPICOMIDI_TUH_MIDI_MAX_DEV_ADDR + 1]; //!< nullptr if no instance owns the address
 
 /**
- * @brief Initialize the pointers to the callback functions. The EZ_USB_MIDI_HOST
- * class constructor should call this. Applications probably should not.
+ * @brief Register the callback functions of an EZ_USB_MIDI_HOST object for
+ * the devices attached to root port rhport. The EZ_USB_MIDI_HOST
+ * class begin() function should call this. Applications probably should not.
+ * @return false if RPPICOMIDI_EZ_USB_MIDI_HOST_MAX_INSTANCES objects are already registered
  */
-extern "C" void rppicomidi_ez_usb_midi_host_set_cbs(void (*mount_cb)(uint8_t devAddr, uint8_t nInCables, uint16_t nOutCables, void*),
+extern "C" bool rppicomidi_ez_usb_midi_host_set_cbs(uint8_t rhport, void (*mount_cb)(uint8_t devAddr, uint8_t nInCables, uint16_t nOutCables, void*),
 					 void (*umount_cb)(uint8_t devAddr, void*), void (*rx_cb)(uint8_t devAddr, uint32_t numPackets, void*),
 					 void* inst)
 {
-  mount_cb_fp = mount_cb;
-  umount_cb_fp = umount_cb;
-  rx_cb_fp = rx_cb;
-  inst_ptr = inst;
+  ez_usb_midi_host_instance* entry = nullptr;
+  for (auto& instance : instances) {
+    // An object or a root port registers at most once; take the first free entry otherwise
+    if (instance.inst_ptr == inst || (instance.inst_ptr != nullptr && instance.rhport == rhport)) {
+      entry = &instance;
+      break;
+    }
+    if (entry == nullptr && instance.inst_ptr == nullptr)
+      entry = &instance;
+  }
+  if (entry == nullptr)
+    return false;
+  entry->rhport = rhport;
+  entry->mount_cb_fp = mount_cb;
+  entry->umount_cb_fp = umount_cb;
+  entry->rx_cb_fp = rx_cb;
+  entry->inst_ptr = inst;
+  return true;
+}
+
+/**
+ * @brief Unregister the callback functions of an EZ_USB_MIDI_HOST object.
+ * The EZ_USB_MIDI_HOST class destructor calls this.
+ */
+extern "C" void rppicomidi_ez_usb_midi_host_clear_cbs(void* inst)
+{
+  for (auto& instance : instances) {
+    if (instance.inst_ptr == inst) {
+      for (auto& owner : dev_owner) {
+        if (owner == &instance)
+          owner = nullptr;
+      }
+      instance.inst_ptr = nullptr;
+    }
+  }
+}
+
+/// @return the instance registered for the device's root port or nullptr.
+/// If only one object is registered, it gets every device.
+static ez_usb_midi_host_instance* find_instance(uint8_t devAddr)
+{
+  ez_usb_midi_host_instance* only = nullptr;
+  unsigned nRegistered = 0;
+  for (auto& instance : instances) {
+    if (instance.inst_ptr != nullptr) {
+      only = &instance;
+      ++nRegistered;
+    }
+  }
+  if (nRegistered <= 1)
+    return only;
+  uint8_t rhport = RPPICOMIDI_EZ_USB_MIDI_HOST_GET_RHPORT(devAddr);
+  for (auto& instance : instances) {
+    if (instance.inst_ptr != nullptr && instance.rhport == rhport)
+      return &instance;
+  }
+  return nullptr;
 }
 
 /* The following functions override the weak functions declared in the usb_midi_host library */
@@ -59,17 +149,28 @@ extern "C" void tuh_midi_mount_cb(uint8_t devAddr, uint8_t inEP, uint8_t outEP,
 {
   (void)inEP;
   (void)outEP;
-  mount_cb_fp(devAddr, nInCables, nOutCables, inst_ptr); 
+  if (devAddr > RPPICOMIDI_TUH_MIDI_MAX_DEV_ADDR)
+    return;
+  auto owner = find_instance(devAddr);
+  dev_owner[devAddr] = owner;
+  if (owner != nullptr)
+    owner->mount_cb_fp(devAddr, nInCables, nOutCables, owner->inst_ptr);
 }
 
 extern "C" void tuh_midi_umount_cb(uint8_t devAddr, uint8_t unused)
 {
   (void)unused;
-  umount_cb_fp(devAddr, inst_ptr);
+  if (devAddr > RPPICOMIDI_TUH_MIDI_MAX_DEV_ADDR)
+    return;
+  auto owner = dev_owner[devAddr];
+  dev_owner[devAddr] = nullptr;
+  if (owner != nullptr)
+    owner->umount_cb_fp(devAddr, owner->inst_ptr);
 }
 
 extern "C" void tuh_midi_rx_cb(uint8_t devAddr, uint32_t numPackets)
 {
-  rx_cb_fp(devAddr, numPackets, inst_ptr);
+  auto owner = devAddr <= RPPICOMIDI_TUH_MIDI_MAX_DEV_ADDR ? dev_owner[devAddr] : nullptr;
+  if (owner != nullptr)
+    owner->rx_cb_fp(devAddr, numPackets, owner->inst_ptr);
 }
-
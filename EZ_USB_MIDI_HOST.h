@@ -4,7 +4,7 @@
  *        application driver
  *
  * This library manages all USB MIDI devices connected to the
- * single USB Root hub for TinyUSB for the whole plug in,
+ * USB root hub (or root hubs) for TinyUSB for the whole plug in,
  * operate, unplug lifecycle. It makes each virtual MIDI cable for
  * each connected USB MIDI device behave as if it were a serial port
  * MIDI device and enables applications to use the Arduino MIDI Library
@@ -47,19 +47,52 @@
 
 #pragma once
 
-extern "C" void rppicomidi_ez_usb_midi_host_set_cbs(void (*mount_cb)(uint8_t devAddr, uint8_t nInCables, uint16_t nOutCables, void*),
+extern "C" bool rppicomidi_ez_usb_midi_host_set_cbs(uint8_t rhport, void (*mount_cb)(uint8_t devAddr, uint8_t nInCables, uint16_t nOutCables, void*),
 					 void (*umount_cb)(uint8_t devAddr, void*), void (*rx_cb)(uint8_t devAddr, uint32_t numPackets, void*), void*);
+extern "C" void rppicomidi_ez_usb_midi_host_clear_cbs(void*);
 
 #include "EZ_USB_MIDI_HOST_Config.h"
 
 #include "EZ_USB_MIDI_HOST_Device.h"
 
+#include "EZ_USB_MIDI_HOST_Packet.h"
+
+#include "EZ_USB_MIDI_HOST_Router.h"
+#include "EZ_USB_MIDI_HOST_SysExChunker.h"
+
 #include "EZ_USB_MIDI_HOST_namespace.h"
 
 BEGIN_EZ_USB_MIDI_HOST_NAMESPACE
 
 using ConnectCallback    = void (*)(uint8_t, uint8_t, uint8_t);
 using DisconnectCallback = void (*)(uint8_t);
+using RxPacketsCallback  = void (*)(uint8_t, const uint8_t*, uint32_t, uint32_t);
+using StringsReadyCallback = void (*)(uint8_t);
+
+/// The phases of EZ_USB_MIDI_HOST::service(), in the order it runs them
+enum EZ_USB_MIDI_HOST_ServicePhase : uint8_t {
+  ServiceUsb,     //!< tuh_task(); single-core mode only
+  ServiceTx,      //!< writeFlushAll(), before and after ServiceRx
+  ServiceRx,      //!< readAllDrain()
+  ServicePhases
+};
+
+/// @brief What one call to EZ_USB_MIDI_HOST::service() did
+struct EZ_USB_MIDI_HOST_ServiceReport {
+  uint32_t phaseUs[ServicePhases]; //!< microseconds each phase took
+  uint8_t skippedPhases;           //!< bit (1 << phase) is set for each phase skipped to meet the deadline
+  bool overran;                    //!< service() returned after the deadline
+  uint32_t rxBytesPending;         //!< bytes left unread in the MIDI IN FIFOs
+
+  /// @return the phase that took the most time
+  EZ_USB_MIDI_HOST_ServicePhase getBusiestPhase() const {
+    uint8_t busiest = 0;
+    for (uint8_t phase = 1; phase < ServicePhases; phase++)
+      if (phaseUs[phase] > phaseUs[busiest])
+        busiest = phase;
+    return static_cast<EZ_USB_MIDI_HOST_ServicePhase>(busiest);
+  }
+};
 
 /// @brief This is the class your application should directly
 /// instantiate. It tracks when MIDI devices are connected
@@ -67,33 +100,65 @@ using DisconnectCallback = void (*)(uint8_t);
 /// the onConnect() and onDisconnect() methods to track the
 /// USB devAddr value of each connected MIDI device.
 ///
-/// This implementation only supports one USB MIDI host port
-/// because that is all TinyUSB supports.
+/// Each object manages the devices attached to the root port passed to
+/// begin(). To use more than one root port (for example, the native USB
+/// controller and a PIO USB port), instantiate one object per port with
+/// different names; up to RPPICOMIDI_EZ_USB_MIDI_HOST_MAX_INSTANCES (2 by
+/// default) objects may be started. TinyUSB assigns device addresses across
+/// all root ports, so the addresses of two objects' devices never collide.
+/// All objects share the usb_midi_host driver buffers, so they must use the
+/// same MidiRxBufsize, MidiTxBufsize and MaxCables settings.
 template<class settings>
 class EZ_USB_MIDI_HOST {
 public:
-  EZ_USB_MIDI_HOST() : appOnConnect{nullptr}, appOnDisconnect{nullptr} {
-        rppicomidi_ez_usb_midi_host_set_cbs(onConnect, onDisconnect, onRx, reinterpret_cast<void*>(this));
-        for (uint8_t idx = 0; idx < CFG_TUH_DEVICE_MAX; idx++)
+  EZ_USB_MIDI_HOST() : appOnConnect{nullptr}, appOnDisconnect{nullptr}, appOnRxPackets{nullptr}, appOnStringsReady{nullptr},
+      appOnMessage{nullptr}, drainNextDev{0}, rxTimestamp{0}, stringFetchDev{nullptr} {
+        for (uint8_t idx = 0; idx <= RPPICOMIDI_TUH_MIDI_MAX_DEV_ADDR; idx++) {
           devAddr2DeviceMap[idx] = nullptr;
+          usbDevAddr2DeviceMap[idx] = nullptr;
+        }
+        for (uint8_t phase = 0; phase < ServicePhases; phase++)
+          serviceCostUs[phase] = 0;
+        for (uint8_t idx = 0; idx < RPPICOMIDI_TUH_MIDI_MAX_DEV; idx++) {
+          usbSlotState[idx] = SlotFree;
+          midiSlotLive[idx] = false;
+          devices[idx].setInterfacePool(&interfacePool);
+          devices[idx].setStringArena(&stringArena);
+          devices[idx].setSysExChunker(&sysexChunker);
+          if (dualCore)
+            devices[idx].setCoreQueue(&txQueue);
+        }
     }
-  ~EZ_USB_MIDI_HOST() = default;
+  ~EZ_USB_MIDI_HOST() { rppicomidi_ez_usb_midi_host_clear_cbs(reinterpret_cast<void*>(this)); }
   EZ_USB_MIDI_HOST(EZ_USB_MIDI_HOST const &) = delete;
   void operator=(EZ_USB_MIDI_HOST const &) = delete;
 
+  /// @brief Register this object for the devices on root port rhPort and
+  /// start the USB host stack on that port
+  /// @param cfptr the connect callback, or nullptr
+  /// @param dfptr the disconnect callback, or nullptr
+  /// @return false if RPPICOMIDI_EZ_USB_MIDI_HOST_MAX_INSTANCES other
+  /// objects are already registered; the host stack is not started and
+  /// the object never sees a device
 #ifdef ADAFRUIT_USBH_HOST_H_
-  void begin(Adafruit_USBH_Host* usbHost, uint8_t rhPort, ConnectCallback cfptr, DisconnectCallback dfptr) {
+  bool begin(Adafruit_USBH_Host* usbHost, uint8_t rhPort, ConnectCallback cfptr, DisconnectCallback dfptr) {
     setAppOnConnect(cfptr);
     setAppOnDisconnect(dfptr);
+    if (!rppicomidi_ez_usb_midi_host_set_cbs(rhPort, onConnect, onDisconnect, onRx, reinterpret_cast<void*>(this)))
+      return false;
     tuh_midih_define_limits(settings::MidiRxBufsize, settings::MidiTxBufsize, settings::MaxCables);
     usbHost->begin(rhPort);
+    return true;
   }
 #else
-  void begin(uint8_t rhPort, ConnectCallback cfptr, DisconnectCallback dfptr) {
+  bool begin(uint8_t rhPort, ConnectCallback cfptr, DisconnectCallback dfptr) {
     setAppOnConnect(cfptr);
     setAppOnDisconnect(dfptr);
+    if (!rppicomidi_ez_usb_midi_host_set_cbs(rhPort, onConnect, onDisconnect, onRx, reinterpret_cast<void*>(this)))
+      return false;
     tuh_midih_define_limits(settings::MidiRxBufsize, settings::MidiTxBufsize, settings::MaxCables);
     tuh_init(rhPort);
+    return true;
   }
 #endif
 
@@ -121,7 +186,7 @@ public:
   /// with the devAddr and cable exists (e.g., because the device has been disconnected)
   MIDI_NAMESPACE::MidiInterface<EZ_USB_MIDI_HOST_Transport<settings>, settings>* getMIDIinterface(uint8_t devAddr, uint8_t cable) {
     auto ptr = getDevFromDevAddr(devAddr);
-    return ptr != nullptr ? &(ptr->getMIDIinterface(cable)) : nullptr;
+    return ptr != nullptr ? ptr->getMIDIinterface(cable) : nullptr;
   }
 
   /// @brief Register a callback function to be called when a MIDI device
@@ -142,31 +207,205 @@ public:
   /// to be called when a MIDI device is disconnected
   void unsetAppOnDisconnect() { appOnConnect = nullptr; }
 
+  /// @brief Register a callback function that receives the raw USB MIDI
+  /// event packets from every connected device instead of the MIDI
+  /// Library.
+  ///
+  /// While this callback is registered, the data received callback
+  /// reads the packets out of the usb_midi_host driver receive FIFO
+  /// and hands them to the callback in batches of up to one bulk
+  /// endpoint's worth. The bytes are never copied into the
+  /// EZ_USB_MIDI_HOST_Transport MIDI IN FIFOs and never parsed, so
+  /// readAll() will not trigger any MIDI Library callbacks. The callback
+  /// arguments are the device address, a pointer to the 4-byte aligned
+  /// packet array, the number of 4-byte packets in the array and the
+  /// RPPICOMIDI_EZ_USB_MIDI_HOST_TIME_US() value when the data received
+  /// callback got the packets. The array is only valid until the callback
+  /// returns. Use the EZ_USB_MIDI_HOST_Packet functions to decode the packets.
+  /// @param fptr is a pointer to the callback function to be called
+  void setAppOnRxPackets(RxPacketsCallback fptr) { appOnRxPackets = fptr; }
+
+  /// @brief Unregister the raw USB MIDI packet callback. Received data goes
+  /// to the MIDI Library again.
+  void unsetAppOnRxPackets() { appOnRxPackets = nullptr; }
+
+  /// @brief Register a callback function that receives SysEx messages in
+  /// chunks as they arrive instead of through the MIDI Library. The payload
+  /// bytes of every SysEx message from every connected device skip the MIDI
+  /// IN FIFOs, so SysExMaxSize and MidiRxBufsize only have to fit the
+  /// messages the MIDI Library still parses, and messages of any length can
+  /// be received. Each chunk holds up to EZ_USB_MIDI_HOST_SysExChunker::chunkSize
+  /// bytes; see SysExChunkCallback for the arguments. Chunks arrive from
+  /// the data received callback in single-core mode and from readAll() in
+  /// dual-core mode, so they may arrive before MIDI Library callbacks for
+  /// messages received ahead of them. The raw packet callback, if set,
+  /// gets SysEx packets instead.
+  /// @param fptr is a pointer to the callback function to be called
+  void setAppOnSysExChunk(SysExChunkCallback fptr) { sysexChunker.setCallback(fptr); }
+
+  /// @brief Unregister the SysEx chunk callback. SysEx messages go to the
+  /// MIDI Library again.
+  void unsetAppOnSysExChunk() { sysexChunker.setCallback(nullptr); }
+
+  /// @brief Register a callback function to be called when the
+  /// manufacturer, product and serial strings of a connected device have
+  /// been read. A device is usable as soon as the connect callback runs,
+  /// but its strings are empty until this callback. The library reads the
+  /// strings of one device at a time with control transfers that do not
+  /// block other USB traffic. The callback argument is the device address.
+  /// @param fptr is a pointer to the callback function to be called
+  void setAppOnStringsReady(StringsReadyCallback fptr) { appOnStringsReady = fptr; }
+
+  /// @brief Unregister the strings ready callback
+  void unsetAppOnStringsReady() { appOnStringsReady = nullptr; }
+
+  /// @brief Register one callback function that receives every MIDI IN
+  /// message the MIDI Library parses, from every device and cable.
+  ///
+  /// Register it once, before or after devices connect; there is no need
+  /// to set MIDI Library callbacks on each cable's MidiInterface in the
+  /// connect callback or to call getCurrentReadDevAndCable() and
+  /// getCurrentReadTimestamp(). readAll() calls it right after the read()
+  /// method that parsed the message returns, with the device address, the
+  /// cable number, the receive time stamp and the decoded message; see
+  /// MessageCallback. MIDI Library callbacks set on a MidiInterface are
+  /// still called, before this one. Messages the MIDI interface input
+  /// channel filters out are not passed to it.
+  /// @param fptr is a pointer to the callback function to be called
+  void setAppOnMessage(MessageCallback fptr) { appOnMessage = fptr; }
+
+  /// @brief Unregister the unified MIDI IN message callback
+  void unsetAppOnMessage() { appOnMessage = nullptr; }
+
   /// @brief call the read method for every connected
-  /// device's virtual MIDI IN cable. This will trigger the callback
-  /// for that device.
-  /// @return the number of device/cable combinations that read() returned data
+  /// device's virtual MIDI IN cable that has received data since
+  /// its MIDI IN FIFO was last empty. This will trigger the callback
+  /// for that device. Cables with no unread data are skipped.
+  /// @return a bitmap of the virtual cable numbers for which read()
+  /// returned a message on any device; bit 0 is cable 0. Use
+  /// isMessageAvailableOnCable(devAddr, cable) to find out which devices.
   uint16_t readAll() {
-    uint16_t hasMessage = 0;
+    if (dualCore)
+      dispatchCoreEvents();
+    uint16_t hasMessageBitmap = 0;
+    clearReadyInCables();
     for (uint8_t dev = 0; dev < RPPICOMIDI_TUH_MIDI_MAX_DEV; dev++) {
-      uint8_t nCables = devices[dev].getNumInCables();
-      currentReadDev = devices[dev].getDevAddr();
-      for (uint8_t cable = 0; cable < nCables; cable++) {
-        currentReadCable = cable;
-        if (devices[dev].getMIDIinterface(cable).read()) {
-          hasMessage++;
+      if (isMidiSlotLive(dev) && devices[dev].getPendingInCables() != 0) {
+        currentReadDev = devices[dev].getDevAddr();
+        hasMessageBitmap |= devices[dev].readPendingInCables(currentReadCable, appOnMessage);
+      }
+    }
+    return hasMessageBitmap;
+  }
+
+  /// @brief Like readAll(), but keep reading each connected device's virtual
+  /// MIDI IN cables until their MIDI IN FIFOs are empty or the budget runs
+  /// out, so a burst of messages on one cable is delivered in one call.
+  ///
+  /// A small budget keeps each call short and lets the rest of the main
+  /// loop run sooner; a large one delivers bursts with less delay. When the
+  /// budget runs out, the next call starts with the device after the one it
+  /// stopped at, so one busy device cannot keep the others waiting. In dual-core mode,
+  /// packets that wait in the queue because the MIDI IN FIFOs were full are
+  /// moved to them once the FIFOs have been drained.
+  /// @param maxMessages the most messages to read; 0 means no limit
+  /// @param maxUs stop after the first read() call that ends this many
+  /// microseconds or more after the call started, even in the middle of a
+  /// message; 0 means no limit
+  /// @return the number of bytes still waiting in the MIDI IN FIFOs of all
+  /// devices; 0 if everything was read. In dual-core mode, packets still in
+  /// the queue from the USB host core are not counted.
+  uint32_t readAllDrain(uint32_t maxMessages, uint32_t maxUs = 0) {
+    uint32_t deadline = maxUs != 0 ? RPPICOMIDI_EZ_USB_MIDI_HOST_TIME_US() + maxUs : 0;
+    if (maxMessages == 0)
+      maxMessages = UINT32_MAX;
+    clearReadyInCables();
+    bool more;
+    do {
+      if (dualCore)
+        dispatchCoreEvents();
+      more = false;
+      for (uint8_t idx = 0; idx < RPPICOMIDI_TUH_MIDI_MAX_DEV && maxMessages != 0; idx++) {
+        uint8_t dev = drainNextDev;
+        if (isMidiSlotLive(dev) && devices[dev].getPendingInCables() != 0) {
+          currentReadDev = devices[dev].getDevAddr();
+          more = devices[dev].drainPendingInCables(currentReadCable, appOnMessage, maxMessages, maxUs != 0, deadline) != 0 || more;
         }
+        drainNextDev = (dev + 1) % RPPICOMIDI_TUH_MIDI_MAX_DEV;
       }
+    } while (dualCore && more && maxMessages != 0 && rxQueue.count() != 0);
+    return getInBytesPending();
+  }
+
+  /// @brief Do one main loop's worth of USB MIDI work and return before
+  /// deadlineUs, so USB MIDI can share a loop with work that must run at
+  /// a fixed rate, such as an audio or LED refresh.
+  ///
+  /// The phases run in priority order:
+  /// - tuh_task();
+  /// - writeFlushAll();
+  /// - readAllDrain() until the time left is about what the next phase takes;
+  /// - writeFlushAll() again, to send what the MIDI IN callbacks sent.
+  /// A phase is skipped if the time it took the last time it ran does not
+  /// fit before the deadline. The skipped work waits for the next call.
+  /// Each skip halves the time the phase is expected to take, so a phase
+  /// that once ran long still runs again after a few calls, even if the
+  /// time slice is shorter than that run.
+  /// A phase cannot be stopped once it starts, so a MIDI IN callback that
+  /// takes long can still make service() return late; the report says so.
+  /// In dual-core mode, call this on the MIDI core. The USB host core runs
+  /// tuh_task() in usbHostTask(), so the ServiceUsb phase never runs here.
+  /// @param deadlineUs the RPPICOMIDI_EZ_USB_MIDI_HOST_TIME_US() value to return by
+  /// @return how long each phase took, which phases were skipped and how
+  /// many MIDI IN bytes are left to read
+  EZ_USB_MIDI_HOST_ServiceReport service(uint32_t deadlineUs) {
+    EZ_USB_MIDI_HOST_ServiceReport report{};
+    uint32_t now = RPPICOMIDI_EZ_USB_MIDI_HOST_TIME_US();
+    if (!dualCore && startServicePhase(report, ServiceUsb, now, deadlineUs)) {
+      tuh_task();
+      now = endServicePhase(report, ServiceUsb, now);
+    }
+    if (startServicePhase(report, ServiceTx, now, deadlineUs)) {
+      writeFlushAll();
+      now = endServicePhase(report, ServiceTx, now);
+    }
+    int32_t rxUs = static_cast<int32_t>(deadlineUs - now - serviceCostUs[ServiceTx]);
+    if (rxUs > 0) {
+      report.rxBytesPending = readAllDrain(0, rxUs);
+      now = endServicePhase(report, ServiceRx, now);
     }
-    return hasMessage++;
+    else {
+      report.skippedPhases |= 1u << ServiceRx;
+      report.rxBytesPending = getInBytesPending();
+    }
+    if (startServicePhase(report, ServiceTx, now, deadlineUs)) {
+      writeFlushAll();
+      now = endServicePhase(report, ServiceTx, now);
+    }
+    report.overran = static_cast<int32_t>(now - deadlineUs) > 0;
+    return report;
   }
 
   /// Send as many pending USB MIDI packets as possible to
-  /// the connected MIDI devices
+  /// the connected MIDI devices. Also retries a string descriptor request
+  /// that found the control pipe busy. In dual-core mode, usbHostTask()
+  /// does that on the USB host core, so this only passes waiting
+  /// coalesced messages (see settings::TxCoalesceSlots) and the next part
+  /// of each bulk SysEx message (see EZ_USB_MIDI_HOST_Device::sendSysEx())
+  /// to it.
   void writeFlushAll() {
+    if (dualCore) {
+      for (uint8_t dev = 0; dev < RPPICOMIDI_TUH_MIDI_MAX_DEV; dev++) {
+        if (isMidiSlotLive(dev))
+          devices[dev].writePending();
+      }
+      return;
+    }
+    writePriorityLane();
     for (uint8_t dev = 0; dev < RPPICOMIDI_TUH_MIDI_MAX_DEV; dev++) {
       devices[dev].writeFlush();
     }
+    fetchStrings();
   }
 
   /// @brief decode hasMessageBitmap returned by the readAll function to check
@@ -178,20 +417,23 @@ public:
     return cable < settings::MaxCables && (hasMessageBitmap & (1 << cable)) != 0;
   }
 
+  /// @brief check if a particular virtual MIDI IN cable of a particular device
+  /// had a message during the last call to readAll() or readAllDrain()
+  /// @param devAddr the USB device address of the device
+  /// @param cable the virtual cable number
+  /// @return true if read() returned a message for the device and cable, false otherwise
+  bool isMessageAvailableOnCable(uint8_t devAddr, uint8_t cable) {
+    auto dev = getDevFromDevAddr(devAddr);
+    return dev != nullptr && cable < settings::MaxCables && (dev->getReadyInCables() & (1 << cable)) != 0;
+  }
+
   /// @brief Get access to the EZ_USB_MIDI_HOST_Device object associated with the devAddr
   /// @param devAddr the USB device address of the device
   /// @return a pointer to the associated EZ_USB_MIDI_HOST_Device object or nullptr
   /// if there is no device attached to the devAddr
   EZ_USB_MIDI_HOST_Device<settings>* getDevFromDevAddr(uint8_t devAddr) {
-    if (devAddr == 0) // 0 is an unconfigured device
-        return nullptr;
-    uint8_t idx = 0;
-    EZ_USB_MIDI_HOST_Device<settings>* ptr = nullptr;
-    for (; idx < RPPICOMIDI_TUH_MIDI_MAX_DEV && (devAddr2DeviceMap[idx] == nullptr || devAddr2DeviceMap[idx]->getDevAddr() != devAddr); idx++) {}
-    if (idx < RPPICOMIDI_TUH_MIDI_MAX_DEV && devAddr2DeviceMap[idx] != nullptr && devAddr2DeviceMap[idx]->getDevAddr() == devAddr) {
-      ptr = devAddr2DeviceMap[idx];
-    }
-    return ptr;
+    // devAddr2DeviceMap[0] is always nullptr; 0 is an unconfigured device
+    return devAddr <= RPPICOMIDI_TUH_MIDI_MAX_DEV_ADDR ? devAddr2DeviceMap[devAddr] : nullptr;
   }
 
   /// @brief  Get the current device address and cable used to call the read method from readAll()
@@ -200,19 +442,218 @@ public:
   /// @param cable The cable number from the last read call from readAll()
   void getCurrentReadDevAndCable(uint8_t& devAddr, uint8_t& cable) { devAddr = currentReadDev; cable = currentReadCable; }
 
+  /// @brief Get the time the message a MIDI IN callback is handling arrived.
+  ///
+  /// The time is the RPPICOMIDI_EZ_USB_MIDI_HOST_TIME_US() value when the
+  /// data received callback got the last byte of the message, so the
+  /// difference from the current time is how long the message waited in
+  /// the MIDI IN FIFO. In dual-core mode, it is the time the USB host core
+  /// moved the bytes from the usb_midi_host driver to the queue.
+  /// @return the receive time stamp of the last message the read method
+  /// called from readAll() parsed, in microseconds
+  uint32_t getCurrentReadTimestamp() {
+    auto dev = getDevFromDevAddr(currentReadDev);
+    return dev != nullptr ? dev->getReadTimestamp(currentReadCable) : 0;
+  }
+
   /// @brief get a pointer to the MIDI Interface object associated with the USB device address
   /// and MIDI virtual IN cable number
   /// @param devAddr the USB device address
   /// @param cable the virtual MIDI IN cable number
   /// @return a pointer to the MIDI Interface object associated with the devAddr and cable
-  /// or nullptr if no such interface exists (if, for example, the device was unplugged)
+  /// or nullptr if no such interface exists (if, for example, the device was unplugged
+  /// or settings::MidiInterfacePoolSize objects were already in use when it connected)
   MIDI_NAMESPACE::MidiInterface<EZ_USB_MIDI_HOST_Transport<settings>, settings>* getInterfaceFromDeviceAndCable(uint8_t devAddr, uint8_t cable) {
     auto dev = getDevFromDevAddr(devAddr);
     if (dev != nullptr && cable < settings::MaxCables && (cable < dev->getNumInCables() || cable < dev->getNumOutCables()))
-      return  &dev->getMIDIinterface(cable);
+      return dev->getMIDIinterface(cable);
     return nullptr;
   }
 
+  /// @brief Get the MIDI IN latency histogram of a device's virtual cable. It
+  /// counts the delay from the data received callback to the MIDI IN callback
+  /// (or the raw packet callback) for every message.
+  /// @param devAddr the USB device address of the device
+  /// @param cable the virtual MIDI IN cable number
+  /// @return a pointer to the histogram or nullptr if there is no such device
+  /// or cable or settings::LatencyHistograms is false
+  const EZ_USB_MIDI_HOST_LatencyHistogram* getRxLatency(uint8_t devAddr, uint8_t cable) {
+    auto dev = getDevFromDevAddr(devAddr);
+    return dev != nullptr && cable < dev->getNumInCables() ? dev->getLatencyStats().getRx(cable) : nullptr;
+  }
+
+  /// @brief Get the MIDI OUT latency histogram of a device's virtual cable. It
+  /// counts the delay from the MIDI Library send function to the writeFlushAll()
+  /// call that started the USB transfer of the message's last packet. In
+  /// dual-core mode, the histograms stay empty.
+  /// @param devAddr the USB device address of the device
+  /// @param cable the virtual MIDI OUT cable number
+  /// @return a pointer to the histogram or nullptr if there is no such device
+  /// or cable or settings::LatencyHistograms is false
+  const EZ_USB_MIDI_HOST_LatencyHistogram* getTxLatency(uint8_t devAddr, uint8_t cable) {
+    auto dev = getDevFromDevAddr(devAddr);
+    return dev != nullptr && cable < dev->getNumOutCables() ? dev->getLatencyStats().getTx(cable) : nullptr;
+  }
+
+  /// @brief Clear the MIDI IN and MIDI OUT latency histograms of a device.
+  /// Connecting a device also clears them.
+  /// @param devAddr the USB device address of the device
+  void resetLatency(uint8_t devAddr) {
+    auto dev = getDevFromDevAddr(devAddr);
+    if (dev != nullptr)
+      dev->getLatencyStats().reset();
+  }
+
+  /// @brief Get the MIDI Clock analyzer of a device's virtual cable. It times
+  /// every MIDI Clock message with the time its bulk transfer arrived, before
+  /// the MIDI IN FIFO, the MIDI Library and MIDI IN filters, and reports the
+  /// filtered tempo, the jitter of the last interval and the number of early
+  /// and missing clocks. In dual-core mode, it uses the time the USB host
+  /// core moved the message from the usb_midi_host driver, and readAll()
+  /// updates it. Connecting a device clears it.
+  /// @param devAddr the USB device address of the device
+  /// @param cable the virtual MIDI IN cable number
+  /// @return a pointer to the analyzer or nullptr if there is no such device
+  /// or cable or settings::RxClockAnalysis is false
+  const EZ_USB_MIDI_HOST_ClockAnalyzer* getRxClock(uint8_t devAddr, uint8_t cable) {
+    auto dev = getDevFromDevAddr(devAddr);
+    return dev != nullptr && cable < dev->getNumInCables() ? dev->getClockAnalyzers().get(cable) : nullptr;
+  }
+
+  /// @brief Forget the tempo and clear the counts of every MIDI Clock analyzer of a device
+  /// @param devAddr the USB device address of the device
+  void resetRxClock(uint8_t devAddr) {
+    auto dev = getDevFromDevAddr(devAddr);
+    if (dev != nullptr)
+      dev->getClockAnalyzers().reset();
+  }
+
+  /// @brief Get the traffic counters of a device. They start at 0 when the
+  /// device connects and count up until it disconnects; the
+  /// disconnect callback may still read them.
+  /// @param devAddr the USB device address of the device
+  /// @return a pointer to the counters or nullptr if there is no such device
+  const EZ_USB_MIDI_HOST_DeviceCounters* getDeviceCounters(uint8_t devAddr) {
+    auto dev = getDevFromDevAddr(devAddr);
+    return dev != nullptr ? &dev->getCounters() : nullptr;
+  }
+
+  /// @brief Get the traffic and drop counters of a device's virtual cable
+  /// @param devAddr the USB device address of the device
+  /// @param cable the virtual MIDI cable number
+  /// @return a pointer to the counters or nullptr if there is no such device or cable
+  const EZ_USB_MIDI_HOST_CableCounters* getCableCounters(uint8_t devAddr, uint8_t cable) {
+    auto dev = getDevFromDevAddr(devAddr);
+    return dev != nullptr && (cable < dev->getNumInCables() || cable < dev->getNumOutCables()) ?
+      &dev->getCableCounters(cable) : nullptr;
+  }
+
+  /// @brief Drop the MIDI messages of the given types and channels that a
+  /// device sends on a virtual MIDI IN cable as soon as they arrive, before
+  /// they take space in the MIDI IN FIFO or reach the MIDI Library or the
+  /// raw packet callback. Routes still forward them. SysEx messages cannot
+  /// be filtered. Filters are cleared when the device connects, so set them
+  /// in the connect callback. Call this from the core that calls readAll().
+  /// @param devAddr the USB device address of the device
+  /// @param cable the virtual MIDI IN cable
+  /// @param typeMask the EZ_USB_MIDI_HOST_Packet::TypeBit values of the message
+  /// types to drop, e.g. EZ_USB_MIDI_HOST_Packet::ActiveSensing | EZ_USB_MIDI_HOST_Packet::Clock
+  /// @param channelMask bit n set drops channel messages on MIDI channel n+1
+  /// @return false if there is no such device or cable
+  bool setInFilter(uint8_t devAddr, uint8_t cable, uint32_t typeMask, uint16_t channelMask) {
+    auto dev = getDevFromDevAddr(devAddr);
+    if (dev == nullptr || cable >= dev->getNumInCables())
+      return false;
+    dev->setInFilter(cable, typeMask, channelMask);
+    return true;
+  }
+
+  /// @brief Choose which messages a device's virtual MIDI IN cable drops
+  /// when its MIDI IN FIFO is full. Messages are always dropped whole, so
+  /// the MIDI Library never sees a message cut short. By default the newest
+  /// messages are dropped. The cable's rxDroppedMessages counter counts
+  /// drops, and its rxHighWaterBytes counter shows how full the FIFO has been,
+  /// to help size settings::MidiRxBufsize. Policies are reset when the device
+  /// connects, so set them in the connect callback. In dual-core mode,
+  /// received data waits in the queue from the USB host core and in the
+  /// usb_midi_host driver while the FIFO is full, so the MIDI IN FIFO never
+  /// drops anything and the policy has no effect. Call this from the core
+  /// that calls readAll().
+  /// @param devAddr the USB device address of the device
+  /// @param cable the virtual MIDI IN cable
+  /// @param policy the overflow policy
+  /// @return false if there is no such device or cable
+  bool setInOverflowPolicy(uint8_t devAddr, uint8_t cable, EZ_USB_MIDI_HOST_InOverflowPolicy policy) {
+    auto dev = getDevFromDevAddr(devAddr);
+    if (dev == nullptr || cable >= dev->getNumInCables())
+      return false;
+    dev->setInOverflowPolicy(cable, policy);
+    return true;
+  }
+
+  /// @brief Forward every USB MIDI packet a device receives on a virtual
+  /// MIDI IN cable to a virtual MIDI OUT cable of a device. The packets
+  /// are forwarded from the data received callback without being parsed,
+  /// and the source device's MIDI IN callbacks still see them. Routes are
+  /// removed when either device disconnects. A route to a cable the
+  /// application also sends SysEx messages on may interleave packets
+  /// with the SysEx message. Call this from the core that calls readAll().
+  /// Requires settings::MaxRoutes > 0.
+  /// @param srcDevAddr the USB device address of the sending device
+  /// @param srcCable the sending device's virtual MIDI IN cable
+  /// @param dstDevAddr the USB device address of the receiving device
+  /// @param dstCable the receiving device's virtual MIDI OUT cable
+  /// @return false if either device or cable does not exist or
+  /// settings::MaxRoutes routes already exist
+  bool addRoute(uint8_t srcDevAddr, uint8_t srcCable, uint8_t dstDevAddr, uint8_t dstCable) {
+    auto src = getDevFromDevAddr(srcDevAddr);
+    auto dst = getDevFromDevAddr(dstDevAddr);
+    if (src == nullptr || dst == nullptr || srcCable >= src->getNumInCables() || dstCable >= dst->getNumOutCables())
+      return false;
+    return router.add(srcDevAddr, srcCable, dstDevAddr, dstCable);
+  }
+
+  /// @brief Remove a route addRoute() added. Call this from the core that calls readAll().
+  /// @return false if there is no such route
+  bool removeRoute(uint8_t srcDevAddr, uint8_t srcCable, uint8_t dstDevAddr, uint8_t dstCable) {
+    return router.remove(srcDevAddr, srcCable, dstDevAddr, dstCable);
+  }
+
+  /// @brief Remove every route from or to a device. Call this from the core that calls readAll().
+  void removeRoutes(uint8_t devAddr) { router.removeDevice(devAddr); }
+
+  /// @return the number of routes
+  unsigned getRouteCount() const { return router.getRouteCount(); }
+
+  /// @brief Run the USB host. In dual-core mode, call this function
+  /// repeatedly from the main loop of the USB host core instead of
+  /// calling tuh_task(). The core that calls this function must also
+  /// be the core that called begin().
+  ///
+  /// In dual-core mode, the USB host core owns TinyUSB and the
+  /// usb_midi_host driver. The MIDI core calls readAll() to run the
+  /// connect, disconnect and MIDI IN callbacks and sends MIDI messages
+  /// with the MIDI Library as usual. Data passes between the cores
+  /// through two single-producer, single-consumer queues, so neither core
+  /// ever waits for the other. Set settings::CoreQueueDepth to enable
+  /// dual-core mode. In single-core mode, this function just calls tuh_task().
+  void usbHostTask() {
+    tuh_task();
+    if (dualCore) {
+      for (uint8_t idx = 0; idx < RPPICOMIDI_TUH_MIDI_MAX_DEV; idx++) {
+        if (usbSlotState[idx] == SlotConnected)
+          queueRxPackets(devices + idx, RPPICOMIDI_EZ_USB_MIDI_HOST_TIME_US());
+      }
+      writePriorityLane();
+      writeTxQueue();
+      for (uint8_t idx = 0; idx < RPPICOMIDI_TUH_MIDI_MAX_DEV; idx++) {
+        if (usbSlotState[idx] == SlotConnected)
+          devices[idx].writeFlush();
+      }
+      fetchStrings();
+    }
+  }
+
   // The following 3 functions should only be used by the tuh_midi_*_cb()
   // callback functions in file EZ_USB_MIDI_HOST.cpp.
   // They are declared public because the tuh_midi_*cb() callbacks are not
@@ -220,58 +661,490 @@ public:
   // function.
   static void onConnect(uint8_t devAddr, uint8_t nInCables, uint16_t nOutCables, void* inst) {
     auto me = reinterpret_cast<EZ_USB_MIDI_HOST<settings>*>(inst);
+    if (dualCore) {
+      me->queueConnect(devAddr, nInCables, nOutCables);
+      return;
+    }
     // try to allocate a EZ_USB_MIDI_HOST_Device object for the connected device
+    if (devAddr == 0 || devAddr > RPPICOMIDI_TUH_MIDI_MAX_DEV_ADDR || me->devAddr2DeviceMap[devAddr] != nullptr)
+      return;
     uint8_t idx = 0;
-    for (; idx < RPPICOMIDI_TUH_MIDI_MAX_DEV && me->devAddr2DeviceMap[idx] != nullptr; idx++) {}
-    if (idx < RPPICOMIDI_TUH_MIDI_MAX_DEV && me->devAddr2DeviceMap[idx] == nullptr) {
-      me->devAddr2DeviceMap[idx] = me->devices + idx;
-      me->devAddr2DeviceMap[idx]->onConnect(devAddr, nInCables, nOutCables);
+    for (; idx < RPPICOMIDI_TUH_MIDI_MAX_DEV && me->usbSlotState[idx] != SlotFree; idx++) {}
+    if (idx < RPPICOMIDI_TUH_MIDI_MAX_DEV) {
+      me->usbSlotState[idx] = SlotConnected;
+      me->devAddr2DeviceMap[devAddr] = me->devices + idx;
+      me->devices[idx].onConnect(devAddr, nInCables, nOutCables);
       if (me->appOnConnect) me->appOnConnect(devAddr, nInCables, nOutCables);
+      me->startStrings(me->devices + idx);
     }
   }
   static void onDisconnect(uint8_t devAddr, void* inst) {
     auto me = reinterpret_cast<EZ_USB_MIDI_HOST<settings>*>(inst);
-    // find the EZ_USB_MIDI_HOST_Device object allocated for this device
-    auto ptr = me->getDevFromDevAddr(devAddr);
-    if (ptr != nullptr) {
-    ptr->onDisconnect(devAddr);
-    if (me->appOnDisconnect)
-      me->appOnDisconnect(devAddr);
-    uint8_t idx = 0;
-    for (; idx < RPPICOMIDI_TUH_MIDI_MAX_DEV && (me->devAddr2DeviceMap[idx] == nullptr || me->devAddr2DeviceMap[idx]->getDevAddr() != devAddr); idx++) {}
-      if (idx < RPPICOMIDI_TUH_MIDI_MAX_DEV && me->devAddr2DeviceMap[idx] != nullptr && me->devAddr2DeviceMap[idx]->getDevAddr() == devAddr) {
-        me->devAddr2DeviceMap[idx] = nullptr;
-      }
+    if (dualCore) {
+      me->queueDisconnect(devAddr);
+      return;
     }
+    me->removeDevice(devAddr);
   }
   static void onRx(uint8_t devAddr, uint32_t numPackets, void* inst) {
     auto me = reinterpret_cast<EZ_USB_MIDI_HOST<settings>*>(inst);
     if (numPackets != 0)
     {
+      uint32_t timestamp = RPPICOMIDI_EZ_USB_MIDI_HOST_TIME_US();
+      if (dualCore) {
+        auto dev = devAddr <= RPPICOMIDI_TUH_MIDI_MAX_DEV_ADDR ? me->usbDevAddr2DeviceMap[devAddr] : nullptr;
+        if (dev != nullptr)
+          me->queueRxPackets(dev, timestamp);
+        return;
+      }
+      if (me->appOnRxPackets != nullptr) {
+        me->readPackets(devAddr, timestamp);
+        return;
+      }
+      auto dev = me->getDevFromDevAddr(devAddr);
+      if (dev != nullptr)
+        dev->getCounters().rxPackets.add(numPackets);
+      if (dev != nullptr && (me->router.isRouted(devAddr) || dev->hasInFilters() || me->sysexChunker.isEnabled())) {
+        me->readPacketsToInFIFO(dev, timestamp);
+        return;
+      }
       uint8_t cable;
       uint8_t buffer[48];
       while (1) {
         uint16_t bytesRead = tuh_midi_stream_read(devAddr, &cable, buffer, sizeof(buffer));
         if (bytesRead == 0)
           return;
-        auto dev = me->getDevFromDevAddr(devAddr);
         if (dev != nullptr) {
-          dev->writeToInFIFO(cable, buffer, bytesRead);
+          if (settings::RxClockAnalysis)
+            dev->analyzeRxClock(cable, buffer, bytesRead, timestamp);
+          dev->writeToInFIFO(cable, buffer, bytesRead, timestamp);
         }
       }
     }
   }
 private:
+  static const bool dualCore = settings::CoreQueueDepth > 0;
+  using CoreQueue = typename EZ_USB_MIDI_HOST_Transport<settings>::CoreQueue;
+  enum SlotState : uint8_t { SlotFree, SlotConnected, SlotDisconnecting };
+
+  /// @return true if the MIDI core may touch devices[idx]. In dual-core
+  /// mode, the USB host core owns a slot from the time it configures it
+  /// until the MIDI core reads its Connect event, and again from the
+  /// time the MIDI core pushes its Release event.
+  bool isMidiSlotLive(uint8_t idx) const { return !dualCore || midiSlotLive[idx]; }
+
+  /// @brief Unconfigure the EZ_USB_MIDI_HOST_Device object allocated to devAddr
+  /// and make it available for the next connected device
+  void removeDevice(uint8_t devAddr) {
+    // find the EZ_USB_MIDI_HOST_Device object allocated for this device
+    auto ptr = getDevFromDevAddr(devAddr);
+    if (ptr != nullptr) {
+      if (!dualCore)
+        stopStrings(ptr);
+      ptr->onDisconnect(devAddr);
+      router.removeDevice(devAddr);
+      if (appOnDisconnect)
+        appOnDisconnect(devAddr);
+      // In dual-core mode, the USB host core does this when the slot is released
+      if (!dualCore) {
+        ptr->unbindInterfaces();
+        ptr->releaseStrings();
+        usbSlotState[ptr - devices] = SlotFree;
+      }
+      devAddr2DeviceMap[devAddr] = nullptr;
+    }
+  }
+
+  /// @brief USB host core: configure a free EZ_USB_MIDI_HOST_Device object for
+  /// the connected device and tell the MIDI core about it. The MIDI core
+  /// does not see the device until it reads the event.
+  void queueConnect(uint8_t devAddr, uint8_t nInCables, uint16_t nOutCables) {
+    if (devAddr == 0 || devAddr > RPPICOMIDI_TUH_MIDI_MAX_DEV_ADDR)
+      return;
+    uint8_t idx = 0;
+    for (; idx < RPPICOMIDI_TUH_MIDI_MAX_DEV && usbSlotState[idx] != SlotFree; idx++) {}
+    if (idx < RPPICOMIDI_TUH_MIDI_MAX_DEV) {
+      usbSlotState[idx] = SlotConnected;
+      usbDevAddr2DeviceMap[devAddr] = devices + idx;
+      devices[idx].onConnect(devAddr, nInCables, nOutCables);
+      EZ_USB_MIDI_HOST_CoreEvent event;
+      event.type = EZ_USB_MIDI_HOST_CoreEvent::Connect;
+      event.devAddr = devAddr;
+      event.arg = idx;
+      event.data[0] = nInCables;
+      event.data[1] = nOutCables;
+      // Always succeeds: each slot has at most one Connect, one StringsReady
+      // and one Disconnect in flight, and coreQueueReserve entries are kept for them
+      rxQueue.push(event);
+      startStrings(devices + idx);
+    }
+  }
+
+  /// @brief USB host core: tell the MIDI core the device is gone. The slot
+  /// stays in use until the MIDI core releases it.
+  void queueDisconnect(uint8_t devAddr) {
+    auto dev = devAddr <= RPPICOMIDI_TUH_MIDI_MAX_DEV_ADDR ? usbDevAddr2DeviceMap[devAddr] : nullptr;
+    if (dev != nullptr) {
+      uint8_t idx = dev - devices;
+      usbDevAddr2DeviceMap[devAddr] = nullptr;
+      usbSlotState[idx] = SlotDisconnecting;
+      stopStrings(dev);
+      EZ_USB_MIDI_HOST_CoreEvent event;
+      event.type = EZ_USB_MIDI_HOST_CoreEvent::Disconnect;
+      event.devAddr = devAddr;
+      event.arg = idx;
+      rxQueue.push(event);
+    }
+  }
+
+  /// @brief Finds the EZ_USB_MIDI_HOST_Device of a device address as the
+  /// USB host core sees it; the router writes forwarded packets through it
+  struct UsbDeviceLookup {
+    EZ_USB_MIDI_HOST<settings>* me;
+    EZ_USB_MIDI_HOST_Device<settings>* operator()(uint8_t devAddr) const {
+      if (devAddr > RPPICOMIDI_TUH_MIDI_MAX_DEV_ADDR)
+        return nullptr;
+      return dualCore ? me->usbDevAddr2DeviceMap[devAddr] : me->devAddr2DeviceMap[devAddr];
+    }
+  };
+  UsbDeviceLookup usbDeviceLookup() { return UsbDeviceLookup{this}; }
+
+  /// @brief USB host core: move USB MIDI packets from the driver receive
+  /// FIFO to the queue until either is empty. Packets that do not fit
+  /// wait in the driver until the next call. An RxTime event with the
+  /// time stamp goes ahead of the packets. Packets on routed cables are
+  /// forwarded as they leave the driver.
+  void queueRxPackets(EZ_USB_MIDI_HOST_Device<settings>* dev, uint32_t timestamp) {
+    uint8_t devAddr = dev->getDevAddr();
+    EZ_USB_MIDI_HOST_CoreEvent event;
+    event.type = EZ_USB_MIDI_HOST_CoreEvent::RxPacket;
+    event.devAddr = devAddr;
+    event.arg = 0;
+    bool stamped = false;
+    while (rxQueue.spaceAvailable() > coreQueueReserve + (stamped ? 0 : 1) && tuh_midi_packet_read(devAddr, event.data)) {
+      if (!stamped) {
+        EZ_USB_MIDI_HOST_CoreEvent timeEvent;
+        timeEvent.type = EZ_USB_MIDI_HOST_CoreEvent::RxTime;
+        timeEvent.devAddr = devAddr;
+        for (uint8_t idx = 0; idx < 4; idx++)
+          timeEvent.data[idx] = (timestamp >> (8 * idx)) & 0xff;
+        rxQueue.push(timeEvent);
+        stamped = true;
+      }
+      router.forward(devAddr, event.data, dev->getCounters(), usbDeviceLookup());
+      if (!dev->isFilteredOut(event.data)) {
+        rxQueue.push(event);
+        continue;
+      }
+      dev->getCounters().rxFilteredPackets.add(1);
+      if (settings::RxClockAnalysis && event.data[1] >= 0xF8) {
+        // the MIDI core owns the clock analyzers
+        event.arg = 1;
+        rxQueue.push(event);
+        event.arg = 0;
+      }
+    }
+    if (stamped && router.isRouted(devAddr))
+      router.flush(devAddr, usbDeviceLookup());
+  }
+
+  /// @brief USB host core: write queued MIDI OUT bytes and packets to the driver and
+  /// free device slots the MIDI core has released
+  void writeTxQueue() {
+    EZ_USB_MIDI_HOST_CoreEvent* event;
+    while ((event = txQueue.peek()) != nullptr) {
+      if (event->type == EZ_USB_MIDI_HOST_CoreEvent::Release) {
+        devices[event->arg].unbindInterfaces();
+        devices[event->arg].releaseStrings();
+        usbSlotState[event->arg] = SlotFree;
+      }
+      else if (event->type == EZ_USB_MIDI_HOST_CoreEvent::TxBytes) {
+        uint32_t nWritten = tuh_midi_stream_write(event->devAddr, event->arg, event->data, event->nBytes);
+        if (nWritten < event->nBytes && tuh_midi_configured(event->devAddr)) {
+          // Driver transmit FIFO is full; keep the rest for next time
+          event->nBytes -= nWritten;
+          for (uint8_t idx = 0; idx < event->nBytes; idx++)
+            event->data[idx] = event->data[idx + nWritten];
+          return;
+        }
+      }
+      else if (event->type == EZ_USB_MIDI_HOST_CoreEvent::TxPacket) {
+        if (!tuh_midi_packet_write(event->devAddr, event->data) && tuh_midi_configured(event->devAddr))
+          return; // Driver transmit FIFO is full; try again next time
+      }
+      txQueue.pop();
+    }
+  }
+
+  /// @brief USB host core: write the packets waiting in every device's
+  /// priority lane to the driver ahead of everything else not yet in the
+  /// driver transmit FIFO. A device whose FIFO is full keeps its packets
+  /// for next time without holding up the other devices.
+  void writePriorityLane() {
+    for (uint8_t idx = 0; idx < RPPICOMIDI_TUH_MIDI_MAX_DEV; idx++)
+      devices[idx].writePriorityLane();
+  }
+
+  /// @brief MIDI core: handle the events the USB host core has queued so far.
+  /// Stops early if a MIDI IN FIFO is too full for the next packet; the
+  /// packet waits in the queue until readAll() has made room for it.
+  void dispatchCoreEvents() {
+    alignas(4) uint8_t packets[64];
+    uint32_t nPackets = 0;
+    uint8_t packetsDevAddr = 0;
+    EZ_USB_MIDI_HOST_CoreEvent* event;
+    for (unsigned nEvents = rxQueue.count(); nEvents != 0 && (event = rxQueue.peek()) != nullptr; nEvents--) {
+      if (nPackets != 0 && (event->type != EZ_USB_MIDI_HOST_CoreEvent::RxPacket ||
+          event->devAddr != packetsDevAddr || nPackets == sizeof(packets) / 4)) {
+        callAppOnRxPackets(packetsDevAddr, packets, nPackets, rxTimestamp);
+        nPackets = 0;
+      }
+      if (event->type == EZ_USB_MIDI_HOST_CoreEvent::Connect) {
+        midiSlotLive[event->arg] = true;
+        devAddr2DeviceMap[event->devAddr] = devices + event->arg;
+        if (appOnConnect) appOnConnect(event->devAddr, event->data[0], event->data[1]);
+      }
+      else if (event->type == EZ_USB_MIDI_HOST_CoreEvent::StringsReady) {
+        if (appOnStringsReady && getDevFromDevAddr(event->devAddr) != nullptr)
+          appOnStringsReady(event->devAddr);
+      }
+      else if (event->type == EZ_USB_MIDI_HOST_CoreEvent::Disconnect) {
+        removeDevice(event->devAddr);
+        // The USB host core may reconfigure the slot as soon as it reads the Release
+        midiSlotLive[event->arg] = false;
+        EZ_USB_MIDI_HOST_CoreEvent release;
+        release.type = EZ_USB_MIDI_HOST_CoreEvent::Release;
+        release.arg = event->arg;
+        txQueue.push(release); // always succeeds; see queueConnect()
+      }
+      else if (event->type == EZ_USB_MIDI_HOST_CoreEvent::RxTime) {
+        rxTimestamp = 0;
+        for (uint8_t idx = 0; idx < 4; idx++)
+          rxTimestamp |= static_cast<uint32_t>(event->data[idx]) << (8 * idx);
+      }
+      else if (event->type == EZ_USB_MIDI_HOST_CoreEvent::RxPacket) {
+        auto dev = getDevFromDevAddr(event->devAddr);
+        if (dev != nullptr && event->arg != 0) {
+          dev->analyzeRxClock(event->data, rxTimestamp);
+        }
+        else if (dev != nullptr) {
+          if (appOnRxPackets == nullptr && !dev->canWritePacketToInFIFO(event->data))
+            break;
+          if (settings::RxClockAnalysis)
+            dev->analyzeRxClock(event->data, rxTimestamp);
+          if (appOnRxPackets != nullptr) {
+            packetsDevAddr = event->devAddr;
+            for (uint8_t idx = 0; idx < 4; idx++)
+              packets[4 * nPackets + idx] = event->data[idx];
+            ++nPackets;
+          }
+          else {
+            dev->writePacketToInFIFO(event->data, rxTimestamp);
+          }
+          dev->getCounters().rxPackets.add(1);
+        }
+      }
+      rxQueue.pop();
+    }
+    if (nPackets != 0)
+      callAppOnRxPackets(packetsDevAddr, packets, nPackets, rxTimestamp);
+    sysexChunker.flush();
+  }
+
+  /// @brief Start a readAll() pass: no cable of any device has returned a message yet
+  void clearReadyInCables() {
+    for (uint8_t dev = 0; dev < RPPICOMIDI_TUH_MIDI_MAX_DEV; dev++) {
+      if (isMidiSlotLive(dev))
+        devices[dev].clearReadyInCables();
+    }
+  }
+
+  /// @return the number of bytes waiting in the MIDI IN FIFOs of all devices
+  uint32_t getInBytesPending() {
+    uint32_t nBytes = 0;
+    for (uint8_t dev = 0; dev < RPPICOMIDI_TUH_MIDI_MAX_DEV; dev++) {
+      if (isMidiSlotLive(dev))
+        nBytes += devices[dev].getInBytesPending();
+    }
+    return nBytes;
+  }
+
+  /// @return true if a service() phase is expected to end before the deadline;
+  /// otherwise mark it skipped and halve the time it is expected to take, so
+  /// one slow run cannot keep it from running in a short time slice forever
+  bool startServicePhase(EZ_USB_MIDI_HOST_ServiceReport& report, EZ_USB_MIDI_HOST_ServicePhase phase, uint32_t now, uint32_t deadlineUs) {
+    if (static_cast<int32_t>(deadlineUs - now) > static_cast<int32_t>(serviceCostUs[phase]))
+      return true;
+    report.skippedPhases |= 1u << phase;
+    serviceCostUs[phase] /= 2;
+    return false;
+  }
+
+  /// @brief Record how long a service() phase that started at startUs took
+  /// @return the current time
+  uint32_t endServicePhase(EZ_USB_MIDI_HOST_ServiceReport& report, EZ_USB_MIDI_HOST_ServicePhase phase, uint32_t startUs) {
+    uint32_t now = RPPICOMIDI_EZ_USB_MIDI_HOST_TIME_US();
+    serviceCostUs[phase] = now - startUs;
+    report.phaseUs[phase] += now - startUs;
+    return now;
+  }
+
+  /// @brief USB host core: fetch the strings of a device that just
+  /// connected, or report them ready if it has none
+  void startStrings(EZ_USB_MIDI_HOST_Device<settings>* dev) {
+    if (dev->needsStrings())
+      fetchStrings();
+    else
+      onStringsReady(dev);
+  }
+
+  /// @brief USB host core: stop fetching the strings of a device that
+  /// disconnected and move on to the next device. TinyUSB drops the
+  /// device's control transfer without calling the completion callback.
+  void stopStrings(EZ_USB_MIDI_HOST_Device<settings>* dev) {
+    dev->cancelStrings();
+    if (stringFetchDev == dev) {
+      stringFetchDev = nullptr;
+      fetchStrings();
+    }
+  }
+
+  /// @brief USB host core: if no string descriptor transfer is in flight,
+  /// start the next one. If the control pipe is busy, a later call retries.
+  void fetchStrings() {
+    if (stringFetchDev != nullptr)
+      return;
+    for (uint8_t idx = 0; idx < RPPICOMIDI_TUH_MIDI_MAX_DEV; idx++) {
+      if (devices[idx].needsStrings()) {
+        if (devices[idx].requestNextString(stringDescBuf, sizeof(stringDescBuf), onStringXferComplete, reinterpret_cast<uintptr_t>(this)))
+          stringFetchDev = devices + idx;
+        return;
+      }
+    }
+  }
+
+  /// @brief USB host core: TinyUSB calls this when a string descriptor transfer completes
+  static void onStringXferComplete(tuh_xfer_t* xfer) {
+    auto me = reinterpret_cast<EZ_USB_MIDI_HOST<settings>*>(xfer->user_data);
+    auto dev = me->stringFetchDev;
+    if (dev == nullptr || dev->getDevAddr() != xfer->daddr)
+      return;
+    me->stringFetchDev = nullptr;
+    if (dev->onStringReceived(xfer->result, me->stringDescBuf))
+      me->onStringsReady(dev);
+    me->fetchStrings();
+  }
+
+  /// @brief USB host core: run the strings ready callback, on the MIDI core in dual-core mode
+  void onStringsReady(EZ_USB_MIDI_HOST_Device<settings>* dev) {
+    if (dualCore) {
+      EZ_USB_MIDI_HOST_CoreEvent event;
+      event.type = EZ_USB_MIDI_HOST_CoreEvent::StringsReady;
+      event.devAddr = dev->getDevAddr();
+      rxQueue.push(event); // always succeeds; see queueConnect()
+    }
+    else if (appOnStringsReady) {
+      appOnStringsReady(dev->getDevAddr());
+    }
+  }
+
+  /// @brief Call the raw packet callback and count the packets in the
+  /// MIDI IN latency histograms
+  void callAppOnRxPackets(uint8_t devAddr, const uint8_t* packets, uint32_t nPackets, uint32_t timestamp) {
+    if (settings::LatencyHistograms) {
+      auto dev = getDevFromDevAddr(devAddr);
+      if (dev != nullptr)
+        dev->addRxPacketsLatency(packets, nPackets, RPPICOMIDI_EZ_USB_MIDI_HOST_TIME_US() - timestamp);
+    }
+    appOnRxPackets(devAddr, packets, nPackets, timestamp);
+  }
+
+  /// @brief Pass all USB MIDI packets waiting in the driver receive
+  /// FIFO for devAddr to the raw packet callback
+  /// @param timestamp the time the data received callback ran
+  void readPackets(uint8_t devAddr, uint32_t timestamp) {
+    auto dev = getDevFromDevAddr(devAddr);
+    if (dev == nullptr)
+      return;
+    // One full speed bulk endpoint's worth of packets
+    alignas(4) uint8_t packets[64];
+    uint32_t nPackets = 0;
+    while (tuh_midi_packet_read(devAddr, packets + 4 * nPackets)) {
+      router.forward(devAddr, packets + 4 * nPackets, dev->getCounters(), usbDeviceLookup());
+      dev->getCounters().rxPackets.add(1);
+      if (settings::RxClockAnalysis)
+        dev->analyzeRxClock(packets + 4 * nPackets, timestamp);
+      if (dev->isFilteredOut(packets + 4 * nPackets)) {
+        dev->getCounters().rxFilteredPackets.add(1);
+        continue;
+      }
+      if (++nPackets == sizeof(packets) / 4) {
+        callAppOnRxPackets(devAddr, packets, nPackets, timestamp);
+        nPackets = 0;
+      }
+    }
+    if (nPackets != 0)
+      callAppOnRxPackets(devAddr, packets, nPackets, timestamp);
+    if (router.isRouted(devAddr))
+      router.flush(devAddr, usbDeviceLookup());
+  }
+
+  /// @brief Forward the USB MIDI packets waiting in the driver receive
+  /// FIFO of a device with routes or filters, or of any device in SysEx
+  /// streaming mode, and write the packets its filters pass to its MIDI
+  /// IN FIFOs or the SysEx chunk callback
+  /// @param timestamp the time the data received callback ran
+  void readPacketsToInFIFO(EZ_USB_MIDI_HOST_Device<settings>* dev, uint32_t timestamp) {
+    uint8_t devAddr = dev->getDevAddr();
+    uint8_t packet[4];
+    while (tuh_midi_packet_read(devAddr, packet)) {
+      router.forward(devAddr, packet, dev->getCounters(), usbDeviceLookup());
+      if (settings::RxClockAnalysis)
+        dev->analyzeRxClock(packet, timestamp);
+      if (dev->isFilteredOut(packet))
+        dev->getCounters().rxFilteredPackets.add(1);
+      else
+        dev->writePacketToInFIFO(packet, timestamp);
+    }
+    sysexChunker.flush();
+    if (router.isRouted(devAddr))
+      router.flush(devAddr, usbDeviceLookup());
+  }
+
+  /// Declared before devices so they outlive them
+  EZ_USB_MIDI_HOST_InterfacePool<settings> interfacePool;
+  EZ_USB_MIDI_HOST_StringArena<settings::StringArenaSize> stringArena;
+  EZ_USB_MIDI_HOST_SysExChunker sysexChunker; //!< core that calls readAll() only
   EZ_USB_MIDI_HOST_Device<settings> devices[RPPICOMIDI_TUH_MIDI_MAX_DEV];
+  EZ_USB_MIDI_HOST_Router<settings> router;
   ConnectCallback appOnConnect;
   DisconnectCallback appOnDisconnect;
+  RxPacketsCallback appOnRxPackets;
+  StringsReadyCallback appOnStringsReady;
+  MessageCallback appOnMessage;
   uint8_t currentReadDev;
   uint8_t currentReadCable;
+  uint8_t drainNextDev; //!< the first device readAllDrain() reads
+  uint32_t serviceCostUs[ServicePhases]; //!< how long each service() phase took the last time it ran
+
+  // usbSlotState[idx] is the USB host core's view of devices[idx]. In
+  // dual-core mode, devAddr2DeviceMap is the MIDI core's view.
+  SlotState usbSlotState[RPPICOMIDI_TUH_MIDI_MAX_DEV];
+  bool midiSlotLive[RPPICOMIDI_TUH_MIDI_MAX_DEV]; //!< dual-core mode, MIDI core only; see isMidiSlotLive()
+  EZ_USB_MIDI_HOST_Device<settings>* usbDevAddr2DeviceMap[RPPICOMIDI_TUH_MIDI_MAX_DEV_ADDR + 1]; //!< dual-core mode only
+  CoreQueue rxQueue; //!< USB host core to MIDI core
+  CoreQueue txQueue; //!< MIDI core to USB host core
+  uint32_t rxTimestamp; //!< MIDI core: time stamp from the last RxTime event
+
+  // String descriptors are fetched on the USB host core, one at a time
+  EZ_USB_MIDI_HOST_Device<settings>* stringFetchDev; //!< the device with a transfer in flight, or nullptr
+  uint16_t stringDescBuf[128]; //!< the longest possible string descriptor
 
-  // devAddr2DeviceMap[idx] == a pointer to an address if device idx
-  // has been connected or nullptr if not.
-  // The problem this solves is RPPICOMIDI_TUH_MIDI_MAX_DEV < CFG_TUH_DEVICE_MAX
-  EZ_USB_MIDI_HOST_Device<settings>* devAddr2DeviceMap[CFG_TUH_DEVICE_MAX];
+  // devAddr2DeviceMap[devAddr] points to the device object allocated to
+  // the device at USB address devAddr, or is nullptr if there is none.
+  // Indexing by address keeps getDevFromDevAddr() to a single load even
+  // though RPPICOMIDI_TUH_MIDI_MAX_DEV may be less than the number of addresses.
+  EZ_USB_MIDI_HOST_Device<settings>* devAddr2DeviceMap[RPPICOMIDI_TUH_MIDI_MAX_DEV_ADDR + 1];
 };
 
 END_EZ_USB_MIDI_HOST_NAMESPACE
@@ -0,0 +1,251 @@
+/*
+ * @file EZ_USB_MIDI_HOST_ClockAnalyzer.h
+ * @brief Optional tempo and jitter analysis of received MIDI Clock messages
+ *
+ * Set RxClockAnalysis to true in the settings class to time every MIDI
+ * Clock message each device sends on each virtual cable with the receive
+ * time stamp of its bulk transfer, before the message waits in a MIDI IN
+ * FIFO or passes through the MIDI Library. The analyzer keeps a filtered
+ * clock interval, from which it reports the tempo, and counts clocks that
+ * arrive early (bursts) or are missing (drops). When RxClockAnalysis is
+ * false, the analyzers have no data and every method is an empty inline
+ * function.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#pragma once
+#include <cstdint>
+#include "EZ_USB_MIDI_HOST_namespace.h"
+
+BEGIN_EZ_USB_MIDI_HOST_NAMESPACE
+
+/// @brief The MIDI Clock statistics of one virtual MIDI IN cable. A clock
+/// that arrives less than half an interval after the one before it is a
+/// burst; it does not change the tempo. A gap of whole intervals means
+/// clocks are missing; a burst right after the gap supplies them late, and
+/// the rest count as drops when the next on-time clock arrives. Eight
+/// unexplained bursts, gaps or intervals more than a quarter off in a row
+/// mean the tempo changed, so the analyzer starts over. Start, Continue and Stop messages, gaps longer
+/// than maxGapTicks intervals and intervals longer than maxIntervalUs restart the timing but keep the tempo.
+class EZ_USB_MIDI_HOST_ClockAnalyzer {
+public:
+  static const uint8_t resyncAnomalies = 8; //!< anomalies in a row that mean the tempo changed
+  static const uint8_t maxGapTicks = 24;    //!< missing clocks, one quarter note, that mean the clock paused
+  /// the longest interval that can be a tick, 10 s (a quarter BPM); longer ones mean the
+  /// clock paused. Keeps the interval times 16 well inside 32 bits.
+  static const uint32_t maxIntervalUs = 10000000;
+
+  EZ_USB_MIDI_HOST_ClockAnalyzer() { reset(); }
+
+  /// @brief Time one MIDI Clock message
+  /// @param timestamp the time the message arrived, in microseconds
+  void onClock(uint32_t timestamp) {
+    ++nClocks;
+    if (!running) {
+      restart(timestamp);
+      running = true;
+      return;
+    }
+    uint32_t interval = timestamp - lastClockUs;
+    if (interval > maxIntervalUs) {
+      restart(timestamp);
+      return;
+    }
+    if (intervalX16 == 0) {
+      // the first interval sets the tempo; a clock that shares the first time stamp waits for it
+      if (interval != 0) {
+        intervalX16 = interval << 4;
+        restart(timestamp);
+      }
+      return;
+    }
+    uint32_t expected = getIntervalUs() != 0 ? getIntervalUs() : 1;
+    if (2ull * interval < expected) {
+      ++nBursts;
+      if (nOwed != 0)
+        --nOwed; // a late clock
+      else
+        onAnomaly(timestamp);
+      return;
+    }
+    nDropped += nOwed;
+    nOwed = 0;
+    uint32_t nIntervals = (interval + expected / 2) / expected;
+    if (nIntervals > maxGapTicks + 1) {
+      restart(timestamp);
+      return;
+    }
+    uint32_t perTick = interval / nIntervals;
+    lastJitterUs = static_cast<int32_t>(perTick - expected);
+    uint32_t absJitter = lastJitterUs < 0 ? -lastJitterUs : lastJitterUs;
+    if (absJitter > maxJitterUs)
+      maxJitterUs = absJitter;
+    nOwed = nIntervals - 1;
+    if (nIntervals > 1 || 4ull * absJitter > expected) {
+      if (onAnomaly(timestamp))
+        return;
+    }
+    else {
+      nAnomalies = 0;
+    }
+    // exponential moving average with a weight of 1/8 for the new interval
+    intervalX16 += (static_cast<int32_t>(perTick << 4) - static_cast<int32_t>(intervalX16)) / 8;
+    lastClockUs = timestamp;
+  }
+
+  /// @brief Start, Continue or Stop: the next clock starts a new interval
+  void onTransport() {
+    running = false;
+    nOwed = 0;
+  }
+
+  /// @brief Forget the tempo and clear the counts
+  void reset() {
+    lastClockUs = 0;
+    intervalX16 = 0;
+    lastJitterUs = 0;
+    maxJitterUs = 0;
+    nClocks = 0;
+    nDropped = 0;
+    nBursts = 0;
+    nOwed = 0;
+    nAnomalies = 0;
+    running = false;
+  }
+
+  /// @return true once the analyzer has a tempo estimate
+  bool hasTempo() const { return intervalX16 != 0; }
+
+  /// @return the filtered time between clocks in microseconds; 0 if no tempo yet
+  uint32_t getIntervalUs() const { return (intervalX16 + 8) >> 4; }
+
+  /// @return the tempo in hundredths of a beat per minute (24 clocks per
+  /// beat), e.g. 12000 for 120 BPM; 0 if no tempo yet
+  uint32_t getBpmX100() const { return intervalX16 != 0 ? 4000000000ul / intervalX16 : 0; }
+
+  /// @return how much longer (positive) or shorter (negative) than the
+  /// filtered interval the last measured interval was, in microseconds
+  int32_t getLastJitterUs() const { return lastJitterUs; }
+
+  /// @return the largest jitter, either way, since the last reset()
+  uint32_t getMaxJitterUs() const { return maxJitterUs; }
+
+  /// @return the time the last on-time clock arrived
+  uint32_t getLastClockUs() const { return lastClockUs; }
+
+  /// @return the number of clocks received since the last reset()
+  uint32_t getClockCount() const { return nClocks; }
+
+  /// @return the number of clocks missing from gaps in the clock, counted
+  /// when the next on-time clock shows they will not arrive late
+  uint32_t getDropCount() const { return nDropped; }
+
+  /// @return the number of clocks that arrived less than half an interval
+  /// after the one before
+  uint32_t getBurstCount() const { return nBursts; }
+private:
+  /// Measure the next interval from timestamp
+  void restart(uint32_t timestamp) {
+    lastClockUs = timestamp;
+    nOwed = 0;
+  }
+
+  /// Count a burst, gap or interval that does not fit the tempo
+  /// @return true if the analyzer started over
+  bool onAnomaly(uint32_t timestamp) {
+    if (++nAnomalies < resyncAnomalies)
+      return false;
+    intervalX16 = 0;
+    nAnomalies = 0;
+    restart(timestamp);
+    return true;
+  }
+
+  uint32_t lastClockUs;
+  uint32_t intervalX16;   //!< the filtered interval in 1/16 microseconds
+  int32_t lastJitterUs;
+  uint32_t maxJitterUs;
+  uint32_t nClocks;
+  uint32_t nDropped;
+  uint32_t nBursts;
+  uint8_t nOwed;          //!< clocks missing from the last gap that may still arrive late
+  uint8_t nAnomalies;     //!< intervals in a row that do not fit the tempo
+  bool running;           //!< false until the first clock after reset() or onTransport()
+};
+
+/// @brief The MIDI Clock analyzers of every virtual MIDI IN cable of one
+/// connected device
+/// @tparam settings the settings class; its MaxCables sets the size
+/// @tparam enabled settings::RxClockAnalysis
+template<class settings, bool enabled = settings::RxClockAnalysis>
+class EZ_USB_MIDI_HOST_ClockAnalyzers {
+public:
+  /// @brief Analyze a received USB MIDI event packet
+  /// @param packet points to the 4 bytes of the packet
+  /// @param timestamp the time the packet arrived
+  void onPacket(const uint8_t* packet, uint32_t timestamp) {
+    if (packet[1] >= 0xF8)
+      onStatus(packet[0] >> 4, packet[1], timestamp);
+  }
+
+  /// @brief Analyze MIDI stream bytes received on a virtual cable. Real-time
+  /// status bytes are the only bytes 0xF8 and higher, so no parsing is needed.
+  void onBytes(uint8_t cable, const uint8_t* bytes, uint16_t nBytes, uint32_t timestamp) {
+    for (uint16_t idx = 0; idx < nBytes; idx++) {
+      if (bytes[idx] >= 0xF8)
+        onStatus(cable, bytes[idx], timestamp);
+    }
+  }
+
+  /// @return the analyzer for the cable
+  const EZ_USB_MIDI_HOST_ClockAnalyzer* get(uint8_t cable) const { return analyzers + cable; }
+
+  /// @brief Clear the analyzers of all cables
+  void reset() {
+    for (unsigned idx = 0; idx < settings::MaxCables; idx++)
+      analyzers[idx].reset();
+  }
+private:
+  void onStatus(uint8_t cable, uint8_t status, uint32_t timestamp) {
+    if (cable >= settings::MaxCables)
+      return;
+    if (status == 0xF8)
+      analyzers[cable].onClock(timestamp);
+    else if (status >= 0xFA && status <= 0xFC)
+      analyzers[cable].onTransport();
+  }
+
+  EZ_USB_MIDI_HOST_ClockAnalyzer analyzers[settings::MaxCables];
+};
+
+/// @brief Clock analysis disabled; uses no memory and no time
+template<class settings>
+class EZ_USB_MIDI_HOST_ClockAnalyzers<settings, false> {
+public:
+  void onPacket(const uint8_t*, uint32_t) { }
+  void onBytes(uint8_t, const uint8_t*, uint16_t, uint32_t) { }
+  const EZ_USB_MIDI_HOST_ClockAnalyzer* get(uint8_t) const { return nullptr; }
+  void reset() { }
+};
+
+END_EZ_USB_MIDI_HOST_NAMESPACE
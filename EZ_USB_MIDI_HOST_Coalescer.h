@@ -0,0 +1,136 @@
+/*
+ * @file EZ_USB_MIDI_HOST_Coalescer.h
+ * @brief Latest-value-wins staging of MIDI OUT control change and pitch
+ * bend messages for one virtual cable
+ *
+ * Motorized faders and LED rings can generate control change and pitch
+ * bend updates faster than a full speed USB endpoint can send them. If
+ * every update goes to the usb_midi_host transmit FIFO, the updates wait
+ * behind each other and the delay grows with the backlog. Instead, each
+ * update waits in a small table until the next flush; a newer value for
+ * the same channel and controller replaces an older one that has not been
+ * sent yet, so at most one value per controller is ever waiting.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#pragma once
+#include <cstdint>
+#include "EZ_USB_MIDI_HOST_namespace.h"
+
+BEGIN_EZ_USB_MIDI_HOST_NAMESPACE
+
+/// @brief A message waiting in an EZ_USB_MIDI_HOST_Coalescer
+struct EZ_USB_MIDI_HOST_CoalescedMessage {
+  uint8_t bytes[3];
+  uint32_t timestamp; //!< when the first value still waiting was written; latency histograms only
+};
+
+/// @brief Up to settings::TxCoalesceSlots control change and pitch bend
+/// messages waiting to go to the MIDI stream, oldest first. Only the core
+/// that runs the MIDI Library may use it. Applications normally do not
+/// use this class.
+template<class settings, bool enabled = (settings::TxCoalesceSlots > 0)>
+class EZ_USB_MIDI_HOST_Coalescer {
+public:
+  static_assert(!settings::UseRunningStatus, "TxCoalesceSlots needs UseRunningStatus false because waiting messages change the status byte");
+  static_assert(settings::TxCoalesceSlots <= 255, "TxCoalesceSlots must be 0 to 255");
+
+  EZ_USB_MIDI_HOST_Coalescer() : nPending(0) { }
+
+  /// @return true if the message is a control change or pitch bend whose
+  /// older values may be dropped. Bank select, data entry and (N)RPN
+  /// number controllers depend on the order of the messages around them,
+  /// and channel mode messages are commands, so they are never coalesced.
+  static bool isCoalescable(const uint8_t* bytes, uint16_t nBytes) {
+    if (nBytes != 3)
+      return false;
+    if ((bytes[0] & 0xF0) == 0xE0)
+      return true;
+    if ((bytes[0] & 0xF0) != 0xB0)
+      return false;
+    uint8_t controller = bytes[1];
+    return controller != 0 && controller != 6 && controller != 32 && controller != 38 &&
+      (controller < 96 || controller > 101) && controller < 120;
+  }
+
+  /// @brief Replace the waiting value for the message's channel and
+  /// controller, or add the message after the others if none is waiting
+  /// @param bytes a message isCoalescable() accepts
+  /// @param timestamp the time the message was written
+  /// @param replaced set to true if a waiting value was replaced
+  /// @return false if the table is full and has no value to replace
+  bool stage(const uint8_t* bytes, uint32_t timestamp, bool& replaced) {
+    for (unsigned idx = 0; idx < nPending; idx++) {
+      uint8_t* waiting = pending[idx].bytes;
+      if (waiting[0] == bytes[0] && ((bytes[0] & 0xF0) == 0xE0 || waiting[1] == bytes[1])) {
+        waiting[1] = bytes[1];
+        waiting[2] = bytes[2];
+        replaced = true;
+        return true;
+      }
+    }
+    if (nPending == settings::TxCoalesceSlots)
+      return false;
+    pending[nPending] = {{bytes[0], bytes[1], bytes[2]}, timestamp};
+    ++nPending;
+    replaced = false;
+    return true;
+  }
+
+  /// @return the number of messages waiting
+  uint8_t getCount() const { return nPending; }
+
+  /// @return the waiting message idx; 0 is the oldest
+  const EZ_USB_MIDI_HOST_CoalescedMessage& getMessage(uint8_t idx) const { return pending[idx]; }
+
+  /// @brief Forget the oldest nMessages messages, usually because they were sent
+  void remove(uint8_t nMessages) {
+    for (unsigned idx = nMessages; idx < nPending; idx++)
+      pending[idx - nMessages] = pending[idx];
+    nPending -= nMessages;
+  }
+
+  /// @brief Forget every waiting message
+  void clear() { nPending = 0; }
+private:
+  EZ_USB_MIDI_HOST_CoalescedMessage pending[settings::TxCoalesceSlots];
+  uint8_t nPending;
+};
+
+/// @brief The EZ_USB_MIDI_HOST_Coalescer when settings::TxCoalesceSlots is 0.
+/// Nothing is coalesced; it uses no memory and no processor time.
+template<class settings>
+class EZ_USB_MIDI_HOST_Coalescer<settings, false> {
+public:
+  static bool isCoalescable(const uint8_t*, uint16_t) { return false; }
+  bool stage(const uint8_t*, uint32_t, bool&) { return false; }
+  uint8_t getCount() const { return 0; }
+  const EZ_USB_MIDI_HOST_CoalescedMessage& getMessage(uint8_t) const {
+    static const EZ_USB_MIDI_HOST_CoalescedMessage none{};
+    return none;
+  }
+  void remove(uint8_t) { }
+  void clear() { }
+};
+
+END_EZ_USB_MIDI_HOST_NAMESPACE
@@ -52,6 +52,28 @@
 #define RPPICOMIDI_TUH_MIDI_MAX_DEV RPPICOMIDI_TUH_MIDI_MAX_DEV_DEFAULT
 #endif
 
+/// Highest USB device address TinyUSB can assign. Hubs use addresses too,
+/// so a MIDI device's address can be larger than RPPICOMIDI_TUH_MIDI_MAX_DEV.
+#ifndef RPPICOMIDI_TUH_MIDI_MAX_DEV_ADDR
+#if defined(CFG_TUH_HUB) && CFG_TUH_HUB
+#define RPPICOMIDI_TUH_MIDI_MAX_DEV_ADDR (CFG_TUH_DEVICE_MAX + CFG_TUH_HUB)
+#else
+#define RPPICOMIDI_TUH_MIDI_MAX_DEV_ADDR CFG_TUH_DEVICE_MAX
+#endif
+#endif
+
+/// Free-running 32-bit microsecond timer used to time stamp received
+/// MIDI data. To use a different timer, define this macro on the compiler
+/// command line or before including EZ_USB_MIDI_HOST.h.
+#ifndef RPPICOMIDI_EZ_USB_MIDI_HOST_TIME_US
+#if ARDUINO
+#define RPPICOMIDI_EZ_USB_MIDI_HOST_TIME_US() static_cast<uint32_t>(micros())
+#else
+#include "pico/time.h"
+#define RPPICOMIDI_EZ_USB_MIDI_HOST_TIME_US() time_us_32()
+#endif
+#endif
+
 /// Because the MIDI Library send() and sendSysEx() libraries
 /// will try to send every byte in the sysex message all at once,
 /// and because the  USB transmitter system can only send as many
@@ -62,6 +84,8 @@
 /// maximum size system exclusive message. The buffer must be a
 /// multiple of 4 bytes. The sysex buffer from messages may not
 /// have the F0 and F7 bytes, but the USB packet needs to send them.
+/// EZ_USB_MIDI_HOST_Device::sendSysEx() sends longer messages a few
+/// packets at a time instead.
 #define RPPICOMIDI_EZ_USB_MIDI_HOST_GET_BUFSIZE(MaxSysExPayload)  (((((MaxSysExPayload) + 2) / 3) + 1) * 4)
 BEGIN_EZ_USB_MIDI_HOST_NAMESPACE
 /// This structure contains the default settings class
@@ -90,7 +114,11 @@ struct MidiHostSettingsDefault : public MIDI_NAMESPACE::DefaultSettings
     /// hold and entire system exclusive message. If your attached devices do not use
     /// system exclusive messages, you can save system memory by overriding the bufsize
     /// values in a subclass of this struct, but you should make the buffers no shorter than
-    /// 64 bytes each.
+    /// 64 bytes each. Received SysEx messages skip the receive buffer if the application
+    /// streams them with EZ_USB_MIDI_HOST::setAppOnSysExChunk(). The rxHighWaterBytes
+    /// cable counter shows how much of the receive buffer a device actually uses.
+    /// Each virtual cable's MIDI IN FIFO holds MidiRxBufsize/4 USB MIDI packets,
+    /// rounded up to a power of 2, in 4 bytes each.
     static const unsigned MidiRxBufsize = RPPICOMIDI_EZ_USB_MIDI_HOST_GET_BUFSIZE(SysExMaxSize);
     static const unsigned MidiTxBufsize = RPPICOMIDI_EZ_USB_MIDI_HOST_GET_BUFSIZE(SysExMaxSize);
     /// USB MIDI packets can be routed to one of up to 16 virtual cables. Each virtual cable
@@ -98,5 +126,57 @@ struct MidiHostSettingsDefault : public MIDI_NAMESPACE::DefaultSettings
     /// virtual cables. You can save memory by overriding this value in a new subclass of
     /// this struct, but MaxCables must be at least 1.
     static const unsigned MaxCables = 16;
+    /// Number of MIDI Library interface objects shared by all connected devices. Each
+    /// virtual cable of a connected device takes one when the device connects; cables
+    /// that find the pool empty have no MIDI Library interface and their MIDI IN data is
+    /// dropped. Each object holds a SysExMaxSize byte buffer. The default never runs
+    /// out; if you override MaxCables, override this too, or set it to the number of
+    /// cables you expect to be connected at the same time.
+    static const unsigned MidiInterfacePoolSize = RPPICOMIDI_TUH_MIDI_MAX_DEV * MaxCables;
+    /// Number of bytes shared by the UTF-8 manufacturer, product and serial strings of
+    /// all connected devices, including 2 bytes of overhead per string. A string that
+    /// does not fit is truncated; one that finds the arena full reads as empty. Must
+    /// be 3 to 32769 bytes.
+    static const unsigned StringArenaSize = 96 * RPPICOMIDI_TUH_MIDI_MAX_DEV;
+    /// Number of entries in each of the two queues that pass MIDI traffic between the
+    /// USB host core and the MIDI core in dual-core mode. Each entry is 8 bytes. Set
+    /// this to a power of 2 larger than 3*RPPICOMIDI_TUH_MIDI_MAX_DEV in a subclass of
+    /// this struct to enable dual-core mode. 0 means single-core mode; the queues then
+    /// use no memory. See EZ_USB_MIDI_HOST::usbHostTask().
+    static const unsigned CoreQueueDepth = 0;
+    /// Number of receive time stamps each MIDI IN FIFO remembers. Bytes that arrive
+    /// while all of them are in use share the time stamp of the newest one. Must be
+    /// a power of 2. Each time stamp is 8 bytes. See EZ_USB_MIDI_HOST::getCurrentReadTimestamp().
+    static const unsigned RxTimestampDepth = 4;
+    /// Set this to true in a subclass of this struct to keep MIDI IN and MIDI OUT latency
+    /// histograms for every device and cable. See EZ_USB_MIDI_HOST_Latency.h. When false,
+    /// the histograms use no memory and no processor time.
+    static const bool LatencyHistograms = false;
+    /// Set this to true in a subclass of this struct to measure the tempo and jitter of
+    /// the MIDI Clock messages every device sends on every cable. See
+    /// EZ_USB_MIDI_HOST::getRxClock(). When false, the analyzers use no memory and no
+    /// processor time.
+    static const bool RxClockAnalysis = false;
+    /// Number of MIDI thru routes between the virtual cables of connected devices. Set
+    /// this in a subclass of this struct to use EZ_USB_MIDI_HOST::addRoute(). Each
+    /// route is 4 bytes. 0 means no routes; routing then uses no memory and no time.
+    static const unsigned MaxRoutes = 0;
+    /// Number of MIDI OUT control change and pitch bend messages per virtual cable that
+    /// wait for writeFlushAll() so a newer value for the same channel and controller can
+    /// replace an older one that has not been sent yet. Set this in a subclass of this
+    /// struct if the application sends controller updates faster than the device can take
+    /// them. Each slot is 8 bytes per cable per device. 0 sends every message right away.
+    static const unsigned TxCoalesceSlots = 0;
+    /// Number of entries in each device's priority lane that carries MIDI OUT real-time
+    /// messages (Clock, Start, Stop...) to the usb_midi_host driver ahead of all other MIDI
+    /// OUT data not yet in its transmit FIFO, so bulk traffic does not delay them. Each
+    /// entry is 8 bytes per device. Set this to a power of 2 in a subclass of this struct
+    /// to enable the lanes; 0 sends real-time messages in order.
+    static const unsigned TxPriorityLaneDepth = 0;
+    /// Set this to true to send Note On and Note Off messages through the priority lane
+    /// too. They may then pass messages sent before them that are not yet in the
+    /// driver transmit FIFO, except coalesced control change and pitch bend messages:
+    /// while any of those wait, notes take the normal path behind them.
+    static const bool TxPriorityNotes = false;
 };
 END_EZ_USB_MIDI_HOST_NAMESPACE
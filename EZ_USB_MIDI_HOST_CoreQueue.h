@@ -0,0 +1,149 @@
+/*
+ * @file EZ_USB_MIDI_HOST_CoreQueue.h
+ * @brief Wait-free single-producer, single-consumer queue used to pass
+ *        USB MIDI traffic between processor cores in dual-core mode
+ *
+ * In dual-core mode, one core (the USB host core) runs tuh_task() and
+ * the usb_midi_host callbacks, and the other core (the MIDI core) runs
+ * readAll(), the MIDI Library callbacks and the application code that
+ * sends MIDI messages. One queue carries connect, disconnect and received
+ * packet events from the USB host core to the MIDI core. Another queue
+ * carries bytes to transmit and device slot releases the other way.
+ * Each queue has exactly one producer core and one consumer core, so the
+ * read and write indices only need atomic loads and stores, which every
+ * supported processor, including the Cortex-M0+, does without locks.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include "EZ_USB_MIDI_HOST_Config.h"
+#include "EZ_USB_MIDI_HOST_namespace.h"
+
+BEGIN_EZ_USB_MIDI_HOST_NAMESPACE
+
+/// @brief One entry in a cross-core queue
+struct EZ_USB_MIDI_HOST_CoreEvent {
+  enum Type : uint8_t {
+    Connect,    //!< USB host core to MIDI core; arg is the device slot, data[0..1] are nInCables, nOutCables
+    Disconnect, //!< USB host core to MIDI core; arg is the device slot
+    StringsReady, //!< USB host core to MIDI core; the device's string descriptors have been fetched
+    RxPacket,   //!< USB host core to MIDI core; data is a USB MIDI event packet; arg is
+                //!< nonzero if the cable's filter drops it and it only feeds the clock analyzer
+    RxTime,     //!< USB host core to MIDI core; data is the receive time stamp of the RxPacket events that follow
+    TxBytes,    //!< MIDI core to USB host core; arg is the cable, nBytes bytes of MIDI stream in data
+    TxPacket,   //!< MIDI core to USB host core; data is a USB MIDI event packet
+    Release     //!< MIDI core to USB host core; arg is the device slot that may be reused
+  };
+  uint8_t type;
+  uint8_t devAddr;
+  uint8_t arg;
+  uint8_t nBytes;
+  uint8_t data[4];
+};
+
+/// Number of queue entries kept free for Connect, StringsReady, Disconnect and
+/// Release events so MIDI data can never crowd them out
+static const unsigned coreQueueReserve = 3 * RPPICOMIDI_TUH_MIDI_MAX_DEV;
+
+/// @brief A wait-free single-producer, single-consumer ring buffer
+/// @tparam T the type of the entries; must be trivially copyable
+/// @tparam Depth the maximum number of entries; must be a power of 2
+/// larger than Reserve or 0 to disable the queue
+/// @tparam Reserve the number of entries the producer keeps free for
+/// control events; coreQueueReserve for the queues between the cores
+template<typename T, unsigned Depth, unsigned Reserve = coreQueueReserve>
+class EZ_USB_MIDI_HOST_SPSCQueue {
+public:
+  static_assert((Depth & (Depth - 1)) == 0, "queue Depth must be a power of 2");
+  static_assert(Depth > Reserve, "queue Depth must be larger than the entries it keeps in reserve");
+
+  EZ_USB_MIDI_HOST_SPSCQueue() : wrIdx{0}, rdIdx{0} { }
+
+  /// @brief Producer only: add an entry to the queue
+  /// @return false if the queue is full
+  bool push(const T& item) {
+    uint32_t wr = wrIdx.load(std::memory_order_relaxed);
+    if (wr - rdIdx.load(std::memory_order_acquire) == Depth)
+      return false;
+    buffer[wr & (Depth - 1)] = item;
+    wrIdx.store(wr + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// @brief Producer only
+  /// @return the number of entries that can be pushed without failing
+  unsigned spaceAvailable() const {
+    return Depth - (wrIdx.load(std::memory_order_relaxed) - rdIdx.load(std::memory_order_acquire));
+  }
+
+  /// @brief Consumer only: get a pointer to the oldest entry without removing it.
+  /// The consumer may modify the entry until it calls pop().
+  /// @return a pointer to the oldest entry or nullptr if the queue is empty
+  T* peek() {
+    uint32_t rd = rdIdx.load(std::memory_order_relaxed);
+    if (rd == wrIdx.load(std::memory_order_acquire))
+      return nullptr;
+    return buffer + (rd & (Depth - 1));
+  }
+
+  /// @brief Consumer only: remove the oldest entry from the queue
+  /// @param item is set to a copy of the removed entry
+  /// @return false if the queue was empty
+  bool pop(T& item) {
+    T* oldest = peek();
+    if (oldest == nullptr)
+      return false;
+    item = *oldest;
+    pop();
+    return true;
+  }
+
+  /// @brief Consumer only: remove the oldest entry returned by peek()
+  void pop() { rdIdx.store(rdIdx.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+  /// @brief Consumer only
+  /// @return the number of entries waiting in the queue
+  unsigned count() const {
+    return wrIdx.load(std::memory_order_acquire) - rdIdx.load(std::memory_order_relaxed);
+  }
+private:
+  T buffer[Depth];
+  std::atomic<uint32_t> wrIdx; //!< only written by the producer
+  std::atomic<uint32_t> rdIdx; //!< only written by the consumer
+};
+
+/// @brief A disabled queue that uses no memory; single-core mode
+template<typename T, unsigned Reserve>
+class EZ_USB_MIDI_HOST_SPSCQueue<T, 0, Reserve> {
+public:
+  bool push(const T&) { return false; }
+  unsigned spaceAvailable() const { return 0; }
+  T* peek() { return nullptr; }
+  bool pop(T&) { return false; }
+  void pop() { }
+  unsigned count() const { return 0; }
+};
+
+END_EZ_USB_MIDI_HOST_NAMESPACE
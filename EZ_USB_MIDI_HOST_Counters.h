@@ -0,0 +1,111 @@
+/*
+ * @file EZ_USB_MIDI_HOST_Counters.h
+ * @brief Traffic and drop counters for connected devices and their virtual cables
+ *
+ * The counters start at 0 when a device connects and only count up while
+ * it stays connected, so the application can compute rates from the
+ * difference between two readings. They wrap around at 2^32. In dual-core
+ * mode, some counters belong to the USB host core; any core may read any
+ * counter at any time.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include "EZ_USB_MIDI_HOST_namespace.h"
+
+BEGIN_EZ_USB_MIDI_HOST_NAMESPACE
+
+/// @brief A 32-bit counter that only one core adds to. Relaxed atomic
+/// loads and stores are plain loads and stores on every supported
+/// processor, so counting costs the same as incrementing a uint32_t.
+class EZ_USB_MIDI_HOST_Counter {
+public:
+  EZ_USB_MIDI_HOST_Counter() : value{0} { }
+
+  /// @brief Add n to the counter. Only the core that owns the counter may call this.
+  void add(uint32_t n) { value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+
+  /// @brief Raise the counter to n if it is lower, for high-water marks.
+  /// Only the core that owns the counter may call this.
+  void raiseTo(uint32_t n) {
+    if (n > get())
+      value.store(n, std::memory_order_relaxed);
+  }
+
+  /// @return the current count
+  uint32_t get() const { return value.load(std::memory_order_relaxed); }
+
+  void reset() { value.store(0, std::memory_order_relaxed); }
+private:
+  std::atomic<uint32_t> value;
+};
+
+/// @brief Counters for one connected device
+struct EZ_USB_MIDI_HOST_DeviceCounters {
+  EZ_USB_MIDI_HOST_Counter rxPackets; //!< USB MIDI packets received from the device
+  EZ_USB_MIDI_HOST_Counter rxFilteredPackets; //!< received packets a MIDI IN filter dropped; USB host core. In dual-core mode, rxPackets does not count them.
+  EZ_USB_MIDI_HOST_Counter txFlushes; //!< tuh_midi_stream_flush() calls that started a USB transfer; USB host core
+  EZ_USB_MIDI_HOST_Counter txPackets; //!< USB MIDI packets those transfers sent; USB host core
+  EZ_USB_MIDI_HOST_Counter thruPackets; //!< received packets forwarded to a route destination; USB host core
+  EZ_USB_MIDI_HOST_Counter thruDroppedPackets; //!< received packets not forwarded because a route destination's transmit FIFO was full; USB host core
+  EZ_USB_MIDI_HOST_Counter thruTxPackets; //!< packets routes forwarded from other devices to this one; USB host core. txPackets includes them.
+
+  void reset() {
+    rxPackets.reset();
+    rxFilteredPackets.reset();
+    txFlushes.reset();
+    txPackets.reset();
+    thruPackets.reset();
+    thruDroppedPackets.reset();
+    thruTxPackets.reset();
+  }
+};
+
+/// @brief Counters for one virtual cable of a connected device
+struct EZ_USB_MIDI_HOST_CableCounters {
+  EZ_USB_MIDI_HOST_Counter rxBytes;            //!< MIDI bytes received for the MIDI IN FIFO, including dropped bytes
+  EZ_USB_MIDI_HOST_Counter rxDroppedBytes;     //!< MIDI bytes dropped because the MIDI IN FIFO was full
+  EZ_USB_MIDI_HOST_Counter rxDroppedMessages;  //!< whole messages (or SysEx parts) those bytes made up
+  EZ_USB_MIDI_HOST_Counter rxHighWaterBytes;   //!< the most bytes the MIDI IN FIFO has held; not a count
+  EZ_USB_MIDI_HOST_Counter rxMessages;         //!< messages the MIDI Library parsed from the MIDI IN FIFO
+  EZ_USB_MIDI_HOST_Counter txBytes;            //!< MIDI bytes the MIDI OUT FIFO accepted
+  EZ_USB_MIDI_HOST_Counter txRejectedBytes;    //!< MIDI bytes the MIDI OUT FIFO did not accept
+  EZ_USB_MIDI_HOST_Counter txRejectedMessages; //!< messages dropped whole because the MIDI OUT FIFO was full
+  EZ_USB_MIDI_HOST_Counter txCoalescedMessages; //!< control change and pitch bend messages a newer value replaced before they were sent
+
+  void reset() {
+    rxBytes.reset();
+    rxDroppedBytes.reset();
+    rxDroppedMessages.reset();
+    rxHighWaterBytes.reset();
+    rxMessages.reset();
+    txBytes.reset();
+    txRejectedBytes.reset();
+    txRejectedMessages.reset();
+    txCoalescedMessages.reset();
+  }
+};
+
+END_EZ_USB_MIDI_HOST_NAMESPACE
@@ -23,13 +23,39 @@
  */
 
 #pragma once
+#include <atomic>
+#include <cstring>
 #include "MIDI.h"
 #include "EZ_USB_MIDI_HOST_Transport.h"
+#include "EZ_USB_MIDI_HOST_Packet.h"
+#include "EZ_USB_MIDI_HOST_InterfacePool.h"
+#include "EZ_USB_MIDI_HOST_StringArena.h"
+#include "EZ_USB_MIDI_HOST_SysExChunker.h"
+#include "EZ_USB_MIDI_HOST_SysExSender.h"
+#include "EZ_USB_MIDI_HOST_ClockAnalyzer.h"
 
 #include "EZ_USB_MIDI_HOST_namespace.h"
 
 BEGIN_EZ_USB_MIDI_HOST_NAMESPACE
 
+/// @brief A MIDI IN message the MIDI Library parsed, as the unified message
+/// callback sees it. For SystemExclusive messages, sysexArray holds the whole
+/// message as the MIDI Library stored it and sysexLength is its length; for
+/// all other messages sysexArray is nullptr.
+struct EZ_USB_MIDI_HOST_Message {
+  MIDI_NAMESPACE::MidiType type;    //!< the message type
+  MIDI_NAMESPACE::Channel channel;  //!< 1-16 for channel messages, 0 otherwise
+  uint8_t data1;                    //!< the first data byte or 0
+  uint8_t data2;                    //!< the second data byte or 0
+  const uint8_t* sysexArray;        //!< valid only until the callback returns
+  unsigned sysexLength;
+};
+
+/// The unified MIDI IN message callback. The arguments are the device address,
+/// the virtual cable number, the receive time stamp of the message (see
+/// EZ_USB_MIDI_HOST::getCurrentReadTimestamp()) and the message.
+using MessageCallback = void (*)(uint8_t devAddr, uint8_t cable, uint32_t timestamp, const EZ_USB_MIDI_HOST_Message& message);
+
 
 /// @brief This class models a connected USB MIDI device
 /// Applications normally do not instantiate this class
@@ -37,21 +63,26 @@ BEGIN_EZ_USB_MIDI_HOST_NAMESPACE
 template<class settings>
 class EZ_USB_MIDI_HOST_Device {
 public:
-  EZ_USB_MIDI_HOST_Device() : devAddr{0}, nInCables{0}, nOutCables{0}, vid{0}, pid{0}, onMidiInWriteFail{nullptr} {
+  using Interface = typename EZ_USB_MIDI_HOST_InterfacePool<settings>::Interface;
+  using StringArena = EZ_USB_MIDI_HOST_StringArena<settings::StringArenaSize>;
+
+  EZ_USB_MIDI_HOST_Device() : devAddr{0}, nInCables{0}, nOutCables{0}, vid{0}, pid{0}, pendingInCables{0}, readyInCables{0},
+      inSysexCables{0}, filteredInCables{0}, languageID{0}, stringState{StringsDone}, stringsReady{false}, onMidiInWriteFail{nullptr},
+      coalescedWaiting{false}, coalescedFlushes{0}, interfacePool{nullptr}, stringArena{nullptr}, sysexChunker{nullptr} {
     clearTransports();
     for (unsigned idx=0;idx < settings::MaxCables; idx++) {
-        interfaces[idx] = new MIDI_NAMESPACE::MidiInterface<EZ_USB_MIDI_HOST_Transport<settings>, settings>(transports[idx]);
+        interfaces[idx] = nullptr;
+        transports[idx].setLatencyStats(&latencyStats);
+        if (settings::TxPriorityLaneDepth != 0)
+            transports[idx].setPriorityLane(&txPriorityLane);
+        inTypeFilters[idx].store(0, std::memory_order_relaxed);
+        inChannelFilters[idx].store(0, std::memory_order_relaxed);
     }
-    productStr[0] = 0;
-    manufacturerStr[0] = 0;
-    serialStr[0] = 0;
+    for (unsigned idx = 0; idx < 3; idx++)
+        strings[idx] = nullptr;
   }
 
-  ~EZ_USB_MIDI_HOST_Device() {
-    for (unsigned idx=0;idx < settings::MaxCables; idx++) {
-        delete interfaces[idx];
-    }
-  }
+  ~EZ_USB_MIDI_HOST_Device() { unbindInterfaces(); releaseStrings(); }
 
 
   /// @brief convert the UTF-16 string from a USB string descriptor to a UTF-8 C-string
@@ -169,7 +200,8 @@ public:
   /// @param src a USB string descriptor array
   /// @return the number of 16-bit data words in the string descriptor array.
   size_t getStringDescriptorLen(uint16_t *src) {
-    return ((src[0] & 0xff) - 2) / 2;
+    size_t bLength = src[0] & 0xff;
+    return bLength < 2 ? 0 : (bLength - 2) / 2;
   }
 
   /// @brief Call this function to configure the MIDI interface objects
@@ -178,49 +210,100 @@ public:
   /// @param nInCables_ the number of virtual MIDI IN cables the device supports
   /// @param nOutCables_ the number of virtual MIDI OUT cables the device supports
   void onConnect(uint8_t devAddr_, uint8_t nInCables_, uint8_t nOutCables_) {
-    if (devAddr_ > 0 && devAddr_ <= RPPICOMIDI_TUH_MIDI_MAX_DEV) {
+    if (devAddr_ > 0 && devAddr_ <= RPPICOMIDI_TUH_MIDI_MAX_DEV_ADDR) {
         devAddr = devAddr_;
         nInCables = nInCables_;
         nOutCables = nOutCables_;
         clearTransports(); // make sure all transports are initialized
+        unbindInterfaces();
+        releaseStrings();
+        latencyStats.reset();
+        clockAnalyzers.reset();
+        counters.reset();
+        coalescedWaiting = false;
+        for (uint8_t idx = 0; idx < settings::MaxCables; idx++) {
+            transports[idx].getCounters().reset();
+            setInFilter(idx, 0, 0);
+        }
         uint8_t maxCables = nInCables > nOutCables ? nInCables : nOutCables;
         for (uint8_t idx = 0; idx < maxCables; idx++) {
             transports[idx].setConfiguration(devAddr, idx, idx < nInCables, idx < nOutCables);
-            interfaces[idx]->begin(MIDI_CHANNEL_OMNI);
+            interfaces[idx] = interfacePool != nullptr ? interfacePool->alloc(transports[idx]) : nullptr;
+            if (interfaces[idx] != nullptr)
+                interfaces[idx]->begin(MIDI_CHANNEL_OMNI);
         }
         tuh_vid_pid_get(devAddr, &vid, &pid);
 
-        uint16_t buf[256];
-        uint16_t languageID;
-        // Set the languateID to the default, which is supposed to be the first available ID
-        // string descriptor index 0
-        uint8_t xfer_result = tuh_descriptor_get_string_sync(devAddr, 0, 0, buf, sizeof(buf));
-        if (XFER_RESULT_SUCCESS == xfer_result && getStringDescriptorLen(buf) >= 1) {
-          languageID = buf[1];
-        }
-        else {
-          // default to US English
-          languageID = 0x0409;
-        }
-        manufacturerStr[0] = 0;
-        xfer_result = tuh_descriptor_get_manufacturer_string_sync(devAddr, languageID, buf, sizeof(buf));
-        if (XFER_RESULT_SUCCESS == xfer_result) {
-          utf16ToUtf8(buf+1, getStringDescriptorLen(buf), manufacturerStr, maxDevStr);
-        }
+        // The strings are fetched later, one control transfer at a time;
+        // see requestNextString()
+        stringsReady.store(false, std::memory_order_relaxed);
+        tusb_desc_device_t desc;
+        bool haveDesc = tuh_descriptor_get_device_local(devAddr, &desc);
+        stringIndex[0] = haveDesc ? desc.iManufacturer : 0;
+        stringIndex[1] = haveDesc ? desc.iProduct : 0;
+        stringIndex[2] = haveDesc ? desc.iSerialNumber : 0;
+        stringState = StringsLangId;
+        skipMissingStrings();
+    }
+  }
 
-        productStr[0] = 0;
-        xfer_result = tuh_descriptor_get_product_string_sync(devAddr, languageID, buf, sizeof(buf));
-        if (XFER_RESULT_SUCCESS == xfer_result) {
-          utf16ToUtf8(buf+1, getStringDescriptorLen(buf), productStr, maxDevStr);
-        }
-        serialStr[0] = 0;
-        xfer_result = tuh_descriptor_get_serial_string_sync(devAddr, languageID, buf, sizeof(buf));
-        if (XFER_RESULT_SUCCESS == xfer_result) {
-          utf16ToUtf8(buf+1, getStringDescriptorLen(buf), serialStr, maxDevStr);
-        }
+  /// @return true if the device has string descriptors left to fetch
+  bool needsStrings() { return devAddr != 0 && stringState != StringsDone; }
+
+  /// @brief Start the control transfer for the next string descriptor
+  /// the device needs. Only the core that runs onConnect() may call this.
+  /// @param buf the buffer for the string descriptor; it must stay valid
+  /// until the transfer completes
+  /// @param len the size of buf in bytes
+  /// @param completeCb the function TinyUSB calls when the transfer completes;
+  /// it must call onStringReceived()
+  /// @param userData passed to completeCb in the transfer's user_data
+  /// @return true if the transfer started, false if the control pipe is busy
+  /// or there is nothing left to fetch
+  bool requestNextString(uint16_t* buf, uint16_t len, tuh_xfer_cb_t completeCb, uintptr_t userData) {
+    if (!needsStrings())
+      return false;
+    if (stringState == StringsLangId)
+      return tuh_descriptor_get_string(devAddr, 0, 0, buf, len, completeCb, userData);
+    return tuh_descriptor_get_string(devAddr, stringIndex[stringState - StringsManufacturer], languageID, buf, len,
+      completeCb, userData);
+  }
+
+  /// @brief Store the string descriptor the transfer requestNextString()
+  /// started returned and move on to the next one
+  /// @param result the transfer result
+  /// @param buf the buffer passed to requestNextString()
+  /// @return true if that was the last string
+  bool onStringReceived(xfer_result_t result, uint16_t* buf) {
+    if (stringState == StringsLangId) {
+      // Use the first language ID; default to US English
+      languageID = (XFER_RESULT_SUCCESS == result && getStringDescriptorLen(buf) >= 1) ? buf[1] : 0x0409;
     }
+    else if (XFER_RESULT_SUCCESS == result && stringArena != nullptr) {
+      // Each UTF-16 code unit takes at most 3 UTF-8 bytes; give back what the
+      // string does not use. If the arena is short, the string is truncated.
+      size_t nUnits = getStringDescriptorLen(buf);
+      uint16_t len;
+      uint8_t* dest = stringArena->alloc(static_cast<uint16_t>(3 * nUnits + 1), len);
+      if (dest != nullptr) {
+        utf16ToUtf8(buf+1, nUnits, dest, len);
+        stringArena->shrink(dest, static_cast<uint16_t>(strlen(reinterpret_cast<char*>(dest)) + 1));
+        strings[stringState - StringsManufacturer] = dest;
+      }
+    }
+    stringState = static_cast<StringState>(stringState + 1);
+    skipMissingStrings();
+    return stringState == StringsDone;
   }
 
+  /// @brief Stop fetching string descriptors; the device is gone
+  void cancelStrings() { stringState = StringsDone; }
+
+  /// @return true once the string descriptors have been fetched. Until then,
+  /// getProductStr(), getManufacturerStr() and getSerialString() return
+  /// empty strings. Any core may call this.
+  bool areStringsReady() { return stringsReady.load(std::memory_order_acquire); }
+
   /// @brief Call this function to unconfigure all MIDI interface objects
   /// associated with the device's virtual MIDI cables
   /// @param devAddr_ is currently not used
@@ -229,6 +312,40 @@ public:
     clearTransports();
   }
 
+  /// @brief Return the MIDI interface objects of the virtual MIDI cables to
+  /// the pool. Call this after the application's disconnect callback has
+  /// returned, from the same core that calls onConnect().
+  void unbindInterfaces() {
+    for (uint8_t idx = 0; idx < settings::MaxCables; idx++) {
+      if (interfaces[idx] != nullptr) {
+        interfacePool->free(interfaces[idx]);
+        interfaces[idx] = nullptr;
+      }
+    }
+  }
+
+  /// @brief Take the MIDI interface objects for the virtual MIDI cables from pool
+  void setInterfacePool(EZ_USB_MIDI_HOST_InterfacePool<settings>* pool) { interfacePool = pool; }
+
+  /// @brief Return the device's strings to the string arena. Call this
+  /// wherever unbindInterfaces() is called.
+  void releaseStrings() {
+    stringsReady.store(false, std::memory_order_relaxed);
+    for (uint8_t idx = 0; idx < 3; idx++) {
+      if (strings[idx] != nullptr) {
+        stringArena->free(strings[idx]);
+        strings[idx] = nullptr;
+      }
+    }
+  }
+
+  /// @brief Store the device's strings in arena
+  void setStringArena(StringArena* arena) { stringArena = arena; }
+
+  /// @brief Pass received SysEx messages to chunker instead of the MIDI IN
+  /// FIFO whenever chunker has a callback
+  void setSysExChunker(EZ_USB_MIDI_HOST_SysExChunker* chunker) { sysexChunker = chunker; }
+
   /// @brief  
   /// @return the device address for this device object
   uint8_t getDevAddr() { return devAddr; }
@@ -243,18 +360,21 @@ public:
 
   /// @brief Get the MIDI interface object associated with a particular virtual MIDI cable
   /// @param cable the virtual MIDI cable
-  /// @return a reference to the MIDI interface object
-  MIDI_NAMESPACE::MidiInterface<EZ_USB_MIDI_HOST_Transport<settings>, settings>& getMIDIinterface(uint8_t cable) {
-    return *interfaces[cable];
+  /// @return a pointer to the MIDI interface object, or nullptr if the cable
+  /// does not exist or the interface pool was empty when the device connected
+  Interface* getMIDIinterface(uint8_t cable) {
+    return cable < settings::MaxCables ? interfaces[cable] : nullptr;
   }
 
   /// @brief Enqueue message bytes to MIDI IN FIFO of a particular transport
   /// @param cable the virtual cable number of the MIDI interface on the device
   /// @param buffer points to an array of bytes to send
   /// @param nBytes the number of bytes in the buffer to send
-  void writeToInFIFO(uint8_t cable, uint8_t* buffer, uint16_t nBytes) {
-    if (cable < nInCables) {
-      if (!transports[cable].writeToInFIFO(buffer, nBytes)) {
+  /// @param timestamp the RPPICOMIDI_EZ_USB_MIDI_HOST_TIME_US() value when the bytes arrived
+  void writeToInFIFO(uint8_t cable, const uint8_t* buffer, uint16_t nBytes, uint32_t timestamp) {
+    if (cable < nInCables && interfaces[cable] != nullptr) {
+      pendingInCables |= (1u << cable);
+      if (!transports[cable].writeToInFIFO(buffer, nBytes, timestamp)) {
         if (onMidiInWriteFail != nullptr) {
           onMidiInWriteFail(devAddr, cable, transports[cable].inOverflow());
         }
@@ -262,6 +382,259 @@ public:
     }
   }
 
+  /// @brief Enqueue the MIDI bytes in a USB MIDI event packet to the
+  /// MIDI IN FIFO of the packet's virtual cable. In SysEx streaming mode,
+  /// SysEx bytes go to the SysEx chunker instead.
+  /// @param packet points to the 4 bytes of the packet
+  /// @param timestamp the RPPICOMIDI_EZ_USB_MIDI_HOST_TIME_US() value when the packet arrived
+  void writePacketToInFIFO(const uint8_t* packet, uint32_t timestamp) {
+    uint8_t cable = EZ_USB_MIDI_HOST_Packet::getCable(packet);
+    bool wasInSysex = (inSysexCables & (1u << cable)) != 0;
+    uint8_t nBytes = EZ_USB_MIDI_HOST_Packet::getStreamLength(packet, inSysexCables);
+    if (nBytes == 0)
+      return;
+    if (sysexChunker != nullptr && sysexChunker->isEnabled() && cable < nInCables) {
+      uint8_t status = packet[1];
+      if (wasInSysex && status >= 0x80 && status < 0xF8 && status != 0xF7)
+        sysexChunker->abort(devAddr, cable);
+      if (status == 0xF0 || (wasInSysex && (status < 0x80 || status == 0xF7))) {
+        sysexChunker->add(devAddr, cable, packet + 1, nBytes);
+        return;
+      }
+    }
+    writeToInFIFO(cable, packet + 1, nBytes, timestamp);
+  }
+
+  /// @brief Choose which messages the MIDI IN FIFO of a virtual cable drops
+  /// when it is full. Only the core that calls readAll() may call this.
+  /// @param cable the virtual MIDI IN cable
+  /// @param policy the overflow policy
+  void setInOverflowPolicy(uint8_t cable, EZ_USB_MIDI_HOST_InOverflowPolicy policy) {
+    if (cable < settings::MaxCables)
+      transports[cable].setInOverflowPolicy(policy);
+  }
+
+  /// @brief Drop received packets of the given message types and channels
+  /// before they reach the MIDI IN FIFO of a virtual cable. Only the core
+  /// that calls readAll() may call this.
+  /// @param cable the virtual MIDI IN cable
+  /// @param typeMask EZ_USB_MIDI_HOST_Packet::TypeBit values of the message types to drop
+  /// @param channelMask bit n set drops channel messages on channel n+1
+  void setInFilter(uint8_t cable, uint32_t typeMask, uint16_t channelMask) {
+    if (cable >= settings::MaxCables)
+      return;
+    inTypeFilters[cable].store(typeMask, std::memory_order_relaxed);
+    inChannelFilters[cable].store(channelMask, std::memory_order_relaxed);
+    uint16_t cables = filteredInCables.load(std::memory_order_relaxed);
+    cables = (typeMask != 0 || channelMask != 0) ? cables | (1u << cable) : cables & ~(1u << cable);
+    filteredInCables.store(cables, std::memory_order_release);
+  }
+
+  /// @return the message types setInFilter() set for the cable
+  uint32_t getInTypeFilter(uint8_t cable) { return cable < settings::MaxCables ? inTypeFilters[cable].load(std::memory_order_relaxed) : 0; }
+
+  /// @return the channels setInFilter() set for the cable
+  uint16_t getInChannelFilter(uint8_t cable) { return cable < settings::MaxCables ? inChannelFilters[cable].load(std::memory_order_relaxed) : 0; }
+
+  /// @return true if any virtual cable has a filter
+  bool hasInFilters() { return filteredInCables.load(std::memory_order_acquire) != 0; }
+
+  /// @return true if the filter of the packet's cable drops the packet
+  bool isFilteredOut(const uint8_t* packet) {
+    uint8_t cable = EZ_USB_MIDI_HOST_Packet::getCable(packet);
+    if ((filteredInCables.load(std::memory_order_acquire) & (1u << cable)) == 0)
+      return false;
+    uint32_t typeBit = EZ_USB_MIDI_HOST_Packet::getTypeBit(packet);
+    if ((inTypeFilters[cable].load(std::memory_order_relaxed) & typeBit) != 0)
+      return true;
+    return (typeBit & EZ_USB_MIDI_HOST_Packet::ChannelMessages) != 0 &&
+      (inChannelFilters[cable].load(std::memory_order_relaxed) & (1u << EZ_USB_MIDI_HOST_Packet::getChannel(packet))) != 0;
+  }
+
+  /// @return true if writePacketToInFIFO() would not overflow the MIDI IN FIFO
+  /// @param packet points to the 4 bytes of the packet
+  bool canWritePacketToInFIFO(const uint8_t* packet) {
+    uint8_t cable = EZ_USB_MIDI_HOST_Packet::getCable(packet);
+    return cable >= nInCables || interfaces[cable] == nullptr || transports[cable].canWriteInPacket();
+  }
+
+  /// @brief In dual-core mode, send MIDI OUT data to the USB host core through txQueue
+  /// @param txQueue the queue from the MIDI core to the USB host core
+  void setCoreQueue(typename EZ_USB_MIDI_HOST_Transport<settings>::CoreQueue* txQueue) {
+    for (unsigned idx=0;idx < settings::MaxCables; idx++) {
+        transports[idx].setCoreQueue(txQueue);
+    }
+  }
+
+  /// @brief Write the packets waiting in this device's priority lane to the
+  /// usb_midi_host driver until its transmit FIFO is full. Packets for a
+  /// device that is gone are dropped. In dual-core mode, only the USB host
+  /// core calls this.
+  void writePriorityLane() {
+    EZ_USB_MIDI_HOST_CoreEvent* event;
+    while ((event = txPriorityLane.peek()) != nullptr) {
+      if (tuh_midi_packet_write(event->devAddr, event->data)) {
+        // the MIDI core owns the histograms in dual-core mode
+        if (settings::LatencyHistograms && settings::CoreQueueDepth == 0)
+            latencyStats.onTxWrite(event->arg, 1, RPPICOMIDI_EZ_USB_MIDI_HOST_TIME_US());
+      }
+      else if (tuh_midi_configured(event->devAddr)) {
+        return; // Driver transmit FIFO is full; try again next time
+      }
+      txPriorityLane.pop();
+    }
+  }
+
+  /// @brief Write a packet a route forwarded from another device to the
+  /// usb_midi_host driver. The packet is counted in thruTxPackets and, in
+  /// single-core mode, untimed in the MIDI OUT latency histograms so the
+  /// flush that sends it does not end the wrong message's delay. In
+  /// dual-core mode, only the USB host core calls this.
+  /// @param packet the USB MIDI packet with this device's cable number
+  /// @return true if the driver's transmit FIFO accepted the packet
+  bool writeThruPacket(const uint8_t* packet) {
+    if (!tuh_midi_packet_write(devAddr, packet))
+        return false;
+    counters.thruTxPackets.add(1);
+    if (settings::LatencyHistograms && settings::CoreQueueDepth == 0)
+        latencyStats.onTxWrite(latencyStats.untimed, 1, 0);
+    return true;
+  }
+
+  /// @brief
+  /// @return a bitmap of the virtual MIDI IN cables that may have unread
+  /// bytes in their MIDI IN FIFO; bit 0 is cable 0
+  uint16_t getPendingInCables() { return pendingInCables; }
+
+  /// @brief Call the MIDI interface read() method for every virtual MIDI IN
+  /// cable with unread bytes in its MIDI IN FIFO. This will trigger the
+  /// MIDI Library callbacks for the cables that have complete messages.
+  /// @param currentReadCable is set to each cable number before that cable's
+  /// read() method is called
+  /// @param onMessage if not nullptr, is called with each message a read() method returned
+  /// @return a bitmap of the virtual MIDI IN cables whose read() method
+  /// returned a message
+  uint16_t readPendingInCables(uint8_t& currentReadCable, MessageCallback onMessage) {
+    uint16_t pending = pendingInCables;
+    uint16_t ready = 0;
+    while (pending != 0) {
+      uint8_t cable = __builtin_ctz(pending);
+      uint16_t cableBit = 1u << cable;
+      pending &= ~cableBit;
+      currentReadCable = cable;
+      if (readInCable(cable, onMessage))
+        ready |= cableBit;
+      if (transports[cable].available() == 0) {
+        pendingInCables &= ~cableBit;
+      }
+    }
+    readyInCables |= ready;
+    return ready;
+  }
+
+  /// @brief Like readPendingInCables(), but keep calling each cable's read()
+  /// method until its MIDI IN FIFO is empty or the budget runs out.
+  /// @param currentReadCable is set to each cable number before that cable's
+  /// read() method is called
+  /// @param onMessage if not nullptr, is called with each message a read() method returned
+  /// @param maxMessages the number of messages that may still be read; reduced
+  /// by the number of messages read. Nothing is read if it is 0.
+  /// @param deadline if useDeadline is true, stop after the first read()
+  /// call that returns at or after this RPPICOMIDI_EZ_USB_MIDI_HOST_TIME_US()
+  /// value, whether or not it returned a message; maxMessages is then set to 0
+  /// @return a bitmap of the virtual MIDI IN cables whose read() method
+  /// returned a message
+  uint16_t drainPendingInCables(uint8_t& currentReadCable, MessageCallback onMessage, uint32_t& maxMessages,
+      bool useDeadline, uint32_t deadline) {
+    uint16_t pending = pendingInCables;
+    uint16_t ready = 0;
+    while (pending != 0 && maxMessages != 0) {
+      uint8_t cable = __builtin_ctz(pending);
+      uint16_t cableBit = 1u << cable;
+      pending &= ~cableBit;
+      currentReadCable = cable;
+      while (transports[cable].available() != 0) {
+        if (readInCable(cable, onMessage)) {
+          ready |= cableBit;
+          if (--maxMessages == 0)
+            break;
+        }
+        // Checked after every read() call, not just the ones that return a
+        // message, so bytes of a message that never completes cannot overrun
+        if (useDeadline && static_cast<int32_t>(RPPICOMIDI_EZ_USB_MIDI_HOST_TIME_US() - deadline) >= 0) {
+          maxMessages = 0;
+          break;
+        }
+      }
+      if (transports[cable].available() == 0) {
+        pendingInCables &= ~cableBit;
+      }
+    }
+    readyInCables |= ready;
+    return ready;
+  }
+
+  /// @return the number of bytes waiting in the MIDI IN FIFOs of all virtual cables
+  uint32_t getInBytesPending() {
+    uint32_t nBytes = 0;
+    for (uint16_t pending = pendingInCables; pending != 0; pending &= pending - 1)
+      nBytes += transports[__builtin_ctz(pending)].available();
+    return nBytes;
+  }
+
+  /// @param cable the virtual MIDI IN cable number
+  /// @return the time the last byte read from the cable's MIDI IN FIFO arrived
+  uint32_t getReadTimestamp(uint8_t cable) { return transports[cable].getReadTimestamp(); }
+
+  /// @brief Count the delay of raw USB MIDI packets in the MIDI IN latency histograms
+  /// @param packets points to nPackets 4-byte packets
+  /// @param nPackets the number of packets
+  /// @param delayUs the time from the data received callback to the raw packet callback
+  void addRxPacketsLatency(const uint8_t* packets, uint32_t nPackets, uint32_t delayUs) {
+    for (uint32_t idx = 0; idx < nPackets; idx++) {
+      uint8_t cable = EZ_USB_MIDI_HOST_Packet::getCable(packets + 4 * idx);
+      if (cable < nInCables)
+        latencyStats.addRx(cable, delayUs);
+    }
+  }
+
+  /// @brief Time the MIDI Clock messages in a received USB MIDI event packet
+  /// @param packet points to the 4 bytes of the packet
+  /// @param timestamp the RPPICOMIDI_EZ_USB_MIDI_HOST_TIME_US() value when the packet arrived
+  void analyzeRxClock(const uint8_t* packet, uint32_t timestamp) {
+    if (EZ_USB_MIDI_HOST_Packet::getCable(packet) < nInCables)
+      clockAnalyzers.onPacket(packet, timestamp);
+  }
+
+  /// @brief Time the MIDI Clock messages in MIDI stream bytes received on a cable
+  void analyzeRxClock(uint8_t cable, const uint8_t* buffer, uint16_t nBytes, uint32_t timestamp) {
+    if (cable < nInCables)
+      clockAnalyzers.onBytes(cable, buffer, nBytes, timestamp);
+  }
+
+  /// @return the MIDI Clock analyzers for this device. Always empty unless
+  /// settings::RxClockAnalysis is true
+  EZ_USB_MIDI_HOST_ClockAnalyzers<settings>& getClockAnalyzers() { return clockAnalyzers; }
+
+  /// @return the latency histograms for this device. Always empty unless
+  /// settings::LatencyHistograms is true
+  EZ_USB_MIDI_HOST_LatencyStats<settings>& getLatencyStats() { return latencyStats; }
+
+  /// @return the traffic counters for this device
+  EZ_USB_MIDI_HOST_DeviceCounters& getCounters() { return counters; }
+
+  /// @param cable the virtual MIDI cable number
+  /// @return the traffic and drop counters for the cable
+  EZ_USB_MIDI_HOST_CableCounters& getCableCounters(uint8_t cable) { return transports[cable].getCounters(); }
+
+  /// @return a bitmap of the virtual MIDI IN cables that returned a message
+  /// since the last clearReadyInCables()
+  uint16_t getReadyInCables() { return readyInCables; }
+
+  /// @brief Forget which virtual MIDI IN cables returned a message. readAll()
+  /// and readAllDrain() call this for every device before reading any.
+  void clearReadyInCables() { readyInCables = 0; }
+
   /// @brief register a callback function that is called if the USB receive
   /// callback fails to write the received data to the FIFO
   /// @param fptr a pointer to the callback function; 
@@ -269,10 +642,83 @@ public:
 
   /// @brief Send any queued bytes to the connected device
   /// if the host bus is ready to do it. Does nothing if
-  /// there is nothing to send or if the host bus is busy
+  /// there is nothing to send or if the host bus is busy.
+  /// In dual-core mode, only the USB host core calls this.
   void writeFlush() {
-    if (devAddr != 0)
-        tuh_midi_stream_flush(devAddr);
+    if (devAddr != 0) {
+        if (settings::CoreQueueDepth == 0)
+            writePending();
+        uint32_t nBytes = tuh_midi_stream_flush(devAddr);
+        if (nBytes != 0) {
+            counters.txFlushes.add(1);
+            counters.txPackets.add(nBytes / 4);
+            // the MIDI core owns the histograms in dual-core mode
+            if (settings::LatencyHistograms && settings::CoreQueueDepth == 0)
+                latencyStats.onTxFlush(nBytes / 4, RPPICOMIDI_EZ_USB_MIDI_HOST_TIME_US());
+        }
+    }
+  }
+
+  /// @brief Write the waiting coalesced messages and the next part of a
+  /// bulk SysEx message to the MIDI stream. In dual-core mode, only the
+  /// MIDI core calls this.
+  void writePending() {
+    drainCoalesced();
+    sysexSender.service(counters.txFlushes.get(), latencyStats);
+  }
+
+  /// @brief Start sending a SysEx message of any length to a virtual MIDI
+  /// OUT cable without blocking. Each writeFlushAll() call writes up to one
+  /// bulk transfer's worth of the message, as the MIDI OUT FIFO permits,
+  /// once a flush has started sending the part before it, so the payload
+  /// needs no RAM buffer and the FIFO always has room for other messages.
+  /// Until the message ends, the cable refuses MIDI Library messages other
+  /// than real-time messages. One message per device may be in progress.
+  /// @param cable the virtual MIDI OUT cable
+  /// @param payload the payload bytes without 0xF0 and 0xF7; may be in
+  /// flash, and must stay valid until the message is done
+  /// @param nBytes the number of payload bytes
+  /// @param onProgress called after each part and when the message is done
+  /// or aborted; may be nullptr
+  /// @param context passed to onProgress
+  /// @return false if the device is not connected, has no such cable, or is
+  /// already sending a message
+  bool sendSysEx(uint8_t cable, const uint8_t* payload, uint32_t nBytes, SysExProgressCallback onProgress = nullptr,
+      void* context = nullptr) {
+    return devAddr != 0 && cable < nOutCables && sysexSender.start(transports + cable, payload, nBytes, nullptr, onProgress, context);
+  }
+
+  /// @brief Start sending a SysEx message whose payload generator supplies,
+  /// a buffer at a time, until it returns 0. See the other sendSysEx().
+  /// @param generator called with context whenever the sender needs more payload
+  bool sendSysEx(uint8_t cable, SysExGenerator generator, SysExProgressCallback onProgress = nullptr, void* context = nullptr) {
+    return devAddr != 0 && cable < nOutCables && generator != nullptr &&
+      sysexSender.start(transports + cable, nullptr, 0, generator, onProgress, context);
+  }
+
+  /// @return true if a sendSysEx() message is in progress
+  bool isSendingSysEx() { return sysexSender.isBusy(); }
+
+  /// @brief Stop the sendSysEx() message in progress, if any
+  void abortSysEx() { sysexSender.abort(); }
+
+  /// @brief Write the waiting coalesced control change and pitch bend
+  /// messages of every cable to the MIDI stream. To keep the delay
+  /// bounded, a new batch is written only after a flush has started
+  /// a transfer since the last batch; until then newer values keep
+  /// replacing the waiting ones. Does nothing if settings::TxCoalesceSlots
+  /// is 0. In dual-core mode, only the MIDI core calls this.
+  void drainCoalesced() {
+    if (settings::TxCoalesceSlots == 0 || devAddr == 0)
+        return;
+    uint32_t nFlushes = counters.txFlushes.get();
+    if (coalescedWaiting && nFlushes == coalescedFlushes)
+        return;
+    bool drained = false;
+    for (uint8_t idx = 0; idx < nOutCables; idx++)
+        drained = transports[idx].drainCoalesced() || drained;
+    coalescedWaiting = drained;
+    coalescedFlushes = nFlushes;
   }
 
   /// @brief
@@ -287,33 +733,110 @@ public:
 
   /// @brief
   /// @return the null-terminated Product string if the device has one
-  const uint8_t* getProductStr() {return productStr; }
+  /// and it has been fetched; see areStringsReady()
+  const uint8_t* getProductStr() {return getString(StringsProduct); }
 
   /// @brief
   /// @return the null-terminated Manufacturer string if the device has one
-  const uint8_t* getManufacturerStr() {return manufacturerStr; }
+  /// and it has been fetched; see areStringsReady()
+  const uint8_t* getManufacturerStr() {return getString(StringsManufacturer); }
 
   /// @brief
   /// @return the null-terminated Serial string if the device has one
-  const uint8_t* getSerialString() {return serialStr; }
+  /// and it has been fetched; see areStringsReady()
+  const uint8_t* getSerialString() {return getString(StringsSerial); }
 private:
+  /// The string descriptors left to fetch, in order
+  enum StringState : uint8_t { StringsLangId, StringsManufacturer, StringsProduct, StringsSerial, StringsDone };
+
+  static const uint8_t* noStr() { return reinterpret_cast<const uint8_t*>(""); }
+
+  const uint8_t* getString(StringState which) {
+    const uint8_t* str = areStringsReady() ? strings[which - StringsManufacturer] : nullptr;
+    return str != nullptr ? str : noStr();
+  }
+
+  /// Skip the strings the device does not have; publish the strings when done
+  void skipMissingStrings() {
+    if (stringState == StringsLangId && stringIndex[0] == 0 && stringIndex[1] == 0 && stringIndex[2] == 0)
+      stringState = StringsDone;
+    while (stringState != StringsLangId && stringState != StringsDone && stringIndex[stringState - StringsManufacturer] == 0)
+      stringState = static_cast<StringState>(stringState + 1);
+    if (stringState == StringsDone && devAddr != 0)
+      stringsReady.store(true, std::memory_order_release);
+  }
+
+  /// Call the cable's MIDI interface read() method once
+  /// @return true if read() returned a message
+  bool readInCable(uint8_t cable, MessageCallback onMessage) {
+    uint32_t now = settings::LatencyHistograms ? RPPICOMIDI_EZ_USB_MIDI_HOST_TIME_US() : 0;
+    if (!interfaces[cable]->read())
+      return false;
+    transports[cable].getCounters().rxMessages.add(1);
+    latencyStats.addRx(cable, now - transports[cable].getReadTimestamp());
+    if (onMessage != nullptr)
+      callOnMessage(onMessage, cable);
+    return true;
+  }
+
+  /// Hand the message the cable's MIDI interface just parsed to the unified message callback
+  void callOnMessage(MessageCallback onMessage, uint8_t cable) {
+    const Interface* midi = interfaces[cable];
+    EZ_USB_MIDI_HOST_Message message;
+    message.type = midi->getType();
+    message.channel = midi->getChannel();
+    message.data1 = midi->getData1();
+    message.data2 = midi->getData2();
+    message.sysexArray = nullptr;
+    message.sysexLength = 0;
+    if (message.type == MIDI_NAMESPACE::SystemExclusive) {
+      message.sysexArray = midi->getSysExArray();
+      message.sysexLength = midi->getSysExArrayLength();
+      message.data1 = 0;
+      message.data2 = 0;
+    }
+    onMessage(devAddr, cable, transports[cable].getReadTimestamp(), message);
+  }
+
   void clearTransports() {
+    sysexSender.abort();
     for (uint8_t idx = 0; idx < settings::MaxCables; idx++) {
         transports[idx].end();
     }
+    pendingInCables = 0;
+    readyInCables = 0;
+    inSysexCables = 0;
+    latencyStats.clearTx();
   }
   uint8_t devAddr;
   uint8_t nInCables;
   uint8_t nOutCables;
   uint16_t vid;
   uint16_t pid;
-  static const size_t maxDevStr = 512;
-  uint8_t productStr[maxDevStr];
-  uint8_t manufacturerStr[maxDevStr];
-  uint8_t serialStr[maxDevStr];
+  uint16_t pendingInCables; //!< bit n is set if cable n may have unread MIDI IN bytes
+  uint16_t readyInCables;   //!< bit n is set if cable n had a message the last read
+  uint16_t inSysexCables;   //!< bit n is set if cable n is receiving a SysEx message
+  std::atomic<uint16_t> filteredInCables; //!< bit n is set if cable n has a filter
+  std::atomic<uint32_t> inTypeFilters[settings::MaxCables];
+  std::atomic<uint16_t> inChannelFilters[settings::MaxCables];
+  uint8_t stringIndex[3]; //!< manufacturer, product and serial string descriptor indices; 0 if none
+  uint16_t languageID;
+  StringState stringState;
+  std::atomic<bool> stringsReady;
+  uint8_t* strings[3]; //!< manufacturer, product and serial strings in stringArena; nullptr if none
   void (*onMidiInWriteFail)(uint8_t devAddr, uint8_t cable, bool fifoOverflow);
+  bool coalescedWaiting;     //!< the last coalesced batch written may still be in the transmit FIFO
+  uint32_t coalescedFlushes; //!< counters.txFlushes when the last coalesced batch was written
   EZ_USB_MIDI_HOST_Transport<settings> transports[settings::MaxCables];
-  MIDI_NAMESPACE::MidiInterface<EZ_USB_MIDI_HOST_Transport<settings>, settings>* interfaces[settings::MaxCables];
+  EZ_USB_MIDI_HOST_SysExSender<settings> sysexSender;
+  EZ_USB_MIDI_HOST_LatencyStats<settings> latencyStats;
+  typename EZ_USB_MIDI_HOST_Transport<settings>::PriorityLane txPriorityLane; //!< MIDI core to USB host core, ahead of the MIDI OUT queues
+  EZ_USB_MIDI_HOST_ClockAnalyzers<settings> clockAnalyzers;
+  EZ_USB_MIDI_HOST_DeviceCounters counters;
+  EZ_USB_MIDI_HOST_InterfacePool<settings>* interfacePool;
+  Interface* interfaces[settings::MaxCables]; //!< nullptr if the cable has no interface object
+  StringArena* stringArena;
+  EZ_USB_MIDI_HOST_SysExChunker* sysexChunker;
 };
 
 END_EZ_USB_MIDI_HOST_NAMESPACE
@@ -0,0 +1,103 @@
+/*
+ * @file EZ_USB_MIDI_HOST_InterfacePool.h
+ * @brief A fixed pool of MIDI Library interface objects shared by all devices
+ *
+ * Every virtual cable of a connected device needs a MIDI Library
+ * MidiInterface object, and each of those carries a SysEx buffer. Instead
+ * of allocating one from the heap for every cable of every device slot,
+ * the library constructs them in place in this pool when a device
+ * connects and destroys them when it disconnects, so RAM use is
+ * settings::MidiInterfacePoolSize objects, fixed at compile time.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#pragma once
+#include <new>
+#include "MIDI.h"
+#include "EZ_USB_MIDI_HOST_Transport.h"
+#include "EZ_USB_MIDI_HOST_namespace.h"
+
+BEGIN_EZ_USB_MIDI_HOST_NAMESPACE
+
+/// @brief Storage for settings::MidiInterfacePoolSize MIDI Library
+/// interface objects. Only the core that connects devices may call
+/// alloc() and free(). Applications normally do not use this class.
+template<class settings>
+class EZ_USB_MIDI_HOST_InterfacePool {
+public:
+  using Interface = MIDI_NAMESPACE::MidiInterface<EZ_USB_MIDI_HOST_Transport<settings>, settings>;
+  static_assert(settings::MidiInterfacePoolSize != 0, "MidiInterfacePoolSize must be at least 1");
+
+  EZ_USB_MIDI_HOST_InterfacePool() {
+    for (unsigned idx = 0; idx < settings::MidiInterfacePoolSize; idx++)
+      used[idx] = false;
+  }
+
+  ~EZ_USB_MIDI_HOST_InterfacePool() {
+    for (unsigned idx = 0; idx < settings::MidiInterfacePoolSize; idx++) {
+      if (used[idx])
+        slot(idx)->~Interface();
+    }
+  }
+
+  EZ_USB_MIDI_HOST_InterfacePool(EZ_USB_MIDI_HOST_InterfacePool const &) = delete;
+  void operator=(EZ_USB_MIDI_HOST_InterfacePool const &) = delete;
+
+  /// @brief Construct an interface object for the transport in a free slot
+  /// @return a pointer to the object, or nullptr if every slot is in use
+  Interface* alloc(EZ_USB_MIDI_HOST_Transport<settings>& transport) {
+    for (unsigned idx = 0; idx < settings::MidiInterfacePoolSize; idx++) {
+      if (!used[idx]) {
+        used[idx] = true;
+        return new (storage[idx]) Interface(transport);
+      }
+    }
+    return nullptr;
+  }
+
+  /// @brief Destroy an object alloc() returned and free its slot
+  void free(Interface* intf) {
+    for (unsigned idx = 0; idx < settings::MidiInterfacePoolSize; idx++) {
+      if (used[idx] && slot(idx) == intf) {
+        intf->~Interface();
+        used[idx] = false;
+        return;
+      }
+    }
+  }
+
+  /// @return the number of free slots
+  unsigned getFreeCount() const {
+    unsigned nFree = 0;
+    for (unsigned idx = 0; idx < settings::MidiInterfacePoolSize; idx++)
+      nFree += used[idx] ? 0 : 1;
+    return nFree;
+  }
+private:
+  Interface* slot(unsigned idx) { return reinterpret_cast<Interface*>(storage[idx]); }
+
+  alignas(Interface) uint8_t storage[settings::MidiInterfacePoolSize][sizeof(Interface)];
+  bool used[settings::MidiInterfacePoolSize];
+};
+
+END_EZ_USB_MIDI_HOST_NAMESPACE
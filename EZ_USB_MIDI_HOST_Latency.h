@@ -0,0 +1,197 @@
+/*
+ * @file EZ_USB_MIDI_HOST_Latency.h
+ * @brief Optional latency histograms for the MIDI IN and MIDI OUT paths
+ *
+ * Set LatencyHistograms to true in the settings class to measure, per
+ * device and virtual cable, how long received MIDI data waits between the
+ * data received callback and the MIDI IN callback that readAll() triggers,
+ * and how long MIDI OUT messages wait between the MIDI Library send
+ * function and the tuh_midi_stream_flush() call that starts their USB
+ * transfer. Each delay goes into a histogram with power of 2 microsecond
+ * buckets. When LatencyHistograms is false, the classes in this file have
+ * no data and every method is an empty inline function.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#pragma once
+#include <cstdint>
+#include "EZ_USB_MIDI_HOST_namespace.h"
+
+BEGIN_EZ_USB_MIDI_HOST_NAMESPACE
+
+/// @brief A histogram of delays in microseconds. Bucket 0 counts delays
+/// of 0 us; bucket n counts delays from 2^(n-1) to 2^n - 1 us. The last
+/// bucket also counts every longer delay.
+class EZ_USB_MIDI_HOST_LatencyHistogram {
+public:
+  static const unsigned nBuckets = 24; //!< the last bucket starts at about 4 seconds
+
+  EZ_USB_MIDI_HOST_LatencyHistogram() { reset(); }
+
+  /// @brief Count one delay
+  /// @param delayUs the delay in microseconds
+  void add(uint32_t delayUs) {
+    unsigned bucket = delayUs == 0 ? 0 : 32 - __builtin_clz(delayUs);
+    if (bucket >= nBuckets)
+      bucket = nBuckets - 1;
+    ++buckets[bucket];
+    ++count;
+    if (delayUs > maxUs)
+      maxUs = delayUs;
+  }
+
+  /// @brief Clear all counts
+  void reset() {
+    for (unsigned idx = 0; idx < nBuckets; idx++)
+      buckets[idx] = 0;
+    count = 0;
+    maxUs = 0;
+  }
+
+  /// @return the number of delays counted since the last reset()
+  uint32_t getCount() const { return count; }
+
+  /// @return the longest delay counted since the last reset()
+  uint32_t getMaxUs() const { return maxUs; }
+
+  /// @param bucket the bucket number, 0 to nBuckets - 1
+  /// @return the number of delays counted in the bucket
+  uint32_t getBucket(unsigned bucket) const { return bucket < nBuckets ? buckets[bucket] : 0; }
+
+  /// @param bucket the bucket number, 0 to nBuckets - 1
+  /// @return the longest delay, in microseconds, bucket counts
+  /// (except for the last bucket, which counts every longer delay, too)
+  static uint32_t getBucketLimitUs(unsigned bucket) { return (1ul << bucket) - 1; }
+
+  /// @brief Estimate a percentile of the delays from the bucket counts
+  /// @param percent the percentile, 0 to 100
+  /// @return the upper limit of the bucket that contains the percentile,
+  /// but no more than getMaxUs(); 0 if no delays have been counted
+  uint32_t getPercentileUs(unsigned percent) const {
+    uint64_t target = (static_cast<uint64_t>(count) * percent + 99) / 100;
+    uint64_t total = 0;
+    for (unsigned idx = 0; idx < nBuckets; idx++) {
+      total += buckets[idx];
+      if (total >= target && total != 0)
+        return getBucketLimitUs(idx) < maxUs ? getBucketLimitUs(idx) : maxUs;
+    }
+    return maxUs;
+  }
+private:
+  uint32_t buckets[nBuckets];
+  uint32_t count;
+  uint32_t maxUs;
+};
+
+/// @brief The MIDI IN and MIDI OUT latency histograms of one connected device
+/// @tparam settings the settings class; its MaxCables and MidiTxBufsize set the size
+/// @tparam enabled settings::LatencyHistograms
+template<class settings, bool enabled = settings::LatencyHistograms>
+class EZ_USB_MIDI_HOST_LatencyStats {
+public:
+  /// Pass as the cable to onTxWrite() for packets that are not the end of a timed message
+  static constexpr uint8_t untimed = 0xff;
+
+  EZ_USB_MIDI_HOST_LatencyStats() : txWrIdx{0}, txRdIdx{0}, txPacketsFlushed{0} { }
+
+  /// @brief Count the delay from the data received callback to the MIDI IN callback
+  void addRx(uint8_t cable, uint32_t delayUs) { rx[cable].add(delayUs); }
+
+  /// @brief Remember that a MIDI OUT message was written to the usb_midi_host driver
+  /// @param cable the virtual MIDI OUT cable
+  /// @param nPackets the number of USB MIDI packets the message takes
+  /// @param timestamp the time the message was written
+  void onTxWrite(uint8_t cable, uint16_t nPackets, uint32_t timestamp) {
+    if (txWrIdx - txRdIdx < txDepth) {
+      txPending[txWrIdx % txDepth] = {timestamp, nPackets, cable};
+      ++txWrIdx;
+    }
+  }
+
+  /// @brief Count the delay of every MIDI OUT message whose last packet a
+  /// tuh_midi_stream_flush() call just started sending
+  /// @param nPackets the number of packets the flush sent
+  /// @param timestamp the time of the flush
+  void onTxFlush(uint32_t nPackets, uint32_t timestamp) {
+    txPacketsFlushed += nPackets;
+    while (txWrIdx != txRdIdx && txPending[txRdIdx % txDepth].nPackets <= txPacketsFlushed) {
+      const TxPending& oldest = txPending[txRdIdx % txDepth];
+      txPacketsFlushed -= oldest.nPackets;
+      if (oldest.cable != untimed)
+        tx[oldest.cable].add(timestamp - oldest.timestamp);
+      ++txRdIdx;
+    }
+    if (txWrIdx == txRdIdx)
+      txPacketsFlushed = 0;
+  }
+
+  /// @return the MIDI IN histogram for the cable
+  const EZ_USB_MIDI_HOST_LatencyHistogram* getRx(uint8_t cable) const { return rx + cable; }
+
+  /// @return the MIDI OUT histogram for the cable
+  const EZ_USB_MIDI_HOST_LatencyHistogram* getTx(uint8_t cable) const { return tx + cable; }
+
+  /// @brief Clear the histograms of all cables
+  void reset() {
+    for (unsigned idx = 0; idx < settings::MaxCables; idx++) {
+      rx[idx].reset();
+      tx[idx].reset();
+    }
+  }
+
+  /// @brief Forget the MIDI OUT messages waiting to be flushed
+  void clearTx() {
+    txRdIdx = txWrIdx;
+    txPacketsFlushed = 0;
+  }
+private:
+  struct TxPending {
+    uint32_t timestamp;
+    uint16_t nPackets;
+    uint8_t cable;
+  };
+  /// Each message takes at least one packet of the driver transmit FIFO
+  static const unsigned txDepth = settings::MidiTxBufsize / 4;
+  EZ_USB_MIDI_HOST_LatencyHistogram rx[settings::MaxCables];
+  EZ_USB_MIDI_HOST_LatencyHistogram tx[settings::MaxCables];
+  TxPending txPending[txDepth];
+  unsigned txWrIdx;
+  unsigned txRdIdx;
+  uint32_t txPacketsFlushed; //!< packets of txPending[txRdIdx] already sent
+};
+
+/// @brief Latency histograms disabled; uses no memory and no time
+template<class settings>
+class EZ_USB_MIDI_HOST_LatencyStats<settings, false> {
+public:
+  static constexpr uint8_t untimed = 0xff;
+  void addRx(uint8_t, uint32_t) { }
+  void onTxWrite(uint8_t, uint16_t, uint32_t) { }
+  void onTxFlush(uint32_t, uint32_t) { }
+  const EZ_USB_MIDI_HOST_LatencyHistogram* getRx(uint8_t) const { return nullptr; }
+  const EZ_USB_MIDI_HOST_LatencyHistogram* getTx(uint8_t) const { return nullptr; }
+  void reset() { }
+  void clearTx() { }
+};
+
+END_EZ_USB_MIDI_HOST_NAMESPACE
@@ -0,0 +1,147 @@
+/*
+ * @file EZ_USB_MIDI_HOST_Packet.h
+ * @brief Helper functions for 4-byte USB MIDI 1.0 event packets
+ *
+ * Byte 0 of a USB MIDI event packet holds the virtual cable number
+ * in the upper nibble and the Code Index Number (CIN) in the lower
+ * nibble. Bytes 1-3 hold up to 3 bytes of the MIDI message; unused
+ * bytes are 0. See section 4 of the USB Device Class Definition for
+ * MIDI Devices, Release 1.0.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#pragma once
+#include <cstdint>
+#include "EZ_USB_MIDI_HOST_namespace.h"
+
+BEGIN_EZ_USB_MIDI_HOST_NAMESPACE
+
+/// @brief Decode fields of a USB MIDI event packet. All functions take
+/// a pointer to the 4 bytes of one packet.
+class EZ_USB_MIDI_HOST_Packet {
+public:
+  /// Message type bits that getTypeBit() returns. Channel messages use
+  /// bit (status >> 4); system messages use bit (16 + (status & 0xF)).
+  enum TypeBit : uint32_t {
+    NoteOff              = 1ul << 8,
+    NoteOn               = 1ul << 9,
+    PolyPressure         = 1ul << 10,
+    ControlChange        = 1ul << 11,
+    ProgramChange        = 1ul << 12,
+    ChannelPressure      = 1ul << 13,
+    PitchBend            = 1ul << 14,
+    TimeCodeQuarterFrame = 1ul << 17,
+    SongPosition         = 1ul << 18,
+    SongSelect           = 1ul << 19,
+    TuneRequest          = 1ul << 22,
+    Clock                = 1ul << 24,
+    Start                = 1ul << 26,
+    Continue             = 1ul << 27,
+    Stop                 = 1ul << 28,
+    ActiveSensing        = 1ul << 30,
+    SystemReset          = 1ul << 31,
+    ChannelMessages      = 0x7ful << 8,
+    RealTime             = 0xfful << 24
+  };
+
+  /// @return the virtual cable number of the packet
+  static uint8_t getCable(const uint8_t* packet) { return (packet[0] >> 4) & 0xf; }
+
+  /// @return the Code Index Number of the packet
+  static uint8_t getCIN(const uint8_t* packet) { return packet[0] & 0xf; }
+
+  /// @return the number of MIDI bytes (0-3) the packet carries according to its CIN.
+  /// Reserved CIN values 0 and 1 return 0.
+  static uint8_t getMidiLength(const uint8_t* packet) {
+    static const uint8_t cinToLength[16] = {0, 0, 2, 3, 3, 1, 2, 3, 3, 3, 3, 3, 2, 2, 3, 1};
+    return cinToLength[getCIN(packet)];
+  }
+
+  /// @return a pointer to the first MIDI byte of the packet
+  static const uint8_t* getMidiBytes(const uint8_t* packet) { return packet + 1; }
+
+  /// @return the TypeBit of the message the packet starts, or 0 if the
+  /// packet is part of a SysEx message (which has no type bit)
+  static uint32_t getTypeBit(const uint8_t* packet) {
+    uint8_t status = packet[1];
+    if (status < 0x80 || status == 0xF0 || status == 0xF7)
+      return 0;
+    return status < 0xF0 ? 1ul << (status >> 4) : 1ul << (16 + (status & 0xf));
+  }
+
+  /// @return the channel (0-15) of a packet that carries a channel message
+  static uint8_t getChannel(const uint8_t* packet) { return packet[1] & 0xf; }
+
+  /// @brief get the number of bytes, starting at packet[1], that belong in
+  /// the MIDI byte stream for the packet's cable.
+  ///
+  /// This decodes packets the same way the usb_midi_host stream read
+  /// function does: it ignores the CIN, because too many devices encode it
+  /// wrong, and uses the status byte and the SysEx state of the cable instead.
+  /// @param packet points to the 4 bytes of the packet
+  /// @param inSysexCables is a bitmap of the cables that are in the middle
+  /// of a SysEx message; it is updated
+  /// @return the number of MIDI stream bytes (0-3)
+  static uint8_t getStreamLength(const uint8_t* packet, uint16_t& inSysexCables) {
+    uint8_t status = packet[1];
+    uint16_t cableBit = 1u << getCable(packet);
+    uint8_t nBytes = 0;
+    if (status < 0x80 || status == 0xF0) {
+      if (status == 0xF0)
+        inSysexCables |= cableBit;
+      // only SysEx packets may start with a data byte
+      if (inSysexCables & cableBit) {
+        for (uint8_t idx = 1; idx < 4 && nBytes == 0; idx++) {
+          if (packet[idx] == 0xF7) {
+            inSysexCables &= ~cableBit;
+            nBytes = idx;
+          }
+        }
+        if (nBytes == 0)
+          nBytes = 3;
+      }
+    }
+    else if (status < 0xF0) {
+      // Channel message; Program Change and Channel Pressure are 2 bytes
+      nBytes = ((status & 0xE0) == 0xC0) ? 2 : 3;
+      inSysexCables &= ~cableBit;
+    }
+    else if (status < 0xF8) {
+      // System Common message
+      if (status == 0xF1 || status == 0xF3)
+        nBytes = 2;
+      else if (status == 0xF2)
+        nBytes = 3;
+      else if (status == 0xF6 || status == 0xF7)
+        nBytes = 1;
+      inSysexCables &= ~cableBit;
+    }
+    else {
+      // Real-time messages may be inserted into a SysEx message
+      nBytes = 1;
+    }
+    return nBytes;
+  }
+};
+
+END_EZ_USB_MIDI_HOST_NAMESPACE
@@ -0,0 +1,212 @@
+/*
+ * @file EZ_USB_MIDI_HOST_Router.h
+ * @brief Optional MIDI thru routes between the virtual cables of
+ * connected devices
+ *
+ * A route sends every USB MIDI packet a device receives on one virtual
+ * cable to a virtual cable of another device (or of the same device).
+ * The packets are forwarded from the data received callback, before any
+ * parsing, by rewriting the cable number and writing the packet to the
+ * usb_midi_host driver transmit FIFO of the destination. Set MaxRoutes in
+ * the settings class to use routes. When MaxRoutes is 0, the classes in
+ * this file have no data and every method is an empty inline function.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include "usb_midi_host.h"
+#include "EZ_USB_MIDI_HOST_Config.h"
+#include "EZ_USB_MIDI_HOST_Counters.h"
+#include "EZ_USB_MIDI_HOST_namespace.h"
+
+BEGIN_EZ_USB_MIDI_HOST_NAMESPACE
+
+/// @brief A table of settings::MaxRoutes routes. Only the core that calls
+/// readAll() may call add(), remove() and removeDevice(); only the USB host
+/// core (the core that calls tuh_task()) may call forward() and flush().
+/// Each route is one 32-bit word that is written in a single store, so the
+/// USB host core never sees half a route. Applications normally do not use
+/// this class.
+/// @tparam enabled settings::MaxRoutes > 0
+template<class settings, bool enabled = (settings::MaxRoutes > 0)>
+class EZ_USB_MIDI_HOST_Router {
+public:
+  EZ_USB_MIDI_HOST_Router() {
+    for (unsigned idx = 0; idx < settings::MaxRoutes; idx++)
+      routes[idx].store(0, std::memory_order_relaxed);
+    for (unsigned idx = 0; idx <= RPPICOMIDI_TUH_MIDI_MAX_DEV_ADDR; idx++)
+      routedCables[idx].store(0, std::memory_order_relaxed);
+  }
+
+  EZ_USB_MIDI_HOST_Router(EZ_USB_MIDI_HOST_Router const &) = delete;
+  void operator=(EZ_USB_MIDI_HOST_Router const &) = delete;
+
+  /// @brief Add a route. Adding a route that exists does nothing.
+  /// @return false if an argument is out of range or the table is full
+  bool add(uint8_t srcDevAddr, uint8_t srcCable, uint8_t dstDevAddr, uint8_t dstCable) {
+    if (!isValid(srcDevAddr, srcCable) || !isValid(dstDevAddr, dstCable))
+      return false;
+    uint32_t route = pack(srcDevAddr, srcCable, dstDevAddr, dstCable);
+    int freeIdx = -1;
+    for (unsigned idx = 0; idx < settings::MaxRoutes; idx++) {
+      uint32_t entry = routes[idx].load(std::memory_order_relaxed);
+      if (entry == route)
+        return true;
+      if (entry == 0 && freeIdx < 0)
+        freeIdx = idx;
+    }
+    if (freeIdx < 0)
+      return false;
+    routes[freeIdx].store(route, std::memory_order_release);
+    routedCables[srcDevAddr].store(routedCables[srcDevAddr].load(std::memory_order_relaxed) | (1u << srcCable),
+      std::memory_order_release);
+    return true;
+  }
+
+  /// @brief Remove a route
+  /// @return false if there is no such route
+  bool remove(uint8_t srcDevAddr, uint8_t srcCable, uint8_t dstDevAddr, uint8_t dstCable) {
+    if (!isValid(srcDevAddr, srcCable) || !isValid(dstDevAddr, dstCable))
+      return false;
+    uint32_t route = pack(srcDevAddr, srcCable, dstDevAddr, dstCable);
+    for (unsigned idx = 0; idx < settings::MaxRoutes; idx++) {
+      if (routes[idx].load(std::memory_order_relaxed) == route) {
+        routes[idx].store(0, std::memory_order_release);
+        updateRoutedCables(srcDevAddr);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /// @brief Remove every route from or to a device
+  void removeDevice(uint8_t devAddr) {
+    if (devAddr == 0 || devAddr > RPPICOMIDI_TUH_MIDI_MAX_DEV_ADDR)
+      return;
+    for (unsigned idx = 0; idx < settings::MaxRoutes; idx++) {
+      uint32_t entry = routes[idx].load(std::memory_order_relaxed);
+      if (entry != 0 && (getSrcDevAddr(entry) == devAddr || getDstDevAddr(entry) == devAddr)) {
+        routes[idx].store(0, std::memory_order_release);
+        updateRoutedCables(getSrcDevAddr(entry));
+      }
+    }
+  }
+
+  /// @return true if any virtual cable of the device has a route
+  bool isRouted(uint8_t srcDevAddr) const {
+    return srcDevAddr <= RPPICOMIDI_TUH_MIDI_MAX_DEV_ADDR && routedCables[srcDevAddr].load(std::memory_order_acquire) != 0;
+  }
+
+  /// @brief Write a packet the device sent to the driver transmit FIFO of
+  /// every destination of the packet's cable
+  /// @param counters the source device's counters
+  /// @param getDevice returns the EZ_USB_MIDI_HOST_Device of a device address
+  /// as the USB host core sees it, or nullptr
+  template<class DeviceLookup>
+  void forward(uint8_t srcDevAddr, const uint8_t* packet, EZ_USB_MIDI_HOST_DeviceCounters& counters, DeviceLookup getDevice) {
+    uint8_t srcCable = (packet[0] >> 4) & 0xf;
+    if ((routedCables[srcDevAddr].load(std::memory_order_acquire) & (1u << srcCable)) == 0)
+      return;
+    for (unsigned idx = 0; idx < settings::MaxRoutes; idx++) {
+      uint32_t entry = routes[idx].load(std::memory_order_acquire);
+      if (entry != 0 && getSrcDevAddr(entry) == srcDevAddr && getSrcCable(entry) == srcCable) {
+        uint8_t out[4] = {static_cast<uint8_t>((getDstCable(entry) << 4) | (packet[0] & 0xf)), packet[1], packet[2], packet[3]};
+        auto dst = getDevice(getDstDevAddr(entry));
+        if (dst != nullptr && dst->writeThruPacket(out))
+          counters.thruPackets.add(1);
+        else
+          counters.thruDroppedPackets.add(1);
+      }
+    }
+  }
+
+  /// @brief Start sending the packets forward() wrote for the device's routes.
+  /// Each destination flushes with its own writeFlush(), so its transmit
+  /// counters and latency histograms count the transfer.
+  /// @param getDevice as for forward()
+  template<class DeviceLookup>
+  void flush(uint8_t srcDevAddr, DeviceLookup getDevice) {
+    for (unsigned idx = 0; idx < settings::MaxRoutes; idx++) {
+      uint32_t entry = routes[idx].load(std::memory_order_relaxed);
+      if (entry != 0 && getSrcDevAddr(entry) == srcDevAddr) {
+        auto dst = getDevice(getDstDevAddr(entry));
+        if (dst != nullptr)
+          dst->writeFlush();
+      }
+    }
+  }
+
+  /// @return the number of routes in the table
+  unsigned getRouteCount() const {
+    unsigned nRoutes = 0;
+    for (unsigned idx = 0; idx < settings::MaxRoutes; idx++)
+      nRoutes += routes[idx].load(std::memory_order_relaxed) != 0 ? 1 : 0;
+    return nRoutes;
+  }
+private:
+  static bool isValid(uint8_t devAddr, uint8_t cable) {
+    return devAddr != 0 && devAddr <= RPPICOMIDI_TUH_MIDI_MAX_DEV_ADDR && cable < settings::MaxCables;
+  }
+  // A route is never 0 because device address 0 is never valid
+  static uint32_t pack(uint8_t srcDevAddr, uint8_t srcCable, uint8_t dstDevAddr, uint8_t dstCable) {
+    return (static_cast<uint32_t>(srcDevAddr) << 24) | (static_cast<uint32_t>(srcCable) << 16) |
+      (static_cast<uint32_t>(dstDevAddr) << 8) | dstCable;
+  }
+  static uint8_t getSrcDevAddr(uint32_t route) { return route >> 24; }
+  static uint8_t getSrcCable(uint32_t route) { return (route >> 16) & 0xff; }
+  static uint8_t getDstDevAddr(uint32_t route) { return (route >> 8) & 0xff; }
+  static uint8_t getDstCable(uint32_t route) { return route & 0xff; }
+
+  /// Recompute the bitmap of routed cables of a source device from the table
+  void updateRoutedCables(uint8_t srcDevAddr) {
+    uint16_t cables = 0;
+    for (unsigned idx = 0; idx < settings::MaxRoutes; idx++) {
+      uint32_t entry = routes[idx].load(std::memory_order_relaxed);
+      if (entry != 0 && getSrcDevAddr(entry) == srcDevAddr)
+        cables |= 1u << getSrcCable(entry);
+    }
+    routedCables[srcDevAddr].store(cables, std::memory_order_release);
+  }
+
+  std::atomic<uint32_t> routes[settings::MaxRoutes]; //!< 0 if the entry is free
+  std::atomic<uint16_t> routedCables[RPPICOMIDI_TUH_MIDI_MAX_DEV_ADDR + 1]; //!< bit n is set if cable n of the device has a route
+};
+
+/// @brief Routes disabled; uses no memory and no time
+template<class settings>
+class EZ_USB_MIDI_HOST_Router<settings, false> {
+public:
+  bool add(uint8_t, uint8_t, uint8_t, uint8_t) { return false; }
+  bool remove(uint8_t, uint8_t, uint8_t, uint8_t) { return false; }
+  void removeDevice(uint8_t) { }
+  bool isRouted(uint8_t) const { return false; }
+  template<class DeviceLookup>
+  void forward(uint8_t, const uint8_t*, EZ_USB_MIDI_HOST_DeviceCounters&, DeviceLookup) { }
+  template<class DeviceLookup>
+  void flush(uint8_t, DeviceLookup) { }
+  unsigned getRouteCount() const { return 0; }
+};
+
+END_EZ_USB_MIDI_HOST_NAMESPACE
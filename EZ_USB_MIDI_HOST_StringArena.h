@@ -0,0 +1,146 @@
+/*
+ * @file EZ_USB_MIDI_HOST_StringArena.h
+ * @brief Storage for the UTF-8 manufacturer, product and serial strings
+ * of all connected devices
+ *
+ * Device strings are usually much shorter than the longest possible string
+ * descriptor, so instead of giving every device slot room for the longest
+ * possible strings, all devices share one arena of settings::StringArenaSize
+ * bytes. The arena is a list of blocks, each with a 2-byte header that holds
+ * the block size and an in-use flag. Blocks never move, so a string stays
+ * put until its device disconnects.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#pragma once
+#include <cstdint>
+#include "EZ_USB_MIDI_HOST_namespace.h"
+
+BEGIN_EZ_USB_MIDI_HOST_NAMESPACE
+
+/// @brief A first-fit allocator for short strings. Only the core that
+/// connects devices may call alloc(), shrink() and free().
+/// Applications normally do not use this class.
+/// @tparam arenaSize the total size in bytes, including block headers
+template<unsigned arenaSize>
+class EZ_USB_MIDI_HOST_StringArena {
+public:
+  EZ_USB_MIDI_HOST_StringArena() { setHeader(0, arenaSize - hdrSize, false); }
+
+  EZ_USB_MIDI_HOST_StringArena(EZ_USB_MIDI_HOST_StringArena const &) = delete;
+  void operator=(EZ_USB_MIDI_HOST_StringArena const &) = delete;
+
+  /// @brief Allocate up to maxLen bytes. If no free block is big enough,
+  /// take the largest free block instead so a long string can be stored
+  /// truncated rather than not at all.
+  /// @param maxLen the number of bytes wanted
+  /// @param len set to the number of bytes allocated
+  /// @return the allocated bytes or nullptr if the arena is full
+  uint8_t* alloc(uint16_t maxLen, uint16_t& len) {
+    unsigned best = arenaSize;
+    uint16_t bestSize = 0;
+    for (unsigned pos = 0; pos < arenaSize; pos += hdrSize + getSize(pos)) {
+      if (!isUsed(pos) && getSize(pos) > bestSize) {
+        best = pos;
+        bestSize = getSize(pos);
+        if (bestSize >= maxLen)
+          break;
+      }
+    }
+    if (bestSize == 0)
+      return nullptr;
+    len = bestSize < maxLen ? bestSize : maxLen;
+    setHeader(best, bestSize, true);
+    split(best, len);
+    return arena + best + hdrSize;
+  }
+
+  /// @brief Return the bytes of an allocated block past the first len to the arena
+  void shrink(uint8_t* ptr, uint16_t len) {
+    unsigned pos = ptr - arena - hdrSize;
+    if (len == 0)
+      len = 1;
+    if (len < getSize(pos)) {
+      split(pos, len);
+      merge();
+    }
+  }
+
+  /// @brief Return a block alloc() returned to the arena
+  void free(uint8_t* ptr) {
+    unsigned pos = ptr - arena - hdrSize;
+    setHeader(pos, getSize(pos), false);
+    merge();
+  }
+
+  /// @return the number of bytes in the largest free block
+  uint16_t getLargestFree() const {
+    uint16_t largest = 0;
+    for (unsigned pos = 0; pos < arenaSize; pos += hdrSize + getSize(pos)) {
+      if (!isUsed(pos) && getSize(pos) > largest)
+        largest = getSize(pos);
+    }
+    return largest;
+  }
+private:
+  static const unsigned hdrSize = 2;
+  static const uint16_t usedFlag = 0x8000;
+  static const uint16_t sizeMask = 0x7fff;
+  static_assert(arenaSize >= hdrSize + 1 && arenaSize <= sizeMask + hdrSize, "StringArenaSize must be 3 to 32769 bytes");
+
+  uint16_t getHeader(unsigned pos) const { return arena[pos] | (arena[pos + 1] << 8); }
+  uint16_t getSize(unsigned pos) const { return getHeader(pos) & sizeMask; }
+  bool isUsed(unsigned pos) const { return (getHeader(pos) & usedFlag) != 0; }
+  void setHeader(unsigned pos, uint16_t size, bool used) {
+    uint16_t hdr = size | (used ? usedFlag : 0);
+    arena[pos] = hdr & 0xff;
+    arena[pos + 1] = hdr >> 8;
+  }
+
+  /// If the block at pos has room for another block after its first len
+  /// bytes, make the rest a new free block
+  void split(unsigned pos, uint16_t len) {
+    uint16_t size = getSize(pos);
+    if (size > len + hdrSize) {
+      setHeader(pos, len, isUsed(pos));
+      setHeader(pos + hdrSize + len, size - len - hdrSize, false);
+    }
+  }
+
+  /// Join every run of adjacent free blocks into one block
+  void merge() {
+    for (unsigned pos = 0; pos < arenaSize; pos += hdrSize + getSize(pos)) {
+      if (isUsed(pos))
+        continue;
+      unsigned next = pos + hdrSize + getSize(pos);
+      while (next < arenaSize && !isUsed(next)) {
+        setHeader(pos, getSize(pos) + hdrSize + getSize(next), false);
+        next = pos + hdrSize + getSize(pos);
+      }
+    }
+  }
+
+  uint8_t arena[arenaSize];
+};
+
+END_EZ_USB_MIDI_HOST_NAMESPACE
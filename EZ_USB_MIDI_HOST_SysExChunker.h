@@ -0,0 +1,131 @@
+/*
+ * @file EZ_USB_MIDI_HOST_SysExChunker.h
+ * @brief Streaming delivery of received SysEx messages in chunks
+ *
+ * The MIDI Library collects a whole SysEx message in a SysExMaxSize buffer
+ * before it calls the application, so every cable of every device needs a
+ * buffer as long as the longest message it may receive. In streaming mode,
+ * the SysEx payload bytes skip the MIDI IN FIFO and the MIDI Library and
+ * go to a callback in chunks as the USB MIDI packets arrive, so a patch
+ * dump of any length needs only one chunk-sized buffer for all devices.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#pragma once
+#include <cstdint>
+#include "EZ_USB_MIDI_HOST_namespace.h"
+
+BEGIN_EZ_USB_MIDI_HOST_NAMESPACE
+
+/// @brief The application's SysEx chunk callback. The arguments are the device
+/// address, the virtual cable, a pointer to the payload bytes (without 0xF0 and
+/// 0xF7), the number of payload bytes (may be 0) and
+/// EZ_USB_MIDI_HOST_SysExChunker::Marker bits. The bytes are only valid until
+/// the callback returns.
+using SysExChunkCallback = void (*)(uint8_t devAddr, uint8_t cable, const uint8_t* payload, uint16_t nBytes, uint8_t markers);
+
+/// @brief Collects the payload bytes of received SysEx messages and passes
+/// them to the application in chunks. One object serves every device of an
+/// EZ_USB_MIDI_HOST object; only the core that calls readAll() may use it.
+/// Applications normally do not use this class.
+class EZ_USB_MIDI_HOST_SysExChunker {
+public:
+  /// Bits of the callback's markers argument. A chunk with neither Start
+  /// nor End continues the message of the chunk before it on the same
+  /// device and cable.
+  enum Marker : uint8_t {
+    Start = 1, //!< the chunk is the first of a message
+    End   = 2, //!< the chunk is the last of a message
+    Abort = 4  //!< set with End if a status byte other than 0xF7 ended the message
+  };
+
+  /// One full speed bulk transfer's worth of SysEx payload bytes
+  static const uint16_t chunkSize = 48;
+
+  EZ_USB_MIDI_HOST_SysExChunker() : appOnChunk{nullptr}, devAddr{0}, cable{0}, markers{0}, nBytes{0} { }
+
+  /// @brief Set the callback; nullptr turns streaming mode off
+  void setCallback(SysExChunkCallback fptr) { appOnChunk = fptr; }
+
+  /// @return true if SysEx messages go to the callback
+  bool isEnabled() const { return appOnChunk != nullptr; }
+
+  /// @brief Add the SysEx bytes of one USB MIDI packet
+  /// @param devAddr_ the device address
+  /// @param cable_ the virtual cable
+  /// @param bytes the MIDI bytes of the packet, including any 0xF0 or 0xF7
+  /// @param nBytes_ the number of MIDI bytes (1-3)
+  void add(uint8_t devAddr_, uint8_t cable_, const uint8_t* bytes, uint8_t nBytes_) {
+    if (nBytes != 0 || markers != 0) {
+      if (devAddr_ != devAddr || cable_ != cable)
+        flush();
+    }
+    devAddr = devAddr_;
+    cable = cable_;
+    for (uint8_t idx = 0; idx < nBytes_; idx++) {
+      uint8_t byte = bytes[idx];
+      if (byte == 0xF0) {
+        if (nBytes != 0 || markers != 0)
+          flush();
+        markers = Start;
+      }
+      else if (byte == 0xF7) {
+        markers |= End;
+        flush();
+      }
+      else {
+        if (nBytes == chunkSize)
+          flush();
+        chunk[nBytes++] = byte;
+      }
+    }
+  }
+
+  /// @brief End the SysEx message on the device's cable because another
+  /// message interrupted it
+  void abort(uint8_t devAddr_, uint8_t cable_) {
+    if ((nBytes != 0 || markers != 0) && (devAddr_ != devAddr || cable_ != cable))
+      flush();
+    devAddr = devAddr_;
+    cable = cable_;
+    markers |= End | Abort;
+    flush();
+  }
+
+  /// @brief Pass the collected bytes, if any, to the callback
+  void flush() {
+    if ((nBytes != 0 || markers != 0) && appOnChunk != nullptr)
+      appOnChunk(devAddr, cable, chunk, nBytes, markers);
+    nBytes = 0;
+    markers = 0;
+  }
+private:
+  SysExChunkCallback appOnChunk;
+  uint8_t devAddr;
+  uint8_t cable;
+  uint8_t markers;
+  uint16_t nBytes;
+  uint8_t chunk[chunkSize];
+};
+
+END_EZ_USB_MIDI_HOST_NAMESPACE
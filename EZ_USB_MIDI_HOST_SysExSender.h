@@ -0,0 +1,209 @@
+/*
+ * @file EZ_USB_MIDI_HOST_SysExSender.h
+ * @brief Non-blocking transmission of SysEx messages of any length
+ *
+ * The MIDI Library writes a whole SysEx message at once, so the transmit
+ * FIFO must hold all of it. The sender instead writes a message a few
+ * packets at a time, from the writeFlushAll() loop, pulling the payload
+ * from a caller's array (which may be in flash) or from a generator
+ * callback, so firmware and sample uploads need no large RAM buffer.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#pragma once
+#include <cstdint>
+#include "EZ_USB_MIDI_HOST_Transport.h"
+#include "EZ_USB_MIDI_HOST_Latency.h"
+#include "EZ_USB_MIDI_HOST_namespace.h"
+
+BEGIN_EZ_USB_MIDI_HOST_NAMESPACE
+
+/// @brief Status passed to a SysExProgressCallback
+enum EZ_USB_MIDI_HOST_SysExStatus : uint8_t {
+  SysExSending, //!< more of the message has been written
+  SysExDone,    //!< the whole message, including 0xF7, has been written
+  SysExAborted  //!< the message was cut off by abortSysEx() or a disconnect
+};
+
+/// @brief Fill buffer with up to maxBytes of SysEx payload bytes (0x00-0x7F).
+/// @return the number of bytes written to buffer; 0 ends the message
+using SysExGenerator = uint16_t (*)(uint8_t* buffer, uint16_t maxBytes, void* context);
+
+/// @brief Reports the progress of a bulk SysEx message. The arguments are the
+/// device address, the virtual cable, the number of payload bytes written so
+/// far, the status and the context pointer passed to sendSysEx().
+using SysExProgressCallback = void (*)(uint8_t devAddr, uint8_t cable, uint32_t nSent, EZ_USB_MIDI_HOST_SysExStatus status, void* context);
+
+/// @brief Writes one SysEx message at a time to a virtual cable of a
+/// connected device. Only the core that runs the MIDI Library may use it.
+/// Applications normally do not use this class; see
+/// EZ_USB_MIDI_HOST_Device::sendSysEx().
+template<class settings>
+class EZ_USB_MIDI_HOST_SysExSender {
+public:
+  using Transport = EZ_USB_MIDI_HOST_Transport<settings>;
+
+  EZ_USB_MIDI_HOST_SysExSender() : transport{nullptr}, payload{nullptr}, nLeft{0}, generator{nullptr},
+      onProgress{nullptr}, context{nullptr}, nSent{0}, startTime{0}, flushes{0},
+      genLen{0}, genPos{0}, started{false}, exhausted{false}, waiting{false} { }
+
+  EZ_USB_MIDI_HOST_SysExSender(EZ_USB_MIDI_HOST_SysExSender const &) = delete;
+  void operator=(EZ_USB_MIDI_HOST_SysExSender const &) = delete;
+
+  /// @brief Start sending a message. Either payload_ or generator_ supplies
+  /// the payload bytes; the sender adds 0xF0 and 0xF7.
+  /// @return false if a message is already being sent
+  bool start(Transport* transport_, const uint8_t* payload_, uint32_t nBytes, SysExGenerator generator_,
+      SysExProgressCallback onProgress_, void* context_) {
+    if (transport != nullptr)
+      return false;
+    transport = transport_;
+    payload = payload_;
+    nLeft = nBytes;
+    generator = generator_;
+    onProgress = onProgress_;
+    context = context_;
+    nSent = 0;
+    genLen = 0;
+    genPos = 0;
+    started = false;
+    exhausted = false;
+    waiting = false;
+    startTime = settings::LatencyHistograms ? RPPICOMIDI_EZ_USB_MIDI_HOST_TIME_US() : 0;
+    transport->setSysExBusy(true);
+    return true;
+  }
+
+  /// @return true if a message is being sent
+  bool isBusy() const { return transport != nullptr; }
+
+  /// @brief Write as much of the message as one bulk transfer carries if
+  /// the MIDI OUT FIFO has room. After a batch, wait until a flush has
+  /// started a transfer so the FIFO always has room for other messages.
+  /// @param txFlushes the device's txFlushes counter
+  /// @param latencyStats the device's latency histograms
+  void service(uint32_t txFlushes, EZ_USB_MIDI_HOST_LatencyStats<settings>& latencyStats) {
+    if (transport == nullptr || (waiting && txFlushes == flushes))
+      return;
+    uint16_t nBatch = 0;
+    bool done = false;
+    uint8_t cable = transport->getCableNum();
+    while (!done && nBatch < packetsPerBatch && transport->canWritePacket()) {
+      uint8_t packet[4] = {0, 0, 0, 0};
+      uint8_t nBytes = 0;
+      if (!started) {
+        packet[1 + nBytes++] = 0xF0;
+        started = true;
+      }
+      uint8_t nPayload = exhausted ? 0 : pull(packet + 1 + nBytes, 3 - nBytes);
+      nBytes += nPayload;
+      // CIN 4 starts or continues a SysEx message; CIN 5-7 end it with 1-3 bytes
+      uint8_t cin = 0x4;
+      if (exhausted && nBytes < 3) {
+        packet[1 + nBytes++] = 0xF7;
+        cin = 0x4 + nBytes;
+        done = true;
+      }
+      packet[0] = static_cast<uint8_t>((cable << 4) | cin);
+      if (!transport->writePacket(packet, nBytes)) {
+        // canWritePacket() said there was room, so the device is gone
+        finish(SysExAborted);
+        return;
+      }
+      nSent += nPayload;
+      ++nBatch;
+    }
+    if (nBatch == 0)
+      return;
+    waiting = true;
+    flushes = txFlushes;
+    if (settings::LatencyHistograms && !transport->isDualCore()) {
+      // The message is timed once, when its last packet goes out
+      latencyStats.onTxWrite(done ? cable : latencyStats.untimed, nBatch, startTime);
+    }
+    if (done)
+      finish(SysExDone);
+    else if (onProgress != nullptr)
+      onProgress(transport->getDevAddr(), cable, nSent, SysExSending, context);
+  }
+
+  /// @brief Stop sending the message. The device sees a SysEx message that
+  /// never ends until the next status byte.
+  void abort() {
+    if (transport != nullptr)
+      finish(SysExAborted);
+  }
+private:
+  /// One full speed bulk transfer's worth of packets
+  static const uint16_t packetsPerBatch = 16;
+
+  /// Copy up to maxBytes payload bytes to dest; set exhausted at the end of the payload
+  uint8_t pull(uint8_t* dest, uint8_t maxBytes) {
+    uint8_t nBytes = 0;
+    while (nBytes < maxBytes) {
+      if (generator == nullptr) {
+        if (nLeft == 0)
+          break;
+        dest[nBytes++] = *payload++;
+        --nLeft;
+      }
+      else {
+        if (genPos == genLen) {
+          genLen = generator(genBuf, sizeof(genBuf), context);
+          genPos = 0;
+          if (genLen == 0)
+            break;
+        }
+        dest[nBytes++] = genBuf[genPos++];
+      }
+    }
+    exhausted = generator == nullptr ? nLeft == 0 : nBytes < maxBytes;
+    return nBytes;
+  }
+
+  void finish(EZ_USB_MIDI_HOST_SysExStatus status) {
+    Transport* done = transport;
+    transport->setSysExBusy(false);
+    transport = nullptr;
+    if (onProgress != nullptr)
+      onProgress(done->getDevAddr(), done->getCableNum(), nSent, status, context);
+  }
+
+  Transport* transport; //!< nullptr if no message is being sent
+  const uint8_t* payload;
+  uint32_t nLeft;
+  SysExGenerator generator;
+  SysExProgressCallback onProgress;
+  void* context;
+  uint32_t nSent;
+  uint32_t startTime;
+  uint32_t flushes; //!< txFlushes when the last batch was written
+  uint16_t genLen;
+  uint16_t genPos;
+  bool started;
+  bool exhausted;
+  bool waiting; //!< the last batch may still be in the transmit FIFO
+  uint8_t genBuf[48];
+};
+
+END_EZ_USB_MIDI_HOST_NAMESPACE
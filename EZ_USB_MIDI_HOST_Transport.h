@@ -32,8 +32,27 @@
 #include "EZ_USB_MIDI_HOST_namespace.h"
 
 #include "usb_midi_host.h"
+#include "EZ_USB_MIDI_HOST_CoreQueue.h"
+#include "EZ_USB_MIDI_HOST_Latency.h"
+#include "EZ_USB_MIDI_HOST_Counters.h"
+#include "EZ_USB_MIDI_HOST_Coalescer.h"
 
 BEGIN_EZ_USB_MIDI_HOST_NAMESPACE
+/// @return the smallest power of 2 that is at least n
+constexpr unsigned EZ_USB_MIDI_HOST_roundUpPow2(unsigned n) { return n <= 1 ? 1 : 2 * EZ_USB_MIDI_HOST_roundUpPow2((n + 1) / 2); }
+
+/// @brief What a virtual cable's MIDI IN FIFO drops when received bytes do
+/// not fit. Bytes are always dropped a whole message at a time, and never
+/// from a message the MIDI Library has started to parse. A SysEx message
+/// arrives in parts; once a part is dropped, the rest of the message is
+/// dropped too, and if the start was kept, a 0xF7 ends it early so the
+/// MIDI Library parses the messages after it.
+enum EZ_USB_MIDI_HOST_InOverflowPolicy : uint8_t {
+  InOverflowDropNewest,        //!< drop the messages that do not fit (default)
+  InOverflowDropOldest,        //!< drop the oldest unread messages to make room
+  InOverflowRealTimeOverwrites //!< real-time messages drop the oldest unread messages; others drop themselves
+};
+
 /// @brief This class models a MIDI IN and MIDI OUT virtual
 /// cable pair of a connected USB MIDI device. It implements
 /// the required Transport class of the MIDI interface class.
@@ -42,6 +61,18 @@ BEGIN_EZ_USB_MIDI_HOST_NAMESPACE
 template<class settings>
 class EZ_USB_MIDI_HOST_Transport {
 public:
+  using CoreQueue = EZ_USB_MIDI_HOST_SPSCQueue<EZ_USB_MIDI_HOST_CoreEvent, settings::CoreQueueDepth>;
+  /// Control events never use the priority lane, so it keeps no entries in reserve
+  using PriorityLane = EZ_USB_MIDI_HOST_SPSCQueue<EZ_USB_MIDI_HOST_CoreEvent, settings::TxPriorityLaneDepth, 0>;
+  static_assert(settings::RxTimestampDepth != 0 && (settings::RxTimestampDepth & (settings::RxTimestampDepth - 1)) == 0,
+    "RxTimestampDepth must be a power of 2");
+  static_assert(settings::MidiRxBufsize >= 4, "MidiRxBufsize must hold at least one USB MIDI packet");
+
+  /// Number of 32-bit packet words in the MIDI IN FIFO: the settings::MidiRxBufsize
+  /// USB MIDI packets the usb_midi_host driver receive buffer holds, rounded up
+  /// to a power of 2. Each message takes one word per 3 bytes or part of 3 bytes.
+  static const unsigned inFIFOPackets = EZ_USB_MIDI_HOST_roundUpPow2(settings::MidiRxBufsize / 4);
+
   EZ_USB_MIDI_HOST_Transport()  :
     devAddr(0), //not connected
     cableNum(no_cable), // cable number not assigned
@@ -49,10 +80,17 @@ public:
     hasMIDI_OUT(false), // or MIDI out
     inFIFOunderflow(false),
     inFIFOoverflow(false),
-    outFIFOoverflow(false) {
-      // The FIFO is not overwritable
-      tu_fifo_config(&inFIFO, &inBuffer, settings::MidiRxBufsize, sizeof(uint8_t), false);
-      tu_fifo_clear(&inFIFO);
+    inDroppingSysex(false),
+    inClosingSysex(false),
+    inOverflowPolicy(InOverflowDropNewest),
+    outFIFOoverflow(false),
+    inTransmission(false),
+    inPriorityTransmission(false),
+    sysexBusy(false),
+    txQueue(nullptr),
+    txPriorityLane(nullptr),
+    latencyStats(nullptr) {
+      clearInFIFO();
     }
 
   /// Return the device address of the connected device,
@@ -71,31 +109,51 @@ public:
     cableNum = cableNum_;
     hasMIDI_IN = hasMIDI_IN_;
     hasMIDI_OUT = hasMIDI_OUT_;
-    tu_fifo_clear(&inFIFO);
+    clearInFIFO();
+    coalescer.clear();
+    inOverflowPolicy = InOverflowDropNewest;
   }
 
   // Required for MIDI transport interface
 
-  void begin() { tu_fifo_clear(&inFIFO); }
+  void begin() { clearInFIFO(); }
 
-  void end() { setConfiguration(0, no_cable, false, false); }
+  void end() {
+    setConfiguration(0, no_cable, false, false);
+    sysexBusy = false;
+  }
 
-  /// Return the number of bytes available to read from the inFIFO.
+  /// Return the number of bytes available to read from the MIDI IN FIFO.
   /// Always return 0 if the transport has no MIDI IN
-  uint16_t available() { return hasMIDI_IN ? tu_fifo_count(&inFIFO) : 0; }
+  uint16_t available() { return hasMIDI_IN ? static_cast<uint16_t>(nInBytesWritten - nInBytesRead) : 0; }
 
-  /// return the byte read from the inFIFO. Will be 0 (bogus) if no data is available
+  /// return the next byte from the MIDI IN FIFO. Will be 0 (bogus) if no data is available
   uint8_t read() {
-    uint8_t buffer = 0;
+    uint8_t byte = 0;
     if (hasMIDI_IN) {
-      inFIFOunderflow = !tu_fifo_read(&inFIFO, &buffer);
+      inFIFOunderflow = inRingRdIdx == inRingWrIdx;
       if (!inFIFOunderflow) {
+        uint32_t word = inRing[inRingRdIdx & inRingMask];
+        byte = static_cast<uint8_t>(word >> (8 * ++inRingRdByte));
+        if (inRingRdByte == getWordLength(word)) {
+          inRingRdByte = 0;
+          ++inRingRdIdx;
+        }
         inFIFOoverflow = false;
+        retireTimestamps();
+        readTimestamp = rxTimestamps[rxTimestampRdIdx & rxTimestampMask].timestamp;
+        ++nInBytesRead;
       }
     }
-    return buffer;
+    return byte;
   }
 
+  /// Return the RPPICOMIDI_EZ_USB_MIDI_HOST_TIME_US() value when the data
+  /// received callback got the byte most recently returned by read().
+  /// While the MIDI Library runs a message callback, this is the time the
+  /// last byte of the message arrived.
+  uint32_t getReadTimestamp() { return readTimestamp; }
+
   /// return true if the MIDI IN buffer was full and the data received
   /// callback attempted to write at least one more byte.
   /// Call read() to clear this error
@@ -105,46 +163,473 @@ public:
   /// was empty.
   bool inUnderflow() { return inFIFOunderflow; }
 
-  /// write the byte to the MIDI stream. No error is reported if something goes wrong
-  void write(uint8_t byteToWrite) { outFIFOoverflow = (1 != tuh_midi_stream_write(devAddr, cableNum, &byteToWrite, 1)); }
+  /// write the byte to the MIDI stream. Between beginTransmission() and
+  /// endTransmission(), the byte is only collected; the whole message
+  /// goes to the MIDI stream in one call when endTransmission() is called.
+  /// No error is reported if something goes wrong
+  void write(uint8_t byteToWrite) {
+    if (!inTransmission) {
+      if (coalescer.getCount() != 0)
+        drainCoalesced();
+      uint16_t nWritten = txQueue != nullptr ? queueTxBytes(&byteToWrite, 1) :
+        tuh_midi_stream_write(devAddr, cableNum, &byteToWrite, 1);
+      outFIFOoverflow = false;
+      countTxBytes(1, nWritten);
+      return;
+    }
+    if (txCount == txStagingSize) {
+      // Message is longer than the staging buffer (e.g., long SysEx); send what we have
+      writeStaged();
+    }
+    txStaging[txCount++] = byteToWrite;
+  }
 
-  /// return true if the last call to write() caused the MIDI OUT FIFO to overflow
+  /// return true if the last message written caused the MIDI OUT FIFO to overflow
   /// Applications should wait for the for this function to return
   /// false before writing more data
   bool outOverflow() { return outFIFOoverflow; }
 
   /// Signal start of transmission to the transport; return false if
   /// if there is no MIDI OUT in the transport, if there is no connected device,
-  /// or if the OUT FIFO is full so subsequent calls to write() will fail
-  bool beginTransmission(uint8_t) { return devAddr != 0 && hasMIDI_OUT && tuh_midi_can_write_stream(devAddr); }
+  /// if the OUT FIFO is full so subsequent calls to write() will fail, or if
+  /// a bulk SysEx message is being sent and the message is not real-time.
+  /// In dual-core mode, the OUT FIFO is the queue to the USB host core.
+  /// Messages that take the priority lane only need room in the lane.
+  /// Note On and Note Off messages only take it while no coalesced
+  /// messages wait, so they never pass the cable's controller values.
+  bool beginTransmission(uint8_t type) {
+    inPriorityTransmission = txPriorityLane != nullptr && isPriority(type) && devAddr != 0 && hasMIDI_OUT &&
+      txPriorityLane->spaceAvailable() != 0 && (!sysexBusy || type >= 0xF8) &&
+      (type >= 0xF8 || coalescer.getCount() == 0);
+    inTransmission = inPriorityTransmission || (canWritePacket() && (!sysexBusy || type >= 0xF8));
+    if (inTransmission) {
+      txCount = 0;
+      outFIFOoverflow = false;
+      if (settings::LatencyHistograms) {
+        txPackets = 0;
+        txStartTime = RPPICOMIDI_EZ_USB_MIDI_HOST_TIME_US();
+      }
+    }
+    else if (devAddr != 0 && hasMIDI_OUT) {
+      // The MIDI Library drops the whole message
+      counters.txRejectedMessages.add(1);
+    }
+    return inTransmission;
+  }
+
+  /// signal end of transmission to the transport; write the collected
+  /// message bytes to the MIDI stream. If settings::TxCoalesceSlots is
+  /// not 0, a control change or pitch bend message waits for
+  /// drainCoalesced() instead.
+  void endTransmission() {
+    if (inTransmission) {
+      if (inPriorityTransmission && txCount != 0 && txCount <= 3 && txStaging[0] >= 0x80)
+        writePriority();
+      else if (!coalescer.isCoalescable(txStaging, txCount) || !stageCoalesced())
+        writeStaged();
+      txCount = 0;
+      inTransmission = false;
+      if (settings::LatencyHistograms && latencyStats != nullptr && !outFIFOoverflow && txPackets != 0)
+        latencyStats->onTxWrite(cableNum, txPackets, txStartTime);
+    }
+  }
+
+  /// The following methods are used internally. Applications should not use them
+
+  /// In dual-core mode, send MIDI OUT bytes to the USB host core through
+  /// txQueue_ instead of writing them to the usb_midi_host driver.
+  void setCoreQueue(CoreQueue* txQueue_) { txQueue = txQueue_; }
+
+  /// Record the MIDI OUT messages written to the usb_midi_host driver in latencyStats_
+  void setLatencyStats(EZ_USB_MIDI_HOST_LatencyStats<settings>* latencyStats_) { latencyStats = latencyStats_; }
+
+  /// Return true if the MIDI IN FIFO has room for one more USB MIDI packet
+  bool canWriteInPacket() { return getInRingSpace() >= (inClosingSysex ? 2u : 1u); }
+
+  /// Send real-time messages, and Note On and Note Off messages if
+  /// settings::TxPriorityNotes, through lane ahead of other MIDI OUT data
+  void setPriorityLane(PriorityLane* lane) { txPriorityLane = lane; }
+
+  /// Return the virtual cable number, or 16 if the transport is not configured
+  uint8_t getCableNum() { return cableNum; }
 
-  /// signal end of transmission to the transport; nothing to do
-  void endTransmission() {  }
+  /// Return true if MIDI OUT data goes to the USB host core through a queue
+  bool isDualCore() { return txQueue != nullptr; }
 
-  /// The following method is used internally. Applications should not use it
-  bool writeToInFIFO(uint8_t* bytes, uint16_t nBytes) {
-    uint16_t nWritten = tu_fifo_write_n(&inFIFO, bytes, nBytes);
-    if (nWritten < nBytes) {
+  /// Return true if the MIDI OUT FIFO has room for one more USB MIDI packet.
+  /// In dual-core mode, the OUT FIFO is the queue to the USB host core.
+  bool canWritePacket() {
+    return devAddr != 0 && hasMIDI_OUT &&
+      (txQueue != nullptr ? txQueue->spaceAvailable() > coreQueueReserve : tuh_midi_can_write_stream(devAddr));
+  }
+
+  /// Write a USB MIDI event packet of a message the MIDI Library does not
+  /// send, such as a bulk SysEx message. The packet skips the driver's
+  /// stream parser, so real-time messages the MIDI Library sends may go
+  /// between packets without upsetting it. Waiting coalesced messages go first.
+  /// @param packet the packet; its cable number must be this transport's
+  /// @param nBytes the number of MIDI bytes in the packet
+  /// @return true if the MIDI OUT FIFO took the packet
+  bool writePacket(const uint8_t* packet, uint8_t nBytes) {
+    if (coalescer.getCount() != 0)
+      drainCoalesced();
+    bool written = false;
+    if (txQueue == nullptr) {
+      written = tuh_midi_packet_write(devAddr, packet);
+    }
+    else if (txQueue->spaceAvailable() > coreQueueReserve) {
+      EZ_USB_MIDI_HOST_CoreEvent event;
+      event.type = EZ_USB_MIDI_HOST_CoreEvent::TxPacket;
+      event.devAddr = devAddr;
+      for (uint8_t idx = 0; idx < 4; idx++)
+        event.data[idx] = packet[idx];
+      written = txQueue->push(event);
+    }
+    countTxBytes(nBytes, written ? nBytes : 0);
+    return written;
+  }
+
+  /// While busy is true, a bulk SysEx message is being written with
+  /// writePacket(), so beginTransmission() refuses all messages but
+  /// real-time messages, which may appear inside a SysEx message
+  void setSysExBusy(bool busy) { sysexBusy = busy; }
+
+  /// Write the waiting control change and pitch bend messages to the MIDI
+  /// stream, oldest first, until the MIDI OUT FIFO is full
+  /// @return true if at least one message was written
+  bool drainCoalesced() {
+    uint8_t nDrained = 0;
+    while (nDrained < coalescer.getCount()) {
+      if (txQueue != nullptr ? txQueue->spaceAvailable() <= coreQueueReserve : !tuh_midi_can_write_stream(devAddr))
+        break;
+      const EZ_USB_MIDI_HOST_CoalescedMessage& message = coalescer.getMessage(nDrained);
+      uint16_t nWritten = txQueue != nullptr ? queueTxBytes(message.bytes, sizeof(message.bytes)) :
+        tuh_midi_stream_write(devAddr, cableNum, message.bytes, sizeof(message.bytes));
+      counters.txBytes.add(nWritten);
+      if (settings::LatencyHistograms && latencyStats != nullptr && txQueue == nullptr)
+        latencyStats->onTxWrite(cableNum, 1, message.timestamp);
+      ++nDrained;
+    }
+    coalescer.remove(nDrained);
+    return nDrained != 0;
+  }
+
+  /// Return the traffic and drop counters of this cable
+  EZ_USB_MIDI_HOST_CableCounters& getCounters() { return counters; }
+
+  /// Write bytes received at time timestamp to the MIDI IN FIFO. If they
+  /// do not all fit, the overflow policy decides which whole messages to drop.
+  /// @return false if any message was dropped
+  bool writeToInFIFO(const uint8_t* bytes, uint16_t nBytes, uint32_t timestamp) {
+    counters.rxBytes.add(nBytes);
+    bool ok = true;
+    for (uint16_t pos = 0; pos < nBytes; ) {
+      uint16_t len = getInMessageLength(bytes + pos, nBytes - pos);
+      if (!inDroppingSysex && !inClosingSysex && getInRingSpace() >= getInWords(len))
+        pushInBytes(bytes + pos, len, timestamp);
+      else
+        ok = writeInMessage(bytes + pos, len, timestamp) && ok;
+      pos += len;
+    }
+    counters.rxHighWaterBytes.raiseTo(nInBytesWritten - nInBytesRead);
+    if (!ok)
       inFIFOoverflow = true;
+    return ok;
+  }
+
+  /// Choose which messages the MIDI IN FIFO drops when it is full
+  void setInOverflowPolicy(EZ_USB_MIDI_HOST_InOverflowPolicy policy) { inOverflowPolicy = policy; }
+
+  /// Return the MIDI IN FIFO overflow policy
+  EZ_USB_MIDI_HOST_InOverflowPolicy getInOverflowPolicy() { return inOverflowPolicy; }
+
+  static const bool thruActivated = false;
+
+private:
+  void clearInFIFO() {
+    inRingWrIdx = 0;
+    inRingRdIdx = 0;
+    inRingRdByte = 0;
+    nInBytesWritten = 0;
+    nInBytesRead = 0;
+    rxTimestampWrIdx = 0;
+    rxTimestampRdIdx = 0;
+    readTimestamp = 0;
+    inDroppingSysex = false;
+    inClosingSysex = false;
+  }
+
+  /// Retire the time stamps of chunks that have been read completely
+  void retireTimestamps() {
+    while (rxTimestampWrIdx - rxTimestampRdIdx > 1 &&
+        static_cast<int32_t>(nInBytesRead - rxTimestamps[(rxTimestampRdIdx + 1) & rxTimestampMask].firstByte) >= 0) {
+      ++rxTimestampRdIdx;
+    }
+  }
+
+  /// Return the number of bytes, 1 to 3, in a MIDI IN FIFO word
+  static uint8_t getWordLength(uint32_t word) { return word & 3; }
+
+  /// Return the number of MIDI IN FIFO words a message of nBytes bytes takes
+  static uint16_t getInWords(uint16_t nBytes) { return (nBytes + 2) / 3; }
+
+  /// Return the number of free MIDI IN FIFO words
+  uint16_t getInRingSpace() { return static_cast<uint16_t>(inFIFOPackets - (inRingWrIdx - inRingRdIdx)); }
+
+  /// Write one message that fits to the MIDI IN FIFO, up to 3 bytes per word,
+  /// and note its time stamp
+  void pushInBytes(const uint8_t* bytes, uint16_t nBytes, uint32_t timestamp) {
+    if (nBytes == 0)
+      return;
+    if (nInBytesRead == nInBytesWritten) {
+      // every byte has been read, so every time stamp is stale
+      rxTimestampRdIdx = rxTimestampWrIdx;
+    }
+    if (rxTimestampWrIdx - rxTimestampRdIdx < settings::RxTimestampDepth &&
+        (rxTimestampWrIdx == rxTimestampRdIdx || rxTimestamps[(rxTimestampWrIdx - 1) & rxTimestampMask].timestamp != timestamp)) {
+      rxTimestamps[rxTimestampWrIdx & rxTimestampMask] = {nInBytesWritten, timestamp};
+      ++rxTimestampWrIdx;
+    }
+    for (uint16_t pos = 0; pos < nBytes; pos += 3) {
+      uint8_t len = nBytes - pos < 3 ? nBytes - pos : 3;
+      uint32_t word = len;
+      for (uint8_t idx = 0; idx < len; idx++)
+        word |= static_cast<uint32_t>(bytes[pos + idx]) << (8 * (idx + 1));
+      inRing[inRingWrIdx++ & inRingMask] = word;
+    }
+    nInBytesWritten += nBytes;
+  }
+
+  /// Return the number of bytes from the start of bytes to the next message.
+  /// A real-time message is 1 byte; anything else runs to the next status
+  /// byte other than 0xF7, so SysEx parts and stray data bytes stay whole.
+  static uint16_t getInMessageLength(const uint8_t* bytes, uint16_t nBytes) {
+    uint16_t len = 1;
+    if (bytes[0] < 0xF8) {
+      while (len < nBytes && (bytes[len] < 0x80 || bytes[len] == 0xF7))
+        ++len;
+    }
+    return len;
+  }
+
+  /// Write one message that may not fit to the MIDI IN FIFO, applying the
+  /// overflow policy
+  /// @return false if a message was dropped
+  bool writeInMessage(const uint8_t* message, uint16_t len, uint32_t timestamp) {
+    bool realTime = message[0] >= 0xF8;
+    bool sysex = !realTime && (message[0] < 0x80 || message[0] == 0xF0 || message[0] == 0xF7);
+    if (!realTime && (!sysex || message[0] == 0xF0))
+      inDroppingSysex = false;
+    closeInSysex(timestamp);
+    bool ok = true;
+    if (!(inDroppingSysex && sysex) && (realTime || !inClosingSysex)) {
+      if (inOverflowPolicy == InOverflowDropOldest || (inOverflowPolicy == InOverflowRealTimeOverwrites && realTime)) {
+        while (getInRingSpace() < getInWords(len) && dropOldestInMessage())
+          ok = false;
+      }
+      if (getInRingSpace() >= getInWords(len)) {
+        pushInBytes(message, len, timestamp);
+        return ok;
+      }
+      // The MIDI Library parser only leaves a SysEx message at 0xF7, so
+      // end the part already written; the rest of the message must go
+      if (sysex && message[0] != 0xF0)
+        inClosingSysex = true;
+    }
+    if (sysex)
+      inDroppingSysex = message[len - 1] != 0xF7;
+    counters.rxDroppedBytes.add(len);
+    counters.rxDroppedMessages.add(1);
+    closeInSysex(timestamp);
+    return false;
+  }
+
+  /// End a SysEx message whose middle was dropped with 0xF7 if there is room
+  void closeInSysex(uint32_t timestamp) {
+    static const uint8_t eox = 0xF7;
+    if (inClosingSysex && getInRingSpace() != 0) {
+      pushInBytes(&eox, 1, timestamp);
+      inClosingSysex = false;
+    }
+  }
+
+  /// Drop the oldest unread message from the MIDI IN FIFO. A SysEx message
+  /// goes with the real-time messages inside it; if its end has not arrived
+  /// yet, the rest is dropped when it does.
+  /// @return false if the FIFO is empty or starts in the middle of a
+  /// message the MIDI Library has started to parse
+  bool dropOldestInMessage() {
+    if (inRingRdIdx == inRingWrIdx || inRingRdByte != 0)
+      return false;
+    uint32_t word = inRing[inRingRdIdx & inRingMask];
+    uint8_t status = static_cast<uint8_t>(word >> 8);
+    if (status < 0x80 || status == 0xF7)
       return false;
+    bool sysex = status == 0xF0;
+    uint16_t nDropped = 0;
+    uint8_t last = 0;
+    do {
+      nDropped += getWordLength(word);
+      last = static_cast<uint8_t>(word >> (8 * getWordLength(word)));
+      ++inRingRdIdx;
+      if (status >= 0xF8 || last == 0xF7 || inRingRdIdx == inRingWrIdx)
+        break;
+      word = inRing[inRingRdIdx & inRingMask];
+      uint8_t first = static_cast<uint8_t>(word >> 8);
+      if (first >= 0x80 && first != 0xF7 && !(sysex && first >= 0xF8))
+        break;
+    } while (true);
+    if (sysex && last != 0xF7 && inRingRdIdx == inRingWrIdx)
+      inDroppingSysex = true;
+    nInBytesRead += nDropped;
+    retireTimestamps();
+    counters.rxDroppedBytes.add(nDropped);
+    counters.rxDroppedMessages.add(1);
+    return true;
+  }
+
+  /// Write the collected message bytes to the MIDI stream. If the MIDI OUT
+  /// FIFO can't take all of them, flag the message as overflowed. Waiting
+  /// coalesced messages go first so messages stay in order.
+  void writeStaged() {
+    if (txCount != 0) {
+      if (coalescer.getCount() != 0)
+        drainCoalesced();
+      uint16_t nWritten = txQueue != nullptr ? queueTxBytes(txStaging, txCount) :
+        tuh_midi_stream_write(devAddr, cableNum, txStaging, txCount);
+      countTxBytes(txCount, nWritten);
+      if (settings::LatencyHistograms && !outFIFOoverflow && txQueue == nullptr) {
+        // Each SysEx chunk but the last is a multiple of 3 bytes, so every
+        // chunk starts a new packet. Other messages always take one packet.
+        bool sysex = txStaging[0] < 0x80 || txStaging[0] == 0xF0 || txStaging[0] == 0xF7;
+        txPackets += sysex ? (txCount + 2) / 3 : 1;
+      }
+    }
+    txCount = 0;
+  }
+
+  /// Return true if messages of the MIDI Library type may take the priority lane
+  static bool isPriority(uint8_t type) {
+    return type >= 0xF8 || (settings::TxPriorityNotes && (type == 0x80 || type == 0x90));
+  }
+
+  /// Push the collected message to the priority lane as one USB MIDI packet
+  void writePriority() {
+    EZ_USB_MIDI_HOST_CoreEvent event;
+    event.type = EZ_USB_MIDI_HOST_CoreEvent::TxPacket;
+    event.devAddr = devAddr;
+    event.arg = cableNum;
+    uint8_t status = txStaging[0];
+    // Real-time messages are CIN 0xF; channel messages use the status nibble
+    event.data[0] = static_cast<uint8_t>((cableNum << 4) | (status >= 0xF0 ? 0xF : status >> 4));
+    for (uint8_t idx = 0; idx < 3; idx++)
+      event.data[idx + 1] = idx < txCount ? txStaging[idx] : 0;
+    countTxBytes(txCount, txPriorityLane->push(event) ? txCount : 0);
+  }
+
+  /// Put the collected control change or pitch bend message in the
+  /// coalescing table, making room by writing the waiting messages if
+  /// it is full
+  /// @return false if the table had no room, so the message must be written
+  bool stageCoalesced() {
+    uint32_t timestamp = settings::LatencyHistograms ? txStartTime : 0;
+    bool replaced;
+    if (!coalescer.stage(txStaging, timestamp, replaced)) {
+      drainCoalesced();
+      if (!coalescer.stage(txStaging, timestamp, replaced))
+        return false;
     }
+    if (replaced)
+      counters.txCoalescedMessages.add(1);
     return true;
   }
 
-  static const bool thruActivated = false;
+  /// Count the bytes the MIDI OUT FIFO accepted and flag the message as
+  /// overflowed if it did not accept all of them
+  void countTxBytes(uint16_t nBytes, uint16_t nWritten) {
+    counters.txBytes.add(nWritten);
+    if (nWritten != nBytes) {
+      counters.txRejectedBytes.add(nBytes - nWritten);
+      outFIFOoverflow = true;
+    }
+  }
+
+  /// Send the bytes to the USB host core in up to 4 byte chunks
+  /// @return the number of bytes sent before the queue filled up
+  uint16_t queueTxBytes(const uint8_t* bytes, uint16_t nBytes) {
+    EZ_USB_MIDI_HOST_CoreEvent event;
+    event.type = EZ_USB_MIDI_HOST_CoreEvent::TxBytes;
+    event.devAddr = devAddr;
+    event.arg = cableNum;
+    uint16_t nQueued = 0;
+    while (nQueued < nBytes) {
+      if (txQueue->spaceAvailable() <= coreQueueReserve)
+        break;
+      uint16_t nLeft = nBytes - nQueued;
+      event.nBytes = nLeft < sizeof(event.data) ? nLeft : sizeof(event.data);
+      for (uint8_t idx = 0; idx < event.nBytes; idx++)
+        event.data[idx] = bytes[nQueued++];
+      txQueue->push(event);
+    }
+    return nQueued;
+  }
 
-private:
   static uint8_t const no_cable = 16;  //!< legal MIDI cable numbers are 0-15
+  /// The MIDI Library writes one message at a time, so all transports share
+  /// one staging buffer. 48 bytes is one full speed bulk transfer's worth
+  /// of MIDI bytes and holds any message except a long SysEx.
+  static uint16_t const txStagingSize = 48;
+  static uint8_t txStaging[txStagingSize];
+  static uint16_t txCount;
   uint8_t devAddr;
   uint8_t cableNum;
   bool hasMIDI_IN;
   bool hasMIDI_OUT;
 
-  uint8_t inBuffer[settings::MidiRxBufsize];
-  tu_fifo_t inFIFO;
+  /// The MIDI IN FIFO. Each word holds up to 3 bytes of one message the way
+  /// a USB MIDI event packet does, but its low byte is the number of bytes
+  /// instead of the cable number and CIN. read() returns the bytes one at
+  /// a time; inRingRdByte counts the bytes it has read from the oldest word.
+  static const unsigned inRingMask = inFIFOPackets - 1;
+  alignas(4) uint32_t inRing[inFIFOPackets];
+  uint32_t inRingWrIdx;
+  uint32_t inRingRdIdx;
+  uint8_t inRingRdByte;
+  /// The time stamp of the bytes from firstByte up to the firstByte of
+  /// the next entry; byte positions count every byte written to the MIDI IN FIFO
+  struct RxTimestamp {
+    uint32_t firstByte;
+    uint32_t timestamp;
+  };
+  static const unsigned rxTimestampMask = settings::RxTimestampDepth - 1;
+  RxTimestamp rxTimestamps[settings::RxTimestampDepth];
+  uint32_t rxTimestampWrIdx;
+  uint32_t rxTimestampRdIdx;
+  uint32_t nInBytesWritten;
+  uint32_t nInBytesRead;
+  uint32_t readTimestamp;
   bool inFIFOunderflow;
   bool inFIFOoverflow;
+  bool inDroppingSysex; //!< a part of the SysEx message being received was dropped
+  bool inClosingSysex;  //!< the MIDI IN FIFO needs a 0xF7 to end a SysEx message whose middle was dropped
+  EZ_USB_MIDI_HOST_InOverflowPolicy inOverflowPolicy;
   bool outFIFOoverflow;
+  bool inTransmission;
+  bool inPriorityTransmission; //!< the message being collected takes the priority lane
+  bool sysexBusy;
+  CoreQueue* txQueue; //!< nullptr unless in dual-core mode
+  PriorityLane* txPriorityLane; //!< nullptr unless settings::TxPriorityLaneDepth is not 0
+  EZ_USB_MIDI_HOST_LatencyStats<settings>* latencyStats;
+  EZ_USB_MIDI_HOST_CableCounters counters;
+  EZ_USB_MIDI_HOST_Coalescer<settings> coalescer;
+  uint16_t txPackets;   //!< latency histograms only: packets the current message takes
+  uint32_t txStartTime; //!< latency histograms only: time of beginTransmission()
 };
 
+template<class settings>
+uint8_t EZ_USB_MIDI_HOST_Transport<settings>::txStaging[EZ_USB_MIDI_HOST_Transport<settings>::txStagingSize];
+
+template<class settings>
+uint16_t EZ_USB_MIDI_HOST_Transport<settings>::txCount = 0;
+
 END_EZ_USB_MIDI_HOST_NAMESPACE
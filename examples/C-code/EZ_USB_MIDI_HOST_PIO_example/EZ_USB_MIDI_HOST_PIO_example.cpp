@@ -32,6 +32,9 @@
  *
  * This program works with a single USB MIDI device connected via a USB hub, but it
  * does not handle multiple USB MIDI devices connected at the same time.
+ *
+ * If RPPICOMIDI_DUAL_CORE is defined, core 1 runs the USB host and core 0
+ * runs everything else.
  */
 #include <stdio.h>
 #include "pico/stdlib.h"
@@ -47,7 +50,15 @@
 
 USING_NAMESPACE_MIDI
 USING_NAMESPACE_EZ_USB_MIDI_HOST
+#ifdef RPPICOMIDI_DUAL_CORE
+struct DualCoreSettings : public MidiHostSettingsDefault
+{
+    static const unsigned CoreQueueDepth = 128;
+};
+RPPICOMIDI_EZ_USB_MIDI_HOST_INSTANCE(usbhMIDI, DualCoreSettings)
+#else
 RPPICOMIDI_EZ_USB_MIDI_HOST_INSTANCE(usbhMIDI, MidiHostSettingsDefault)
+#endif
 
 /* MIDI IN MESSAGE REPORTING */
 static void onMidiError(int8_t errCode)
@@ -289,7 +300,7 @@ static void unregisterMidiInCallbacks(uint8_t midiDevAddr)
 static void listConnectedDevices()
 {
     printf("Dev  VID:PID  Product Name[Manufacter]{serial string}\r\n");
-    for (uint8_t midiDevAddr = 1; midiDevAddr <= RPPICOMIDI_TUH_MIDI_MAX_DEV; midiDevAddr++) {
+    for (uint8_t midiDevAddr = 1; midiDevAddr <= RPPICOMIDI_TUH_MIDI_MAX_DEV_ADDR; midiDevAddr++) {
         auto dev = usbhMIDI.getDevFromDevAddr(midiDevAddr);
         if (dev) {
             printf("%02u  %04x:%04x %s[%s]{%s}\r\n",midiDevAddr, dev->getVID(), dev->getPID(),
@@ -302,6 +313,12 @@ static void onMIDIconnect(uint8_t devAddr, uint8_t nInCables, uint8_t nOutCables
 {
     printf("MIDI device at address %u has %u IN cables and %u OUT cables\r\n", devAddr, nInCables, nOutCables);
     registerMidiInCallbacks(devAddr);
+}
+
+static void onMIDIstringsReady(uint8_t devAddr)
+{
+    // The product, manufacturer and serial strings are empty until now
+    (void)devAddr;
     listConnectedDevices();
 }
 
@@ -351,7 +368,7 @@ static void sendNextNote()
     if ( board_millis() - startMs < intervalMs)
         return; // not enough time
     startMs += intervalMs;
-    for (uint8_t midiDevAddr = 1; midiDevAddr <= RPPICOMIDI_TUH_MIDI_MAX_DEV; midiDevAddr++) {
+    for (uint8_t midiDevAddr = 1; midiDevAddr <= RPPICOMIDI_TUH_MIDI_MAX_DEV_ADDR; midiDevAddr++) {
         auto intf = usbhMIDI.getInterfaceFromDeviceAndCable(midiDevAddr, usbhMIDI.getNumOutCables(midiDevAddr)-1);
         if (intf == nullptr)
             continue; // not connected
@@ -364,6 +381,27 @@ static void sendNextNote()
         onNote = firstNote;
 }
 
+#ifdef RPPICOMIDI_DUAL_CORE
+/* USB HOST CORE */
+static void core1Main()
+{
+    pio_usb_configuration_t pio_cfg = PIO_USB_DEFAULT_CONFIG;
+    // Use GP16 for USB D+ and GP17 for USB D-
+    pio_cfg.pin_dp = 16;
+
+    tuh_configure(BOARD_TUH_RHPORT, TUH_CFGID_RPI_PIO_USB_CONFIGURATION, &pio_cfg);
+
+    usbhMIDI.setAppOnStringsReady(onMIDIstringsReady);
+
+    if (!usbhMIDI.begin(BOARD_TUH_RHPORT, onMIDIconnect, onMIDIdisconnect))
+        printf("EZ_USB_MIDI_HOST begin() failed\r\n");
+    while (1) {
+        // tinyusb host task plus the MIDI data transfers to and from core 0
+        usbhMIDI.usbHostTask();
+    }
+}
+#endif
+
 /* APPLICATION STARTS HERE */
 int main() {
 
@@ -374,13 +412,20 @@ int main() {
     sleep_ms(10);
     board_init();
 
+#ifdef RPPICOMIDI_DUAL_CORE
+    multicore_launch_core1(core1Main);
+#else
     pio_usb_configuration_t pio_cfg = PIO_USB_DEFAULT_CONFIG;
     // Use GP16 for USB D+ and GP17 for USB D-
     pio_cfg.pin_dp = 16;
 
     tuh_configure(BOARD_TUH_RHPORT, TUH_CFGID_RPI_PIO_USB_CONFIGURATION, &pio_cfg);
 
-    usbhMIDI.begin(BOARD_TUH_RHPORT, onMIDIconnect, onMIDIdisconnect);
+    usbhMIDI.setAppOnStringsReady(onMIDIstringsReady);
+
+    if (!usbhMIDI.begin(BOARD_TUH_RHPORT, onMIDIconnect, onMIDIdisconnect))
+        printf("EZ_USB_MIDI_HOST begin() failed\r\n");
+#endif
     printf("EZ USB MIDI HOST PIO Example\r\n");
 #if RPPICOMIDI_PICO_W
     // The Pico W LED is attached to the CYW43 WiFi/Bluetooth module
@@ -392,8 +437,10 @@ int main() {
 #endif
 
     while (1) {
+#ifndef RPPICOMIDI_DUAL_CORE
         // tinyusb host task; calls usb_midi_host drivers, etc.
         tuh_task();
+#endif
 
         // Handle any incoming data; triggers MIDI IN callbacks
         usbhMIDI.readAll();
@@ -401,7 +448,8 @@ int main() {
         // Do other processing that might generate pending MIDI OUT data
         sendNextNote();
     
-        // Tell the USB Host to send as much pending MIDI OUT data as possible
+        // Tell the USB Host to send as much pending MIDI OUT data as possible;
+        // does nothing in dual-core mode
         usbhMIDI.writeFlushAll();
     
         // Do other non-USB host processing
@@ -285,7 +285,7 @@ static void unregisterMidiInCallbacks(uint8_t midiDevAddr)
 static void listConnectedDevices()
 {
     printf("Dev  VID:PID  Product Name[Manufacter]{serial string}\r\n");
-    for (uint8_t midiDevAddr = 1; midiDevAddr <= RPPICOMIDI_TUH_MIDI_MAX_DEV; midiDevAddr++) {
+    for (uint8_t midiDevAddr = 1; midiDevAddr <= RPPICOMIDI_TUH_MIDI_MAX_DEV_ADDR; midiDevAddr++) {
         auto dev = usbhMIDI.getDevFromDevAddr(midiDevAddr);
         if (dev) {
             printf("%02u  %04x:%04x %s[%s]{%s}\r\n",midiDevAddr, dev->getVID(), dev->getPID(),
@@ -298,6 +298,12 @@ static void onMIDIconnect(uint8_t devAddr, uint8_t nInCables, uint8_t nOutCables
 {
     printf("MIDI device at address %u has %u IN cables and %u OUT cables\r\n", devAddr, nInCables, nOutCables);
     registerMidiInCallbacks(devAddr);
+}
+
+static void onMIDIstringsReady(uint8_t devAddr)
+{
+    // The product, manufacturer and serial strings are empty until now
+    (void)devAddr;
     listConnectedDevices();
 }
 
@@ -345,7 +351,7 @@ static void sendNextNote()
     if ( board_millis() - startMs < intervalMs)
         return; // not enough time
     startMs += intervalMs;
-    for (uint8_t midiDevAddr = 1; midiDevAddr <= RPPICOMIDI_TUH_MIDI_MAX_DEV; midiDevAddr++) {
+    for (uint8_t midiDevAddr = 1; midiDevAddr <= RPPICOMIDI_TUH_MIDI_MAX_DEV_ADDR; midiDevAddr++) {
         auto intf = usbhMIDI.getInterfaceFromDeviceAndCable(midiDevAddr, usbhMIDI.getNumOutCables(midiDevAddr)-1);
         if (intf == nullptr)
             continue; // not connected
@@ -365,7 +371,9 @@ int main() {
 
     bi_decl(bi_program_description("A USB MIDI host example."));
     board_init();
-    usbhMIDI.begin(0, onMIDIconnect, onMIDIdisconnect);
+    usbhMIDI.setAppOnStringsReady(onMIDIstringsReady);
+    if (!usbhMIDI.begin(0, onMIDIconnect, onMIDIdisconnect))
+        printf("EZ_USB_MIDI_HOST begin() failed\r\n");
     printf("EZ USB MIDI Host Example\r\n");
 #if RPPICOMIDI_PICO_W
     // The Pico W LED is attached to the CYW43 WiFi/Bluetooth module
@@ -217,6 +217,8 @@ static void registerMidiInCallbacks(uint8_t midiDevAddr)
     uint8_t ncables = usbhMIDI.getNumInCables(midiDevAddr);
     for (uint8_t cable = 0; cable < ncables; cable++) {
         auto intf = usbhMIDI.getInterfaceFromDeviceAndCable(midiDevAddr, cable);
+        if (intf == nullptr)
+            return;
         intf->setHandleNoteOff(onNoteOff);                      // 0x80
         intf->setHandleNoteOn(onNoteOn);                        // 0x90
         intf->setHandleAfterTouchPoly(onPolyphonicAftertouch);  // 0xA0
@@ -284,7 +286,7 @@ static void unregisterMidiInCallbacks(uint8_t midiDevAddr)
 static void listConnectedDevices()
 {
     Serial1.printf("Dev  VID:PID  Product Name[Manufacter]{serial string}\r\n");
-    for (uint8_t midiDevAddr = 1; midiDevAddr <= RPPICOMIDI_TUH_MIDI_MAX_DEV; midiDevAddr++) {
+    for (uint8_t midiDevAddr = 1; midiDevAddr <= RPPICOMIDI_TUH_MIDI_MAX_DEV_ADDR; midiDevAddr++) {
         auto dev = usbhMIDI.getDevFromDevAddr(midiDevAddr);
         if (dev) {
             Serial1.printf("%02u  %04x:%04x %s[%s]{%s}\r\n",midiDevAddr, dev->getVID(), dev->getPID(),
@@ -296,6 +298,12 @@ static void onMIDIconnect(uint8_t devAddr, uint8_t nInCables, uint8_t nOutCables
 {
     Serial1.printf("MIDI device at address %u has %u IN cables and %u OUT cables\r\n", devAddr, nInCables, nOutCables);
     registerMidiInCallbacks(devAddr);
+}
+
+static void onMIDIstringsReady(uint8_t devAddr)
+{
+    // The product, manufacturer and serial strings are empty until now
+    (void)devAddr;
     listConnectedDevices();
 }
 
@@ -336,7 +344,7 @@ static void sendNextNote()
     if (millis() - startMs < intervalMs)
         return; // not enough time
     startMs += intervalMs;
-    for (uint8_t midiDevAddr = 1; midiDevAddr <= RPPICOMIDI_TUH_MIDI_MAX_DEV; midiDevAddr++) {
+    for (uint8_t midiDevAddr = 1; midiDevAddr <= RPPICOMIDI_TUH_MIDI_MAX_DEV_ADDR; midiDevAddr++) {
         auto intf = usbhMIDI.getInterfaceFromDeviceAndCable(midiDevAddr, usbhMIDI.getNumOutCables(midiDevAddr)-1);
         if (intf == nullptr)
             continue; // not connected
@@ -358,7 +366,9 @@ void setup()
 
   while(!Serial1);   // wait for serial port
   pinMode(LED_BUILTIN, OUTPUT);
-  usbhMIDI.begin(&USBHost, 0, onMIDIconnect, onMIDIdisconnect);
+  usbhMIDI.setAppOnStringsReady(onMIDIstringsReady);
+  if (!usbhMIDI.begin(&USBHost, 0, onMIDIconnect, onMIDIdisconnect))
+    Serial1.println("EZ_USB_MIDI_HOST begin() failed");
   Serial1.println("EZ_USB_MIDI_HOST Example");
 }
 
@@ -0,0 +1,320 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * This program measures the cost of the EZ_USB_MIDI_HOST receive path, transmit
+ * path and hot-plug handling on a Linux PC. It links the library against the
+ * simulated usb_midi_host driver in this directory, so the numbers include the
+ * driver FIFO and stream encoder work but no real USB traffic. Use it to compare
+ * library changes against each other, not to predict absolute RP2040 throughput.
+ *
+ * Usage: EZ_USB_MIDI_HOST_bench [--path rx|rxraw|tx|hotplug|all] [--devices N]
+ *                               [--cables N] [--messages N] [--cycles N]
+ */
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include "EZ_USB_MIDI_HOST.h"
+#include "usb_midi_host_sim.h"
+
+USING_NAMESPACE_MIDI
+USING_NAMESPACE_EZ_USB_MIDI_HOST
+RPPICOMIDI_EZ_USB_MIDI_HOST_INSTANCE(usbhMIDI, MidiHostSettingsDefault)
+
+struct BenchOptions {
+  bool rx = true;
+  bool rxraw = true;
+  bool tx = true;
+  bool hotplug = true;
+  unsigned devices = RPPICOMIDI_TUH_MIDI_MAX_DEV;
+  unsigned cables = 1;
+  uint64_t messages = 1000000;
+  uint64_t cycles = 10000;
+};
+
+struct BenchResult {
+  uint64_t count;
+  double seconds;
+};
+
+static uint64_t rxMessages = 0;
+static uint64_t rxFailures = 0;
+
+/* MIDI IN HANDLERS */
+static void onNoteOff(Channel, byte, byte) { ++rxMessages; }
+static void onNoteOn(Channel, byte, byte) { ++rxMessages; }
+static void onControlChange(Channel, byte, byte) { ++rxMessages; }
+static void onMidiInWriteFail(uint8_t, uint8_t, bool) { ++rxFailures; }
+static void onRxPackets(uint8_t, const uint8_t* packets, uint32_t nPackets, uint32_t)
+{
+    for (uint32_t idx = 0; idx < nPackets; idx++) {
+        if (EZ_USB_MIDI_HOST_Packet::getMidiLength(packets + 4 * idx) != 0)
+            ++rxMessages;
+    }
+}
+
+/* CONNECTION MANAGEMENT */
+static void onMIDIconnect(uint8_t devAddr, uint8_t nInCables, uint8_t nOutCables)
+{
+    (void)nOutCables;
+    // Same per-cable registration the example programs do
+    for (uint8_t cable = 0; cable < nInCables; cable++) {
+        auto intf = usbhMIDI.getInterfaceFromDeviceAndCable(devAddr, cable);
+        if (intf == nullptr)
+            return;
+        intf->setHandleNoteOff(onNoteOff);
+        intf->setHandleNoteOn(onNoteOn);
+        intf->setHandleControlChange(onControlChange);
+    }
+    auto dev = usbhMIDI.getDevFromDevAddr(devAddr);
+    if (dev != nullptr)
+        dev->setOnMidiInWriteFail(onMidiInWriteFail);
+}
+
+static void onMIDIdisconnect(uint8_t devAddr)
+{
+    uint8_t ncables = usbhMIDI.getNumInCables(devAddr);
+    for (uint8_t cable = 0; cable < ncables; cable++) {
+        auto intf = usbhMIDI.getInterfaceFromDeviceAndCable(devAddr, cable);
+        if (intf == nullptr)
+            return;
+        intf->disconnectCallbackFromType(NoteOff);
+        intf->disconnectCallbackFromType(NoteOn);
+        intf->disconnectCallbackFromType(ControlChange);
+    }
+}
+
+/* SIMULATED BUS HELPERS */
+static void plugAll(const BenchOptions& opt)
+{
+    for (unsigned devAddr = 1; devAddr <= opt.devices; devAddr++) {
+        sim_usb_midi_host_plug(devAddr, opt.cables, opt.cables, 0xcafe, 0x4000 + devAddr,
+            "rppicomidi", "EZ_USB_MIDI_HOST bench device", "0123456789");
+    }
+    tuh_task();
+}
+
+static void unplugAll(const BenchOptions& opt)
+{
+    for (unsigned devAddr = 1; devAddr <= opt.devices; devAddr++) {
+        sim_usb_midi_host_unplug(devAddr);
+    }
+    tuh_task();
+}
+
+/* BENCHMARKS */
+// One full bulk transfer per device per loop: Note On/Note Off
+// pairs spread round-robin across the device's cables
+static void makeRxPackets(const BenchOptions& opt, uint8_t packets[SIM_USB_MIDI_PACKETS_PER_XFER][4])
+{
+    for (uint8_t idx = 0; idx < SIM_USB_MIDI_PACKETS_PER_XFER; idx++) {
+        uint8_t cable = (idx / 2) % opt.cables;
+        bool noteOn = (idx & 1) == 0;
+        packets[idx][0] = (cable << 4) | (noteOn ? 0x9 : 0x8);
+        packets[idx][1] = noteOn ? 0x90 : 0x80;
+        packets[idx][2] = 60 + cable;
+        packets[idx][3] = noteOn ? 100 : 0;
+    }
+}
+
+static BenchResult benchRx(const BenchOptions& opt)
+{
+    sim_usb_midi_host_reset();
+    plugAll(opt);
+    uint8_t packets[SIM_USB_MIDI_PACKETS_PER_XFER][4];
+    makeRxPackets(opt, packets);
+    rxMessages = 0;
+    rxFailures = 0;
+    uint64_t sent = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (sent < opt.messages) {
+        for (unsigned devAddr = 1; devAddr <= opt.devices; devAddr++) {
+            sent += sim_usb_midi_host_send_to_host(devAddr, packets[0], SIM_USB_MIDI_PACKETS_PER_XFER);
+        }
+        tuh_task();
+        // Each message is 3 bytes and each readAll() reads at most one byte per cable
+        for (unsigned pass = 0; rxMessages < sent && pass < 3 * SIM_USB_MIDI_PACKETS_PER_XFER; pass++) {
+            usbhMIDI.readAll();
+        }
+    }
+    auto stop = std::chrono::steady_clock::now();
+    unplugAll(opt);
+    if (rxFailures != 0)
+        printf("rx: %llu MIDI IN FIFO write failures\r\n", static_cast<unsigned long long>(rxFailures));
+    return {rxMessages, std::chrono::duration<double>(stop - start).count()};
+}
+
+static BenchResult benchRxPackets(const BenchOptions& opt)
+{
+    sim_usb_midi_host_reset();
+    plugAll(opt);
+    uint8_t packets[SIM_USB_MIDI_PACKETS_PER_XFER][4];
+    makeRxPackets(opt, packets);
+    usbhMIDI.setAppOnRxPackets(onRxPackets);
+    rxMessages = 0;
+    uint64_t sent = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (sent < opt.messages) {
+        for (unsigned devAddr = 1; devAddr <= opt.devices; devAddr++) {
+            sent += sim_usb_midi_host_send_to_host(devAddr, packets[0], SIM_USB_MIDI_PACKETS_PER_XFER);
+        }
+        tuh_task();
+    }
+    auto stop = std::chrono::steady_clock::now();
+    usbhMIDI.unsetAppOnRxPackets();
+    unplugAll(opt);
+    return {rxMessages, std::chrono::duration<double>(stop - start).count()};
+}
+
+static BenchResult benchTx(const BenchOptions& opt)
+{
+    sim_usb_midi_host_reset();
+    plugAll(opt);
+    uint64_t queued = 0;
+    uint8_t value = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (queued < opt.messages) {
+        // One Control Change message per cable per device, then let
+        // the simulated bus carry them
+        for (unsigned devAddr = 1; devAddr <= opt.devices; devAddr++) {
+            for (unsigned cable = 0; cable < opt.cables; cable++) {
+                auto intf = usbhMIDI.getInterfaceFromDeviceAndCable(devAddr, cable);
+                if (intf != nullptr) {
+                    intf->sendControlChange(cable, value, 1);
+                    ++queued;
+                }
+            }
+        }
+        value = (value + 1) & 0x7f;
+        usbhMIDI.writeFlushAll();
+        tuh_task();
+    }
+    while (sim_usb_midi_host_busy()) {
+        usbhMIDI.writeFlushAll();
+        tuh_task();
+    }
+    auto stop = std::chrono::steady_clock::now();
+    uint64_t delivered = 0;
+    for (unsigned devAddr = 1; devAddr <= opt.devices; devAddr++) {
+        delivered += sim_usb_midi_host_get_tx_packets(devAddr);
+    }
+    unplugAll(opt);
+    if (delivered != queued)
+        printf("tx: %llu of %llu messages were not delivered\r\n", static_cast<unsigned long long>(queued - delivered),
+            static_cast<unsigned long long>(queued));
+    return {delivered, std::chrono::duration<double>(stop - start).count()};
+}
+
+static BenchResult benchHotplug(const BenchOptions& opt)
+{
+    sim_usb_midi_host_reset();
+    uint64_t cycles = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t idx = 0; idx < opt.cycles; idx++) {
+        plugAll(opt);
+        unplugAll(opt);
+        cycles += opt.devices;
+    }
+    auto stop = std::chrono::steady_clock::now();
+    return {cycles, std::chrono::duration<double>(stop - start).count()};
+}
+
+static void printResult(const char* path, const char* unit, const BenchOptions& opt, const BenchResult& result)
+{
+    double perSecond = result.seconds > 0 ? result.count / result.seconds : 0;
+    double nsPerItem = result.count > 0 ? result.seconds * 1e9 / result.count : 0;
+    printf("%-8s %7u %6u %12llu %-6s %14.0f %10.1f\r\n", path, opt.devices, opt.cables,
+        static_cast<unsigned long long>(result.count), unit, perSecond, nsPerItem);
+}
+
+static void usage(const char* name)
+{
+    printf("Usage: %s [--path rx|rxraw|tx|hotplug|all] [--devices N] [--cables N] [--messages N] [--cycles N]\r\n", name);
+    printf("  --devices  number of simulated devices, 1-%u (default %u)\r\n", RPPICOMIDI_TUH_MIDI_MAX_DEV, RPPICOMIDI_TUH_MIDI_MAX_DEV);
+    printf("  --cables   number of IN and OUT virtual cables per device, 1-%u (default 1)\r\n", MidiHostSettingsDefault::MaxCables);
+    printf("  --messages number of messages for the rx and tx paths (default 1000000)\r\n");
+    printf("  --cycles   number of plug/unplug rounds for the hotplug path (default 10000)\r\n");
+}
+
+static bool parseOptions(int argc, char* argv[], BenchOptions& opt)
+{
+    for (int idx = 1; idx < argc; idx++) {
+        const char* arg = argv[idx];
+        const char* val = (idx + 1 < argc) ? argv[idx + 1] : nullptr;
+        if (val == nullptr)
+            return false;
+        ++idx;
+        if (strcmp(arg, "--path") == 0) {
+            opt.rx = strcmp(val, "rx") == 0 || strcmp(val, "all") == 0;
+            opt.rxraw = strcmp(val, "rxraw") == 0 || strcmp(val, "all") == 0;
+            opt.tx = strcmp(val, "tx") == 0 || strcmp(val, "all") == 0;
+            opt.hotplug = strcmp(val, "hotplug") == 0 || strcmp(val, "all") == 0;
+            if (!opt.rx && !opt.rxraw && !opt.tx && !opt.hotplug)
+                return false;
+        }
+        else if (strcmp(arg, "--devices") == 0) {
+            opt.devices = strtoul(val, nullptr, 0);
+            if (opt.devices < 1 || opt.devices > RPPICOMIDI_TUH_MIDI_MAX_DEV)
+                return false;
+        }
+        else if (strcmp(arg, "--cables") == 0) {
+            opt.cables = strtoul(val, nullptr, 0);
+            if (opt.cables < 1 || opt.cables > MidiHostSettingsDefault::MaxCables)
+                return false;
+        }
+        else if (strcmp(arg, "--messages") == 0) {
+            opt.messages = strtoull(val, nullptr, 0);
+        }
+        else if (strcmp(arg, "--cycles") == 0) {
+            opt.cycles = strtoull(val, nullptr, 0);
+        }
+        else {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    BenchOptions opt;
+    if (!parseOptions(argc, argv, opt)) {
+        usage(argv[0]);
+        return 1;
+    }
+    usbhMIDI.begin(0, onMIDIconnect, onMIDIdisconnect);
+    printf("%-8s %7s %6s %12s %-6s %14s %10s\r\n", "path", "devices", "cables", "count", "unit", "per second", "ns each");
+    if (opt.rx)
+        printResult("rx", "msgs", opt, benchRx(opt));
+    if (opt.rxraw)
+        printResult("rxraw", "msgs", opt, benchRxPackets(opt));
+    if (opt.tx)
+        printResult("tx", "msgs", opt, benchTx(opt));
+    if (opt.hotplug)
+        printResult("hotplug", "cycles", opt, benchHotplug(opt));
+    return 0;
+}
@@ -0,0 +1,262 @@
+/*
+ * @file EZ_USB_MIDI_HOST_spsc_test.cpp
+ * @brief Tests dual-core mode with one std::thread per processor core
+ *
+ * The "USB host core" thread owns the simulated USB bus and calls
+ * usbHostTask(). The "MIDI core" thread calls readAll() and sends MIDI
+ * messages. Nothing else is shared between the threads, so the test passes
+ * only if the cross-core queues deliver every message in order. Build with
+ * -fsanitize=thread to also check the queues for data races.
+ *
+ * The threads yield whenever they wait for each other so the test also
+ * finishes quickly on a PC with only one processor.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include "EZ_USB_MIDI_HOST.h"
+#include "usb_midi_host_sim.h"
+
+USING_NAMESPACE_MIDI
+USING_NAMESPACE_EZ_USB_MIDI_HOST
+
+struct DualCoreSettings : public MidiHostSettingsDefault
+{
+    static const unsigned CoreQueueDepth = 64;
+    static const unsigned MaxRoutes = 4; // no routes are added; the lookups still run
+    static const unsigned TxCoalesceSlots = 4; // only notes are sent; they check the tables
+    static const unsigned TxPriorityLaneDepth = 64; // no real-time messages are sent
+    static const bool RxClockAnalysis = true; // no clocks are received; the scan still runs
+};
+
+RPPICOMIDI_EZ_USB_MIDI_HOST_INSTANCE(usbhMIDI, DualCoreSettings)
+
+static const uint8_t testDevAddr = 1;
+static const uint32_t testMessages = 200000;
+// After the first connection, the device is unplugged and plugged in again
+// this many times and sends replugMessages more notes each time
+static const unsigned replugs = 20;
+static const uint32_t replugMessages = 100;
+// Fewer TxBytes events than the queue holds outside the reserve, so no
+// message the MIDI core sends is dropped
+static const uint32_t maxNotesInFlight = 32;
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    if (!ok) {
+        printf("FAIL: %s\r\n", what);
+        ++failures;
+    }
+}
+
+/* QUEUE ORDERING */
+static void testQueueOrder()
+{
+    static EZ_USB_MIDI_HOST_SPSCQueue<uint32_t, 32> queue;
+    const uint32_t nItems = 1000000;
+    std::thread producer([]() {
+        for (uint32_t item = 0; item < nItems; ) {
+            if (queue.push(item))
+                ++item;
+            else
+                std::this_thread::yield();
+        }
+    });
+    uint32_t expected = 0;
+    bool inOrder = true;
+    while (expected < nItems) {
+        uint32_t item;
+        if (queue.pop(item)) {
+            inOrder = inOrder && item == expected;
+            ++expected;
+        }
+        else {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+    check(inOrder, "queue items arrive in order");
+    check(queue.count() == 0, "queue is empty after the last pop");
+}
+
+/* END TO END */
+// Written by the USB host core thread only
+static std::atomic<uint32_t> txNotes;
+static bool txInOrder;
+// Written by the MIDI core thread only
+static std::atomic<uint32_t> rxNotes;
+static bool rxInOrder;
+static std::atomic<unsigned> nConnects;
+static std::atomic<unsigned> nDisconnects;
+static std::atomic<bool> midiCoreLooping;
+static std::atomic<bool> midiCoreDone;
+static bool stringsOk;
+
+// Every packet from the device and to the device is Note On with the
+// note number and velocity counting up
+static void makeNote(uint32_t count, uint8_t packet[4])
+{
+    packet[0] = 0x09;
+    packet[1] = 0x90;
+    packet[2] = count & 0x7f;
+    packet[3] = (count >> 7) & 0x7f;
+}
+
+static void onTxPacket(uint8_t, const uint8_t packet[4], void*)
+{
+    uint8_t expected[4];
+    makeNote(txNotes++, expected);
+    txInOrder = txInOrder && memcmp(packet, expected, 4) == 0;
+}
+
+static void onNoteOn(Channel, byte note, byte velocity)
+{
+    uint8_t expected[4];
+    makeNote(rxNotes++, expected);
+    rxInOrder = rxInOrder && note == expected[2] && velocity == expected[3];
+}
+
+static void onConnect(uint8_t devAddr, uint8_t, uint8_t)
+{
+    usbhMIDI.getInterfaceFromDeviceAndCable(devAddr, 0)->setHandleNoteOn(onNoteOn);
+    ++nConnects;
+}
+
+static void onDisconnect(uint8_t)
+{
+    ++nDisconnects;
+}
+
+static void onStringsReady(uint8_t devAddr)
+{
+    auto dev = usbhMIDI.getDevFromDevAddr(devAddr);
+    stringsOk = dev != nullptr && dev->areStringsReady() &&
+        strcmp(reinterpret_cast<const char*>(dev->getProductStr()), "dual-core test") == 0;
+}
+
+static void usbHostCore()
+{
+    sim_usb_midi_host_reset();
+    sim_usb_midi_host_set_tx_sink(onTxPacket, nullptr);
+    usbhMIDI.setAppOnStringsReady(onStringsReady);
+    usbhMIDI.begin(0, onConnect, onDisconnect);
+    // The MIDI core is already reading and flushing every device slot
+    // when the device connects
+    while (!midiCoreLooping)
+        std::this_thread::yield();
+    uint32_t sent = 0;
+    for (unsigned round = 0; round <= replugs; round++) {
+        sim_usb_midi_host_plug(testDevAddr, 1, 1, 0xcafe, 0x4001, "rppicomidi", "dual-core test", nullptr);
+        uint32_t roundMessages = testMessages + round * replugMessages;
+        while (rxNotes < roundMessages || (round == 0 && !midiCoreDone) || sim_usb_midi_host_busy()) {
+            // Never let the simulated device overrun the driver receive FIFO
+            if (sent < roundMessages && !sim_usb_midi_host_busy()) {
+                uint8_t packets[SIM_USB_MIDI_PACKETS_PER_XFER][4];
+                uint32_t nPackets = 0;
+                for (; nPackets < SIM_USB_MIDI_PACKETS_PER_XFER && sent + nPackets < roundMessages; nPackets++)
+                    makeNote(sent + nPackets, packets[nPackets]);
+                sent += sim_usb_midi_host_send_to_host(testDevAddr, packets[0], nPackets);
+            }
+            usbhMIDI.usbHostTask();
+            std::this_thread::yield();
+        }
+        // Plug the device in again as soon as the MIDI core lets go of it, so
+        // the connection may reuse the slot the MIDI core just released
+        sim_usb_midi_host_unplug(testDevAddr);
+        while (nDisconnects <= round) {
+            usbhMIDI.usbHostTask();
+            std::this_thread::yield();
+        }
+    }
+}
+
+static void midiCore()
+{
+    midiCoreLooping = true;
+    while (nConnects == 0) {
+        usbhMIDI.readAll();
+        usbhMIDI.readAllDrain(4);
+        usbhMIDI.writeFlushAll();
+        std::this_thread::yield();
+    }
+    auto intf = usbhMIDI.getInterfaceFromDeviceAndCable(testDevAddr, 0);
+    uint32_t queued = 0;
+    while (queued < testMessages || rxNotes < testMessages) {
+        // half of the loops drain the MIDI IN FIFOs a few messages at a time
+        if (queued & 1)
+            usbhMIDI.readAllDrain(8);
+        else
+            usbhMIDI.readAll();
+        if (queued < testMessages) {
+            uint8_t packet[4];
+            makeNote(queued, packet);
+            // sendNoteOn() drops the message if the queue to the USB host core is full
+            if (queued - txNotes < maxNotesInFlight) {
+                intf->sendNoteOn(packet[2], packet[3], 1);
+                ++queued;
+            }
+        }
+        std::this_thread::yield();
+    }
+    midiCoreDone = true;
+    while (nDisconnects <= replugs) {
+        usbhMIDI.service(RPPICOMIDI_EZ_USB_MIDI_HOST_TIME_US() + 1000);
+        std::this_thread::yield();
+    }
+}
+
+static void testDualCore()
+{
+    txNotes = 0;
+    txInOrder = true;
+    rxNotes = 0;
+    rxInOrder = true;
+    nConnects = 0;
+    nDisconnects = 0;
+    std::thread usbHostThread(usbHostCore);
+    std::thread midiThread(midiCore);
+    midiThread.join();
+    usbHostThread.join();
+    check(rxNotes == testMessages + replugs * replugMessages, "every message from the device arrives");
+    check(nConnects == replugs + 1 && nDisconnects == replugs + 1, "every connection and disconnection is reported");
+    check(rxInOrder, "messages from the device arrive in order");
+    check(txNotes == testMessages, "every message to the device is sent");
+    check(txInOrder, "messages to the device are sent in order");
+    check(sim_usb_midi_host_get_rx_dropped(testDevAddr) == 0, "the driver receive FIFO never overflows");
+    check(stringsOk, "the MIDI core gets the device strings");
+    check(usbhMIDI.getDevFromDevAddr(testDevAddr) == nullptr, "the device is gone after the disconnect");
+}
+
+int main()
+{
+    testQueueOrder();
+    testDualCore();
+    printf("%s\r\n", failures == 0 ? "PASS" : "FAIL");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,1434 @@
+/*
+ * @file EZ_USB_MIDI_HOST_test.cpp
+ * @brief Tests single-core mode against the simulated USB bus
+ *
+ * Each test plugs in simulated devices, feeds USB MIDI packets through
+ * tuh_task() the way the USB hardware would and checks what the MIDI
+ * Library callbacks, the raw packet callback and the query functions
+ * report. The simulated timer is stopped so time stamps are predictable.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include "EZ_USB_MIDI_HOST.h"
+#include "usb_midi_host_sim.h"
+
+USING_NAMESPACE_MIDI
+USING_NAMESPACE_EZ_USB_MIDI_HOST
+
+struct TestSettings : public MidiHostSettingsDefault
+{
+    static const bool LatencyHistograms = true;
+    static const unsigned MidiInterfacePoolSize = 3;
+    static const unsigned StringArenaSize = 64;
+    static const unsigned MaxRoutes = 4;
+    static const unsigned TxCoalesceSlots = 4;
+    static const unsigned TxPriorityLaneDepth = 16;
+    static const bool RxClockAnalysis = true;
+};
+
+RPPICOMIDI_EZ_USB_MIDI_HOST_INSTANCE(usbhMIDI, TestSettings)
+RPPICOMIDI_EZ_USB_MIDI_HOST_INSTANCE(usbhMIDIport1, TestSettings) // started by testRootPorts()
+RPPICOMIDI_EZ_USB_MIDI_HOST_INSTANCE(usbhMIDIport2, TestSettings) // one object too many for testRootPorts()
+
+static const uint8_t testDevAddr = 1;
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    if (!ok) {
+        printf("FAIL: %s\r\n", what);
+        ++failures;
+    }
+}
+
+/* RECORDED MIDI IN TRAFFIC */
+struct RxNote {
+    uint8_t devAddr;
+    uint8_t cable;
+    uint8_t note;
+    uint32_t timestamp;
+};
+static RxNote rxNotes[64];
+static unsigned nRxNotes;
+
+static void onNoteOn(Channel, byte note, byte)
+{
+    if (nRxNotes < sizeof(rxNotes) / sizeof(rxNotes[0])) {
+        RxNote& rx = rxNotes[nRxNotes++];
+        usbhMIDI.getCurrentReadDevAndCable(rx.devAddr, rx.cable);
+        rx.note = note;
+        rx.timestamp = usbhMIDI.getCurrentReadTimestamp();
+    }
+}
+
+static void onRxPackets(uint8_t devAddr, const uint8_t* packets, uint32_t nPackets, uint32_t timestamp)
+{
+    for (uint32_t idx = 0; idx < nPackets && nRxNotes < sizeof(rxNotes) / sizeof(rxNotes[0]); idx++) {
+        RxNote& rx = rxNotes[nRxNotes++];
+        rx.devAddr = devAddr;
+        rx.cable = EZ_USB_MIDI_HOST_Packet::getCable(packets + 4 * idx);
+        rx.note = packets[4 * idx + 2];
+        rx.timestamp = timestamp;
+    }
+}
+
+static void onConnect(uint8_t devAddr, uint8_t nInCables, uint8_t)
+{
+    for (uint8_t cable = 0; cable < nInCables; cable++) {
+        auto intf = usbhMIDI.getInterfaceFromDeviceAndCable(devAddr, cable);
+        if (intf != nullptr)
+            intf->setHandleNoteOn(onNoteOn);
+    }
+}
+
+static void onDisconnect(uint8_t)
+{
+}
+
+static uint8_t stringsReadyDevAddrs[4];
+static unsigned nStringsReady;
+
+static void onStringsReady(uint8_t devAddr)
+{
+    if (nStringsReady < sizeof(stringsReadyDevAddrs))
+        stringsReadyDevAddrs[nStringsReady++] = devAddr;
+}
+
+/* HELPERS */
+static void sendNoteOn(uint8_t devAddr, uint8_t cable, uint8_t note)
+{
+    uint8_t packet[4] = {static_cast<uint8_t>((cable << 4) | 0x9), 0x90, note, 0x7f};
+    sim_usb_midi_host_send_to_host(devAddr, packet, 1);
+}
+
+static void readAllUntilIdle()
+{
+    // every readAll() parses at most one byte per cable
+    for (unsigned pass = 0; pass < 256; pass++)
+        usbhMIDI.readAll();
+}
+
+static void startTest(uint8_t nCables)
+{
+    sim_usb_midi_host_reset();
+    sim_usb_midi_host_set_time_us(0);
+    sim_usb_midi_host_plug(testDevAddr, nCables, nCables, 0xcafe, 0x4001, "rppicomidi", "single-core test", nullptr);
+    tuh_task();
+    nRxNotes = 0;
+}
+
+static void endTest()
+{
+    sim_usb_midi_host_unplug(testDevAddr);
+    tuh_task();
+}
+
+/* TESTS */
+static void testRxTimestamps()
+{
+    startTest(2);
+    // Three bulk transfers arrive before the application reads any of them
+    sim_usb_midi_host_set_time_us(1000);
+    sendNoteOn(testDevAddr, 0, 60);
+    tuh_task();
+    sim_usb_midi_host_set_time_us(2000);
+    sendNoteOn(testDevAddr, 0, 61);
+    sendNoteOn(testDevAddr, 1, 62);
+    tuh_task();
+    sim_usb_midi_host_set_time_us(3000);
+    sendNoteOn(testDevAddr, 0, 63);
+    tuh_task();
+    sim_usb_midi_host_set_time_us(9000);
+    readAllUntilIdle();
+    check(nRxNotes == 4, "every note arrives");
+    // note 60 arrived at 1000, notes 61 and 62 at 2000 and note 63 at 3000
+    static const uint32_t expected[4] = {1000, 2000, 2000, 3000};
+    bool timestampsOk = true;
+    bool contextOk = true;
+    for (unsigned idx = 0; idx < nRxNotes; idx++) {
+        timestampsOk = timestampsOk && rxNotes[idx].timestamp == expected[(rxNotes[idx].note - 60) & 3];
+        contextOk = contextOk && rxNotes[idx].devAddr == testDevAddr && rxNotes[idx].cable == (rxNotes[idx].note == 62 ? 1 : 0);
+    }
+    check(timestampsOk, "MIDI Library messages carry the time their bulk transfer arrived");
+    check(contextOk, "MIDI Library messages report their device and cable");
+
+    // The raw packet path gets the same time stamps
+    nRxNotes = 0;
+    usbhMIDI.setAppOnRxPackets(onRxPackets);
+    sim_usb_midi_host_set_time_us(4000);
+    sendNoteOn(testDevAddr, 1, 64);
+    tuh_task();
+    usbhMIDI.unsetAppOnRxPackets();
+    check(nRxNotes == 1 && rxNotes[0].timestamp == 4000 && rxNotes[0].cable == 1, "raw packets carry their arrival time");
+    endTest();
+}
+
+static uint32_t nRxPacketBatches;
+static uint32_t maxRxPacketBatch;
+static bool rxPacketsOk;
+
+static void onRxPacketBatch(uint8_t devAddr, const uint8_t* packets, uint32_t nPackets, uint32_t timestamp)
+{
+    ++nRxPacketBatches;
+    if (nPackets > maxRxPacketBatch)
+        maxRxPacketBatch = nPackets;
+    rxPacketsOk = rxPacketsOk && (reinterpret_cast<uintptr_t>(packets) & 3) == 0;
+    for (uint32_t idx = 0; idx < nPackets; idx++) {
+        const uint8_t* packet = packets + 4 * idx;
+        rxPacketsOk = rxPacketsOk && EZ_USB_MIDI_HOST_Packet::getCIN(packet) == 0x9 && packet[1] == 0x90 &&
+            packet[2] == nRxNotes + idx && packet[3] == 0x7f;
+    }
+    onRxPackets(devAddr, packets, nPackets, timestamp);
+}
+
+// The raw packet callback gets the driver's packets in order, in
+// aligned batches of up to one bulk endpoint's worth, and nothing reaches
+// the MIDI IN FIFOs or the MIDI Library while it is registered
+static void testRawPackets()
+{
+    startTest(1);
+    nRxPacketBatches = 0;
+    maxRxPacketBatch = 0;
+    rxPacketsOk = true;
+    usbhMIDI.setAppOnRxPackets(onRxPacketBatch);
+    for (uint8_t note = 0; note < 40; note++)
+        sendNoteOn(testDevAddr, 0, note);
+    while (sim_usb_midi_host_busy())
+        tuh_task();
+    check(nRxNotes == 40 && rxPacketsOk, "raw packets arrive intact and in order");
+    check(nRxPacketBatches >= 3 && maxRxPacketBatch == 16, "raw packets come in batches of up to 16");
+    readAllUntilIdle();
+    check(nRxNotes == 40 && usbhMIDI.getCableCounters(testDevAddr, 0)->rxBytes.get() == 0,
+        "raw packets skip the MIDI IN FIFOs and the MIDI Library");
+    check(usbhMIDI.getDeviceCounters(testDevAddr)->rxPackets.get() == 40, "raw packets are counted");
+
+    usbhMIDI.unsetAppOnRxPackets();
+    nRxNotes = 0;
+    sendNoteOn(testDevAddr, 0, 60);
+    tuh_task();
+    readAllUntilIdle();
+    check(nRxNotes == 1 && rxNotes[0].note == 60, "unregistering sends MIDI IN to the MIDI Library again");
+    endTest();
+}
+
+struct RxMessage {
+    uint8_t devAddr;
+    uint8_t cable;
+    uint32_t timestamp;
+    EZ_USB_MIDI_HOST_Message message;
+};
+static RxMessage rxMessages[8];
+static unsigned nRxMessages;
+
+static void onMessage(uint8_t devAddr, uint8_t cable, uint32_t timestamp, const EZ_USB_MIDI_HOST_Message& message)
+{
+    if (nRxMessages < sizeof(rxMessages) / sizeof(rxMessages[0]))
+        rxMessages[nRxMessages++] = {devAddr, cable, timestamp, message};
+}
+
+static void testMessageAvailable()
+{
+    static const uint8_t secondDevAddr = 2;
+    static const uint8_t cable = 0;
+    startTest(1);
+    sim_usb_midi_host_plug(secondDevAddr, 1, 1, 0xcafe, 0x4002, "rppicomidi", "second device", nullptr);
+    tuh_task();
+    sendNoteOn(testDevAddr, cable, 60);
+    tuh_task();
+    uint16_t bitmap = 0;
+    for (unsigned pass = 0; pass < 8 && bitmap == 0; pass++)
+        bitmap = usbhMIDI.readAll();
+    check(usbhMIDI.isMessageAvailableOnCable(cable, bitmap) && usbhMIDI.isMessageAvailableOnCable(testDevAddr, cable) &&
+        !usbhMIDI.isMessageAvailableOnCable(secondDevAddr, cable), "readAll() reports the device and cable that had a message");
+
+    // The next pass only reads the second device
+    sendNoteOn(secondDevAddr, cable, 61);
+    tuh_task();
+    bitmap = 0;
+    for (unsigned pass = 0; pass < 8 && bitmap == 0; pass++)
+        bitmap = usbhMIDI.readAll();
+    check(usbhMIDI.isMessageAvailableOnCable(secondDevAddr, cable) && !usbhMIDI.isMessageAvailableOnCable(testDevAddr, cable),
+        "a device readAll() did not read reports no message");
+    usbhMIDI.readAll();
+    check(!usbhMIDI.isMessageAvailableOnCable(secondDevAddr, cable), "a pass with no messages clears every device");
+
+    sendNoteOn(testDevAddr, cable, 62);
+    tuh_task();
+    usbhMIDI.readAllDrain(0);
+    sendNoteOn(secondDevAddr, cable, 63);
+    tuh_task();
+    usbhMIDI.readAllDrain(0);
+    check(usbhMIDI.isMessageAvailableOnCable(secondDevAddr, cable) && !usbhMIDI.isMessageAvailableOnCable(testDevAddr, cable),
+        "readAllDrain() clears the devices it did not read");
+    sim_usb_midi_host_unplug(secondDevAddr);
+    tuh_task();
+    endTest();
+}
+
+static void testMessageCallback()
+{
+    startTest(2);
+    nRxMessages = 0;
+    usbhMIDI.setAppOnMessage(onMessage);
+    sim_usb_midi_host_set_time_us(1000);
+    sendNoteOn(testDevAddr, 1, 60);
+    tuh_task();
+    sim_usb_midi_host_set_time_us(2000);
+    const uint8_t packets[12] = {
+        0x0B, 0xB3, 0x07, 0x64,
+        0x04, 0xF0, 0x7D, 0x01,
+        0x06, 0x02, 0xF7, 0x00,
+    };
+    sim_usb_midi_host_send_to_host(testDevAddr, packets, 3);
+    tuh_task();
+    readAllUntilIdle();
+    check(nRxMessages == 3 && nRxNotes == 1, "the message callback gets every message along with the MIDI Library callbacks");
+    // readAll() reads cable 0 before cable 1
+    const RxMessage& note = rxMessages[1];
+    check(note.devAddr == testDevAddr && note.cable == 1 && note.timestamp == 1000 && note.message.type == NoteOn &&
+        note.message.channel == 1 && note.message.data1 == 60 && note.message.data2 == 0x7f && note.message.sysexArray == nullptr,
+        "the message callback reports the device, cable and time stamp of a note");
+    const RxMessage& cc = rxMessages[0];
+    check(cc.cable == 0 && cc.timestamp == 2000 && cc.message.type == ControlChange && cc.message.channel == 4 &&
+        cc.message.data1 == 7 && cc.message.data2 == 0x64, "the message callback decodes control changes");
+    const RxMessage& sysex = rxMessages[2];
+    check(sysex.cable == 0 && sysex.message.type == SystemExclusive && sysex.message.sysexLength == 5 &&
+        sysex.message.sysexArray[0] == 0xF0 && sysex.message.sysexArray[2] == 0x01 && sysex.message.sysexArray[4] == 0xF7,
+        "the message callback passes the SysEx array");
+
+    // The callback is registered once for every device, including ones that connect later
+    sim_usb_midi_host_plug(2, 1, 1, 0xcafe, 0x4002, "rppicomidi", "second device", nullptr);
+    tuh_task();
+    nRxMessages = 0;
+    sendNoteOn(2, 0, 61);
+    tuh_task();
+    readAllUntilIdle();
+    check(nRxMessages == 1 && rxMessages[0].devAddr == 2 && rxMessages[0].message.data1 == 61,
+        "the message callback gets messages from a device that connected after it was registered");
+    sim_usb_midi_host_unplug(2);
+    tuh_task();
+
+    usbhMIDI.unsetAppOnMessage();
+    nRxMessages = 0;
+    nRxNotes = 0;
+    sendNoteOn(testDevAddr, 0, 62);
+    tuh_task();
+    readAllUntilIdle();
+    check(nRxMessages == 0 && nRxNotes == 1, "unregistering stops the message callback");
+    endTest();
+}
+
+static void testLatencyHistograms()
+{
+    startTest(2);
+    // MIDI IN: one note waits 500 us, the other 3 us
+    sim_usb_midi_host_set_time_us(1000);
+    sendNoteOn(testDevAddr, 0, 60);
+    tuh_task();
+    sim_usb_midi_host_set_time_us(1500);
+    readAllUntilIdle();
+    sim_usb_midi_host_set_time_us(1600);
+    sendNoteOn(testDevAddr, 0, 61);
+    tuh_task();
+    sim_usb_midi_host_set_time_us(1603);
+    readAllUntilIdle();
+    auto rx = usbhMIDI.getRxLatency(testDevAddr, 0);
+    check(rx != nullptr && rx->getCount() == 2 && rx->getBucket(2) == 1 && rx->getBucket(9) == 1 && rx->getMaxUs() == 500,
+        "MIDI IN delays land in the right buckets");
+    check(rx != nullptr && rx->getPercentileUs(50) == 3 && rx->getPercentileUs(100) == 500, "MIDI IN percentiles");
+    check(usbhMIDI.getRxLatency(testDevAddr, 1)->getCount() == 0, "MIDI IN histograms are per cable");
+
+    // MIDI OUT: 20 notes; the first flush sends 16 of them
+    auto intf = usbhMIDI.getInterfaceFromDeviceAndCable(testDevAddr, 1);
+    sim_usb_midi_host_set_time_us(2000);
+    for (uint8_t note = 0; note < 20; note++)
+        intf->sendNoteOn(note, 0x7f, 1);
+    sim_usb_midi_host_set_time_us(2100);
+    usbhMIDI.writeFlushAll();
+    tuh_task();
+    auto tx = usbhMIDI.getTxLatency(testDevAddr, 1);
+    check(tx != nullptr && tx->getCount() == 16 && tx->getBucket(7) == 16, "MIDI OUT delay counts only sent messages");
+    sim_usb_midi_host_set_time_us(2400);
+    usbhMIDI.writeFlushAll();
+    tuh_task();
+    check(tx != nullptr && tx->getCount() == 20 && tx->getBucket(9) == 4, "MIDI OUT delay counts the rest on the next flush");
+    check(usbhMIDI.getTxLatency(testDevAddr, 0)->getCount() == 0, "MIDI OUT histograms are per cable");
+
+    // A long SysEx message is counted once, when its last packet goes out
+    uint8_t sysex[100];
+    for (uint8_t idx = 0; idx < sizeof(sysex); idx++)
+        sysex[idx] = idx;
+    sim_usb_midi_host_set_time_us(3000);
+    intf->sendSysEx(sizeof(sysex), sysex);
+    for (uint32_t now = 3010; sim_usb_midi_host_busy(); now += 10) {
+        sim_usb_midi_host_set_time_us(now);
+        usbhMIDI.writeFlushAll();
+        tuh_task();
+    }
+    // 34 packets; the third flush at 3030 sends the last two
+    check(tx->getCount() == 21 && tx->getBucket(5) == 1, "a SysEx message is counted when its last packet is sent");
+
+    usbhMIDI.resetLatency(testDevAddr);
+    check(rx->getCount() == 0 && tx->getCount() == 0, "resetLatency() clears the histograms");
+    endTest();
+}
+
+static void testCounters()
+{
+    startTest(2);
+    auto devCounters = usbhMIDI.getDeviceCounters(testDevAddr);
+    auto cable0 = usbhMIDI.getCableCounters(testDevAddr, 0);
+    auto cable1 = usbhMIDI.getCableCounters(testDevAddr, 1);
+    check(devCounters != nullptr && cable0 != nullptr && cable1 != nullptr, "counters exist for connected devices and cables");
+    check(usbhMIDI.getCableCounters(testDevAddr, 2) == nullptr, "no counters for missing cables");
+
+    // MIDI IN: 3 notes on cable 0, then 6 notes more than its MIDI IN FIFO holds on cable 1
+    const uint32_t fifoNotes = EZ_USB_MIDI_HOST_Transport<TestSettings>::inFIFOPackets;
+    for (uint8_t note = 0; note < 3; note++)
+        sendNoteOn(testDevAddr, 0, note);
+    for (uint8_t note = 0; note < fifoNotes + 6; note++)
+        sendNoteOn(testDevAddr, 1, note);
+    while (sim_usb_midi_host_busy())
+        tuh_task();
+    readAllUntilIdle();
+    check(devCounters->rxPackets.get() == 3 + fifoNotes + 6, "every received packet is counted");
+    check(cable0->rxBytes.get() == 9 && cable0->rxDroppedBytes.get() == 0 && cable0->rxMessages.get() == 3,
+        "MIDI IN bytes and messages are counted per cable");
+    check(cable1->rxBytes.get() == (fifoNotes + 6) * 3 && cable1->rxDroppedBytes.get() == 6 * 3 &&
+        cable1->rxMessages.get() == fifoNotes, "bytes that overflow the MIDI IN FIFO are counted as dropped");
+
+    // MIDI OUT: 50 notes without a flush; the driver transmit FIFO holds 44 packets
+    auto intf = usbhMIDI.getInterfaceFromDeviceAndCable(testDevAddr, 1);
+    for (uint8_t note = 0; note < 50; note++)
+        intf->sendNoteOn(note, 0x7f, 1);
+    check(cable1->txBytes.get() == 44 * 3 && cable1->txRejectedMessages.get() == 6 && cable1->txRejectedBytes.get() == 0,
+        "messages the MIDI OUT FIFO cannot take are counted as rejected");
+    while (sim_usb_midi_host_busy()) {
+        usbhMIDI.writeFlushAll();
+        tuh_task();
+    }
+    check(devCounters->txFlushes.get() == 3 && devCounters->txPackets.get() == 44, "flushes that start a transfer are counted");
+    check(cable0->txBytes.get() == 0, "MIDI OUT bytes are counted per cable");
+
+    // Counters start over when a device connects
+    endTest();
+    startTest(2);
+    check(usbhMIDI.getDeviceCounters(testDevAddr)->rxPackets.get() == 0 &&
+        usbhMIDI.getCableCounters(testDevAddr, 1)->txBytes.get() == 0, "connecting a device clears its counters");
+    endTest();
+}
+
+static void testInterfacePool()
+{
+    // The pool has 3 interface objects; two 2-cable devices need 4
+    startTest(2);
+    const uint8_t otherDevAddr = 2;
+    sim_usb_midi_host_plug(otherDevAddr, 2, 2, 0xcafe, 0x4002, "rppicomidi", "second device", nullptr);
+    tuh_task();
+    check(usbhMIDI.getInterfaceFromDeviceAndCable(testDevAddr, 1) != nullptr &&
+        usbhMIDI.getInterfaceFromDeviceAndCable(otherDevAddr, 0) != nullptr, "cables get interfaces in connect order");
+    check(usbhMIDI.getInterfaceFromDeviceAndCable(otherDevAddr, 1) == nullptr, "no interface once the pool is empty");
+
+    // MIDI IN data for a cable without an interface is dropped
+    sendNoteOn(otherDevAddr, 1, 60);
+    sendNoteOn(otherDevAddr, 0, 61);
+    tuh_task();
+    readAllUntilIdle();
+    check(nRxNotes == 1 && rxNotes[0].note == 61, "cables without an interface drop MIDI IN data");
+
+    // Disconnecting a device returns its interfaces to the pool
+    endTest();
+    const uint8_t thirdDevAddr = 3;
+    sim_usb_midi_host_plug(thirdDevAddr, 2, 2, 0xcafe, 0x4003, "rppicomidi", "third device", nullptr);
+    tuh_task();
+    check(usbhMIDI.getInterfaceFromDeviceAndCable(thirdDevAddr, 1) != nullptr, "disconnecting frees interfaces");
+    nRxNotes = 0;
+    sendNoteOn(thirdDevAddr, 1, 62);
+    tuh_task();
+    readAllUntilIdle();
+    check(nRxNotes == 1 && rxNotes[0].devAddr == thirdDevAddr && rxNotes[0].note == 62, "reused interfaces receive MIDI IN data");
+    sim_usb_midi_host_unplug(thirdDevAddr);
+    sim_usb_midi_host_unplug(otherDevAddr);
+    tuh_task();
+}
+
+static bool strEquals(const uint8_t* str, const char* expected)
+{
+    return strcmp(reinterpret_cast<const char*>(str), expected) == 0;
+}
+
+static void testStrings()
+{
+    nStringsReady = 0;
+    startTest(1);
+    // The device is usable before its strings arrive
+    auto dev = usbhMIDI.getDevFromDevAddr(testDevAddr);
+    check(dev != nullptr && usbhMIDI.getInterfaceFromDeviceAndCable(testDevAddr, 0) != nullptr, "device is usable right away");
+    check(!dev->areStringsReady() && strEquals(dev->getProductStr(), "") && nStringsReady == 0, "strings are empty until fetched");
+    sendNoteOn(testDevAddr, 0, 60);
+    tuh_task();
+    readAllUntilIdle();
+    check(nRxNotes == 1, "MIDI IN works while strings are being fetched");
+
+    // A second device waits for the first device's strings; one control transfer completes per tuh_task()
+    const uint8_t otherDevAddr = 2;
+    sim_usb_midi_host_plug(otherDevAddr, 1, 1, 0xcafe, 0x4002, "maker", "other device", "1234");
+    for (unsigned pass = 0; pass < 8 && nStringsReady < 2; pass++)
+        tuh_task();
+    check(nStringsReady == 2 && stringsReadyDevAddrs[0] == testDevAddr && stringsReadyDevAddrs[1] == otherDevAddr,
+        "strings ready callbacks run in connect order");
+    check(strEquals(dev->getManufacturerStr(), "rppicomidi") && strEquals(dev->getProductStr(), "single-core test") &&
+        strEquals(dev->getSerialString(), ""), "first device strings");
+    auto other = usbhMIDI.getDevFromDevAddr(otherDevAddr);
+    check(other != nullptr && strEquals(other->getManufacturerStr(), "maker") && strEquals(other->getProductStr(), "other device") &&
+        strEquals(other->getSerialString(), "1234"), "second device strings");
+    endTest();
+    sim_usb_midi_host_unplug(otherDevAddr);
+    tuh_task();
+
+    // Unplugging a device while its strings are fetched does not stall the next device
+    nStringsReady = 0;
+    startTest(1);
+    sim_usb_midi_host_plug(otherDevAddr, 1, 1, 0xcafe, 0x4002, "maker", "other device", "1234");
+    tuh_task();
+    sim_usb_midi_host_unplug(testDevAddr);
+    for (unsigned pass = 0; pass < 8 && nStringsReady < 1; pass++)
+        tuh_task();
+    check(nStringsReady == 1 && stringsReadyDevAddrs[0] == otherDevAddr, "fetching moves on when a device is unplugged");
+
+    // A device without strings is ready as soon as it connects
+    const uint8_t plainDevAddr = 3;
+    sim_usb_midi_host_plug(plainDevAddr, 1, 1, 0xcafe, 0x4003, nullptr, nullptr, nullptr);
+    tuh_task();
+    check(nStringsReady == 2 && stringsReadyDevAddrs[1] == plainDevAddr, "a device without strings is ready at once");
+    sim_usb_midi_host_unplug(otherDevAddr);
+    sim_usb_midi_host_unplug(plainDevAddr);
+    tuh_task();
+}
+
+static void testStringArena()
+{
+    // "rppicomidi" and "single-core test" use 32 of the 64 arena bytes
+    nStringsReady = 0;
+    startTest(1);
+    for (unsigned pass = 0; pass < 8 && nStringsReady < 1; pass++)
+        tuh_task();
+    const char* longProduct = "a product name that is too long for the string arena";
+    const uint8_t otherDevAddr = 2;
+    sim_usb_midi_host_plug(otherDevAddr, 1, 1, 0xcafe, 0x4002, nullptr, longProduct, nullptr);
+    for (unsigned pass = 0; pass < 8 && nStringsReady < 2; pass++)
+        tuh_task();
+    auto other = usbhMIDI.getDevFromDevAddr(otherDevAddr);
+    const char* product = other != nullptr ? reinterpret_cast<const char*>(other->getProductStr()) : "";
+    check(nStringsReady == 2 && strlen(product) == 29 && strncmp(product, longProduct, 29) == 0,
+        "a string that does not fit is truncated");
+    sim_usb_midi_host_unplug(otherDevAddr);
+    tuh_task();
+
+    // Disconnecting a device returns its strings to the arena
+    endTest();
+    sim_usb_midi_host_plug(otherDevAddr, 1, 1, 0xcafe, 0x4002, nullptr, longProduct, nullptr);
+    for (unsigned pass = 0; pass < 8 && nStringsReady < 3; pass++)
+        tuh_task();
+    other = usbhMIDI.getDevFromDevAddr(otherDevAddr);
+    check(nStringsReady == 3 && other != nullptr && strEquals(other->getProductStr(), longProduct),
+        "disconnecting frees strings");
+    sim_usb_midi_host_unplug(otherDevAddr);
+    tuh_task();
+}
+
+static void testDeviceAddresses()
+{
+    // RPPICOMIDI_TUH_MIDI_MAX_DEV is 4, but USB addresses go up to CFG_TUH_DEVICE_MAX
+    startTest(1);
+    const uint8_t highDevAddr = CFG_TUH_DEVICE_MAX;
+    sim_usb_midi_host_plug(highDevAddr, 1, 1, 0xcafe, 0x4002, nullptr, nullptr, nullptr);
+    tuh_task();
+    check(usbhMIDI.isConnected(highDevAddr) && usbhMIDI.getDevFromDevAddr(highDevAddr)->getDevAddr() == highDevAddr,
+        "a device address above RPPICOMIDI_TUH_MIDI_MAX_DEV is found");
+    check(!usbhMIDI.isConnected(0) && !usbhMIDI.isConnected(2) && !usbhMIDI.isConnected(CFG_TUH_DEVICE_MAX + 1),
+        "addresses without a device are not found");
+    sendNoteOn(highDevAddr, 0, 60);
+    tuh_task();
+    readAllUntilIdle();
+    check(nRxNotes == 1 && rxNotes[0].devAddr == highDevAddr, "MIDI IN from a high device address");
+    sim_usb_midi_host_unplug(highDevAddr);
+    tuh_task();
+    check(!usbhMIDI.isConnected(highDevAddr) && usbhMIDI.isConnected(testDevAddr), "unplugging clears only that address");
+    endTest();
+}
+
+static void testRootPorts()
+{
+    // usbhMIDI runs root port 0; a second object takes the devices on root port 1
+    startTest(1);
+    check(usbhMIDIport1.begin(1, nullptr, nullptr), "a second object starts");
+    check(!usbhMIDIport2.begin(2, nullptr, nullptr), "begin() fails once RPPICOMIDI_EZ_USB_MIDI_HOST_MAX_INSTANCES objects are started");
+    usbhMIDIport1.setAppOnRxPackets(onRxPackets);
+    const uint8_t port1DevAddr = 2;
+    sim_usb_midi_host_plug(port1DevAddr, 1, 1, 0xcafe, 0x4002, nullptr, nullptr, nullptr);
+    sim_usb_midi_host_set_rhport(port1DevAddr, 1);
+    tuh_task();
+    check(usbhMIDIport1.isConnected(port1DevAddr) && !usbhMIDI.isConnected(port1DevAddr), "a device belongs to its root port's object");
+    check(usbhMIDI.isConnected(testDevAddr) && !usbhMIDIport1.isConnected(testDevAddr), "the other root port's devices stay put");
+
+    sendNoteOn(port1DevAddr, 0, 64);
+    sendNoteOn(testDevAddr, 0, 65);
+    tuh_task();
+    readAllUntilIdle();
+    check(nRxNotes == 2 && rxNotes[0].devAddr == port1DevAddr && rxNotes[0].note == 64 &&
+        rxNotes[1].devAddr == testDevAddr && rxNotes[1].note == 65, "MIDI IN goes to the device's object");
+
+    // Devices on a root port without an object are ignored
+    const uint8_t port2DevAddr = 3;
+    sim_usb_midi_host_plug(port2DevAddr, 1, 1, 0xcafe, 0x4003, nullptr, nullptr, nullptr);
+    sim_usb_midi_host_set_rhport(port2DevAddr, 2);
+    tuh_task();
+    check(!usbhMIDI.isConnected(port2DevAddr) && !usbhMIDIport1.isConnected(port2DevAddr), "devices on other root ports are ignored");
+
+    sim_usb_midi_host_unplug(port1DevAddr);
+    sim_usb_midi_host_unplug(port2DevAddr);
+    tuh_task();
+    check(!usbhMIDIport1.isConnected(port1DevAddr) && usbhMIDI.isConnected(testDevAddr), "unplugging goes to the device's object");
+    endTest();
+}
+
+struct TxPacket {
+    uint8_t devAddr;
+    uint8_t packet[4];
+};
+static TxPacket txPackets[16];
+static unsigned nTxPackets;
+
+static void onTxPacket(uint8_t devAddr, const uint8_t packet[4], void*)
+{
+    if (nTxPackets < sizeof(txPackets) / sizeof(txPackets[0])) {
+        txPackets[nTxPackets].devAddr = devAddr;
+        memcpy(txPackets[nTxPackets].packet, packet, 4);
+        ++nTxPackets;
+    }
+}
+
+static void testRoutes()
+{
+    startTest(1);
+    const uint8_t otherDevAddr = 2;
+    sim_usb_midi_host_plug(otherDevAddr, 2, 2, 0xcafe, 0x4002, nullptr, nullptr, nullptr);
+    tuh_task();
+    check(!usbhMIDI.addRoute(testDevAddr, 1, otherDevAddr, 0) && !usbhMIDI.addRoute(testDevAddr, 0, otherDevAddr, 2) &&
+        !usbhMIDI.addRoute(testDevAddr, 0, 3, 0), "routes need connected devices and cables");
+    check(usbhMIDI.addRoute(testDevAddr, 0, otherDevAddr, 1) && usbhMIDI.addRoute(testDevAddr, 0, testDevAddr, 0) &&
+        usbhMIDI.getRouteCount() == 2, "add routes");
+
+    // Packets are forwarded from the data received callback; the source still gets them
+    nTxPackets = 0;
+    sim_usb_midi_host_set_tx_sink(onTxPacket, nullptr);
+    sendNoteOn(testDevAddr, 0, 60);
+    tuh_task();
+    sim_usb_midi_host_set_tx_sink(nullptr, nullptr);
+    bool toOther = false;
+    bool toSelf = false;
+    for (unsigned idx = 0; idx < nTxPackets; idx++) {
+        const uint8_t* packet = txPackets[idx].packet;
+        toOther |= txPackets[idx].devAddr == otherDevAddr && packet[0] == 0x19 && packet[1] == 0x90 && packet[2] == 60;
+        toSelf |= txPackets[idx].devAddr == testDevAddr && packet[0] == 0x09 && packet[1] == 0x90 && packet[2] == 60;
+    }
+    check(nTxPackets == 2 && toOther && toSelf, "packets go out on every route without writeFlushAll()");
+    readAllUntilIdle();
+    check(nRxNotes == 1 && rxNotes[0].note == 60, "routed packets still reach the MIDI Library");
+    check(usbhMIDI.getDeviceCounters(testDevAddr)->thruPackets.get() == 2, "forwarded packets are counted");
+    auto otherCounters = usbhMIDI.getDeviceCounters(otherDevAddr);
+    check(otherCounters->thruTxPackets.get() == 1 && otherCounters->txPackets.get() == 1 && otherCounters->txFlushes.get() == 1,
+        "the destination's flush counters include forwarded packets");
+
+    // A forwarded packet that flushes the destination's own message times
+    // that message, and is not timed itself
+    sim_usb_midi_host_set_time_us(1000);
+    usbhMIDI.getInterfaceFromDeviceAndCable(otherDevAddr, 0)->sendNoteOn(62, 0x7f, 1);
+    sim_usb_midi_host_set_time_us(1200);
+    sendNoteOn(testDevAddr, 0, 61);
+    tuh_task();
+    auto tx = usbhMIDI.getTxLatency(otherDevAddr, 0);
+    check(tx->getCount() == 1 && tx->getMaxUs() == 200 && usbhMIDI.getTxLatency(otherDevAddr, 1)->getCount() == 0,
+        "forwarded packets keep the destination's MIDI OUT delays in step");
+    sim_usb_midi_host_set_time_us(1300);
+    usbhMIDI.getInterfaceFromDeviceAndCable(otherDevAddr, 0)->sendNoteOn(63, 0x7f, 1);
+    sim_usb_midi_host_set_time_us(1310);
+    usbhMIDI.writeFlushAll();
+    tuh_task();
+    check(tx->getCount() == 2 && tx->getMaxUs() == 200, "later messages are timed from their own write");
+    readAllUntilIdle();
+
+    check(usbhMIDI.removeRoute(testDevAddr, 0, testDevAddr, 0) && !usbhMIDI.removeRoute(testDevAddr, 0, testDevAddr, 0) &&
+        usbhMIDI.getRouteCount() == 1, "remove a route");
+    sim_usb_midi_host_unplug(otherDevAddr);
+    tuh_task();
+    check(usbhMIDI.getRouteCount() == 0, "disconnecting removes the device's routes");
+    endTest();
+}
+
+static void testInFilters()
+{
+    startTest(1);
+    check(!usbhMIDI.setInFilter(testDevAddr, 1, EZ_USB_MIDI_HOST_Packet::Clock, 0), "no filter for a missing cable");
+    check(usbhMIDI.setInFilter(testDevAddr, 0, EZ_USB_MIDI_HOST_Packet::ActiveSensing | EZ_USB_MIDI_HOST_Packet::Clock |
+        EZ_USB_MIDI_HOST_Packet::PolyPressure, 1u << 1), "set a filter");
+    const uint8_t packets[][4] = {
+        {0x0F, 0xFE, 0, 0},       // Active Sensing
+        {0x09, 0x90, 60, 0x7f},   // Note On, channel 1
+        {0x0F, 0xF8, 0, 0},       // Clock
+        {0x09, 0x91, 61, 0x7f},   // Note On, channel 2
+        {0x0A, 0xA0, 60, 0x10},   // Poly Pressure
+        {0x09, 0x90, 62, 0x7f},   // Note On, channel 1
+    };
+    sim_usb_midi_host_send_to_host(testDevAddr, packets[0], sizeof(packets) / 4);
+    tuh_task();
+    readAllUntilIdle();
+    check(nRxNotes == 2 && rxNotes[0].note == 60 && rxNotes[1].note == 62, "filtered messages never reach the MIDI Library");
+    check(usbhMIDI.getDeviceCounters(testDevAddr)->rxFilteredPackets.get() == 4 &&
+        usbhMIDI.getCableCounters(testDevAddr, 0)->rxBytes.get() == 6, "filtered packets never reach the MIDI IN FIFO");
+
+    usbhMIDI.setInFilter(testDevAddr, 0, 0, 0);
+    sim_usb_midi_host_send_to_host(testDevAddr, packets[3], 1);
+    tuh_task();
+    readAllUntilIdle();
+    check(nRxNotes == 3 && rxNotes[2].note == 61, "clearing the filter passes everything again");
+    endTest();
+}
+
+static void sendNotesUntilIdle(uint8_t firstNote, uint8_t nNotes)
+{
+    for (uint8_t note = firstNote; note < firstNote + nNotes; note++)
+        sendNoteOn(testDevAddr, 0, note);
+    while (sim_usb_midi_host_busy())
+        tuh_task();
+}
+
+static void testInOverflowPolicies()
+{
+    startTest(1);
+    auto cable0 = usbhMIDI.getCableCounters(testDevAddr, 0);
+    const unsigned fifoNotes = EZ_USB_MIDI_HOST_Transport<TestSettings>::inFIFOPackets; // one note per packet
+    check(!usbhMIDI.setInOverflowPolicy(testDevAddr, 1, InOverflowDropOldest), "no policy for a missing cable");
+
+    // The default drops the newest notes whole
+    sendNotesUntilIdle(0, fifoNotes + 2);
+    readAllUntilIdle();
+    check(nRxNotes == fifoNotes && rxNotes[0].note == 0 && rxNotes[nRxNotes - 1].note == fifoNotes - 1,
+        "the newest notes are dropped");
+    check(cable0->rxDroppedMessages.get() == 2 && cable0->rxDroppedBytes.get() == 6, "drops are whole messages");
+    check(cable0->rxHighWaterBytes.get() == fifoNotes * 3, "the high-water mark shows how full the FIFO got");
+
+    // Dropping the oldest notes keeps the newest
+    nRxNotes = 0;
+    check(usbhMIDI.setInOverflowPolicy(testDevAddr, 0, InOverflowDropOldest), "set a policy");
+    sendNotesUntilIdle(0, fifoNotes + 2);
+    readAllUntilIdle();
+    check(nRxNotes == fifoNotes && rxNotes[0].note == 2 && rxNotes[nRxNotes - 1].note == fifoNotes + 1,
+        "the oldest notes are dropped");
+
+    // Real-time messages make room; other messages do not
+    nRxNotes = 0;
+    usbhMIDI.setInOverflowPolicy(testDevAddr, 0, InOverflowRealTimeOverwrites);
+    sendNotesUntilIdle(0, fifoNotes + 1);
+    const uint8_t clock[4] = {0x0F, 0xF8, 0, 0};
+    sim_usb_midi_host_send_to_host(testDevAddr, clock, 1);
+    tuh_task();
+    readAllUntilIdle();
+    check(nRxNotes == fifoNotes - 1 && rxNotes[0].note == 1 && rxNotes[nRxNotes - 1].note == fifoNotes - 1,
+        "a clock drops the oldest note; a note that does not fit drops itself");
+    check(cable0->rxDroppedMessages.get() == 6, "every drop is counted");
+
+    // Once part of a SysEx message is dropped, the rest of it is too
+    nRxNotes = 0;
+    usbhMIDI.setInOverflowPolicy(testDevAddr, 0, InOverflowDropNewest);
+    sendNotesUntilIdle(0, fifoNotes - 1); // room for one packet
+    const uint8_t sysex[3][4] = {{0x04, 0xF0, 0x01, 0x02}, {0x04, 0x03, 0x04, 0x05}, {0x06, 0x06, 0xF7, 0}};
+    for (unsigned idx = 0; idx < 3; idx++) {
+        sim_usb_midi_host_send_to_host(testDevAddr, sysex[idx], 1);
+        tuh_task();
+        if (idx == 1)
+            readAllUntilIdle();
+    }
+    sendNotesUntilIdle(100, 1);
+    readAllUntilIdle();
+    check(cable0->rxDroppedMessages.get() == 8 && cable0->rxDroppedBytes.get() == 6 + 6 + 3 + 3 + 3 + 2,
+        "a SysEx message is not finished after its middle was dropped");
+    check(nRxNotes == fifoNotes && rxNotes[nRxNotes - 1].note == 100, "the next message gets through");
+
+    endTest();
+    startTest(1);
+    check(usbhMIDI.getDevFromDevAddr(testDevAddr) != nullptr &&
+        usbhMIDI.getCableCounters(testDevAddr, 0)->rxHighWaterBytes.get() == 0, "connecting a device clears the high-water mark");
+    endTest();
+}
+
+static bool isTxPacket(unsigned idx, uint8_t status, uint8_t data1, uint8_t data2)
+{
+    const uint8_t* packet = txPackets[idx].packet;
+    return idx < nTxPackets && packet[1] == status && packet[2] == data1 && packet[3] == data2;
+}
+
+static uint32_t slowHandlerTime;
+
+static void onMessageSlowly(uint8_t, uint8_t, uint32_t, const EZ_USB_MIDI_HOST_Message&)
+{
+    // each message takes the application 100us to handle
+    slowHandlerTime += 100;
+    sim_usb_midi_host_set_time_us(slowHandlerTime);
+}
+
+static void testReadAllDrain()
+{
+    startTest(2);
+    sendNotesUntilIdle(0, 20);
+    sendNoteOn(testDevAddr, 1, 20);
+    sendNoteOn(testDevAddr, 1, 21);
+    tuh_task();
+    check(usbhMIDI.readAllDrain(0) == 0 && nRxNotes == 22, "one call delivers every message");
+
+    // A message budget leaves the rest in the MIDI IN FIFOs
+    nRxNotes = 0;
+    sendNotesUntilIdle(0, 10);
+    check(usbhMIDI.readAllDrain(4) == 6 * 3 && nRxNotes == 4, "the message budget limits one call");
+    check(usbhMIDI.readAllDrain(4) == 2 * 3 && nRxNotes == 8, "the next call continues where the last stopped");
+    check(usbhMIDI.readAllDrain(0) == 0 && nRxNotes == 10 && rxNotes[9].note == 9, "messages stay in order");
+
+    // A time budget stops after the first message that ends past it
+    nRxNotes = 0;
+    slowHandlerTime = 1000;
+    sim_usb_midi_host_set_time_us(slowHandlerTime);
+    usbhMIDI.setAppOnMessage(onMessageSlowly);
+    sendNotesUntilIdle(0, 10);
+    check(usbhMIDI.readAllDrain(0, 250) == 7 * 3 && nRxNotes == 3, "the time budget limits one call");
+    check(usbhMIDI.readAllDrain(100, 1000) == 0 && nRxNotes == 10, "the smaller budget wins");
+    usbhMIDI.unsetAppOnMessage();
+
+    // The time budget also stops bytes that do not finish a message
+    static const uint8_t sysexStart[4] = {0x04, 0xF0, 0x01, 0x02};
+    static const uint8_t sysexMore[4] = {0x04, 0x03, 0x04, 0x05};
+    static const uint8_t sysexEnd[4] = {0x05, 0xF7, 0, 0};
+    sim_usb_midi_host_send_to_host(testDevAddr, sysexStart, 1);
+    for (unsigned idx = 0; idx < 9; idx++)
+        sim_usb_midi_host_send_to_host(testDevAddr, sysexMore, 1);
+    tuh_task();
+    sim_usb_midi_host_set_time_step_us(10);
+    uint32_t left = usbhMIDI.readAllDrain(0, 50);
+    sim_usb_midi_host_set_time_step_us(0);
+    check(left != 0 && left < 30, "the time budget stops in the middle of a message");
+    sim_usb_midi_host_send_to_host(testDevAddr, sysexEnd, 1);
+    tuh_task();
+    check(usbhMIDI.readAllDrain(0) == 0, "the next call finishes the message");
+    sim_usb_midi_host_set_time_us(0);
+
+    // One busy device does not keep another waiting
+    sim_usb_midi_host_plug(2, 1, 1, 0xcafe, 0x4002, "rppicomidi", "second device", nullptr);
+    tuh_task();
+    nRxNotes = 0;
+    sendNotesUntilIdle(0, 10);
+    sendNoteOn(2, 0, 40);
+    tuh_task();
+    usbhMIDI.readAllDrain(4);
+    usbhMIDI.readAllDrain(4);
+    bool secondDeviceRead = false;
+    for (unsigned idx = 0; idx < nRxNotes; idx++)
+        secondDeviceRead = secondDeviceRead || rxNotes[idx].devAddr == 2;
+    check(nRxNotes == 8 && secondDeviceRead, "the budget is shared by all devices");
+    check(usbhMIDI.readAllDrain(0) == 0 && nRxNotes == 11, "draining reads every device");
+    sim_usb_midi_host_unplug(2);
+    tuh_task();
+    endTest();
+}
+
+static void onRxPacketsSlowly(uint8_t, const uint8_t*, uint32_t, uint32_t)
+{
+    // tuh_task() calls this; it takes 500us
+    slowHandlerTime += 500;
+    sim_usb_midi_host_set_time_us(slowHandlerTime);
+}
+
+static void testService()
+{
+    startTest(1);
+    auto intf = usbhMIDI.getInterfaceFromDeviceAndCable(testDevAddr, 0);
+    for (uint8_t note = 0; note < 5; note++)
+        sendNoteOn(testDevAddr, 0, note);
+    intf->sendNoteOn(60, 100, 1);
+    auto report = usbhMIDI.service(1000);
+    check(nRxNotes == 5 && report.rxBytesPending == 0 && report.skippedPhases == 0 && !report.overran,
+        "service() polls the USB host and reads every message when there is time");
+    tuh_task();
+    check(sim_usb_midi_host_get_tx_packets(testDevAddr) == 1, "service() sends MIDI OUT");
+
+    // A slow MIDI IN callback uses up the time; reading stops at the deadline
+    nRxNotes = 0;
+    slowHandlerTime = 1000;
+    sim_usb_midi_host_set_time_us(slowHandlerTime);
+    usbhMIDI.setAppOnMessage(onMessageSlowly);
+    sendNotesUntilIdle(0, 10);
+    report = usbhMIDI.service(1350);
+    check(nRxNotes == 4 && report.rxBytesPending == 6 * 3 && report.phaseUs[ServiceRx] == 400, "reading stops at the deadline");
+    check(report.getBusiestPhase() == ServiceRx && report.overran && (report.skippedPhases & (1 << ServiceTx)) != 0,
+        "the report blames the MIDI IN phase and the last flush waits");
+    report = usbhMIDI.service(slowHandlerTime + 10000);
+    check(nRxNotes == 10 && report.rxBytesPending == 0, "the next call reads the rest");
+    usbhMIDI.unsetAppOnMessage();
+
+    // A phase that does not fit before the deadline waits for the next call
+    usbhMIDI.setAppOnRxPackets(onRxPacketsSlowly);
+    sendNoteOn(testDevAddr, 0, 70);
+    report = usbhMIDI.service(slowHandlerTime + 10000);
+    check(report.phaseUs[ServiceUsb] == 500 && report.getBusiestPhase() == ServiceUsb, "the report blames the USB host phase");
+    sendNoteOn(testDevAddr, 0, 71);
+    report = usbhMIDI.service(slowHandlerTime + 300);
+    check(report.skippedPhases == (1 << ServiceUsb) && !report.overran, "the USB host phase is skipped if it will not fit");
+    report = usbhMIDI.service(slowHandlerTime + 10000);
+    check(report.phaseUs[ServiceUsb] == 500, "the next call runs it");
+
+    // A slice shorter than the last run still polls the USB host within a few calls
+    unsigned nUsbRuns = 0;
+    unsigned nCalls = 0;
+    for (; nCalls < 8 && nUsbRuns == 0; nCalls++) {
+        sendNoteOn(testDevAddr, 0, 72);
+        report = usbhMIDI.service(slowHandlerTime + 300);
+        if ((report.skippedPhases & (1 << ServiceUsb)) == 0)
+            ++nUsbRuns;
+    }
+    check(nUsbRuns == 1 && nCalls == 2, "a skipped phase runs again in a short time slice");
+    for (unsigned idx = 0; idx < 8; idx++) {
+        sendNoteOn(testDevAddr, 0, 73);
+        report = usbhMIDI.service(slowHandlerTime + 300);
+        if ((report.skippedPhases & (1 << ServiceUsb)) == 0)
+            ++nUsbRuns;
+    }
+    check(nUsbRuns == 5, "the USB host keeps being polled while every run overruns the slice");
+    report = usbhMIDI.service(slowHandlerTime - 1);
+    check(report.skippedPhases == ((1 << ServiceUsb) | (1 << ServiceTx) | (1 << ServiceRx)) && report.overran,
+        "nothing runs after the deadline");
+    usbhMIDI.unsetAppOnRxPackets();
+    sim_usb_midi_host_set_time_us(0);
+    endTest();
+}
+
+static void testTxCoalescing()
+{
+    startTest(1);
+    auto intf = usbhMIDI.getInterfaceFromDeviceAndCable(testDevAddr, 0);
+    auto cable0 = usbhMIDI.getCableCounters(testDevAddr, 0);
+    nTxPackets = 0;
+    sim_usb_midi_host_set_tx_sink(onTxPacket, nullptr);
+
+    // A fader move: only the last value before the Note On goes out, and it goes first
+    for (uint8_t value = 0; value < 50; value++)
+        intf->sendControlChange(7, value, 1);
+    intf->sendNoteOn(60, 0x7f, 1);
+    intf->sendControlChange(7, 100, 1);
+    intf->sendControlChange(10, 5, 1);
+    intf->sendPitchBend(0, 2);
+    intf->sendControlChange(7, 101, 1);
+    intf->sendPitchBend(100, 2);
+    usbhMIDI.writeFlushAll();
+    tuh_task();
+    check(nTxPackets == 5 && isTxPacket(0, 0xB0, 7, 49) && isTxPacket(1, 0x90, 60, 0x7f) && isTxPacket(2, 0xB0, 7, 101) &&
+        isTxPacket(3, 0xB0, 10, 5) && isTxPacket(4, 0xE1, 100, 0x40), "newer values replace waiting ones in place");
+    check(cable0->txCoalescedMessages.get() == 51 && cable0->txBytes.get() == 15, "replaced messages are counted");
+
+    // While the last batch waits for the bus, newer values keep replacing each other
+    nTxPackets = 0;
+    intf->sendControlChange(1, 1, 1);
+    usbhMIDI.writeFlushAll();       // starts a transfer with value 1
+    intf->sendControlChange(1, 2, 1);
+    usbhMIDI.writeFlushAll();       // the bus is busy; value 2 waits in the transmit FIFO
+    intf->sendControlChange(1, 3, 1);
+    usbhMIDI.writeFlushAll();
+    intf->sendControlChange(1, 4, 1);
+    while (sim_usb_midi_host_busy() || usbhMIDI.getCableCounters(testDevAddr, 0)->txBytes.get() < 24) {
+        usbhMIDI.writeFlushAll();
+        tuh_task();
+    }
+    check(nTxPackets == 3 && isTxPacket(0, 0xB0, 1, 1) && isTxPacket(1, 0xB0, 1, 2) && isTxPacket(2, 0xB0, 1, 4),
+        "at most one batch waits in the transmit FIFO");
+
+    // Data entry depends on the (N)RPN number sent before it, so it is never coalesced
+    nTxPackets = 0;
+    intf->sendControlChange(101, 0, 1);
+    intf->sendControlChange(100, 0, 1);
+    intf->sendControlChange(6, 2, 1);
+    intf->sendControlChange(6, 3, 1);
+    usbhMIDI.writeFlushAll();
+    tuh_task();
+    check(nTxPackets == 4 && isTxPacket(3, 0xB0, 6, 3), "data entry is never coalesced");
+    sim_usb_midi_host_set_tx_sink(nullptr, nullptr);
+    endTest();
+}
+
+static uint8_t sysexPayload[128];
+static uint16_t nSysexPayload;
+static uint8_t sysexMarkers[8];
+static unsigned nSysexChunks;
+static bool sysexChunkTooLong;
+
+static void onSysExChunk(uint8_t devAddr, uint8_t cable, const uint8_t* payload, uint16_t nBytes, uint8_t markers)
+{
+    if (devAddr != testDevAddr || cable != 1 || nBytes > EZ_USB_MIDI_HOST_SysExChunker::chunkSize ||
+            nSysexPayload + nBytes > sizeof(sysexPayload)) {
+        sysexChunkTooLong = true;
+        return;
+    }
+    memcpy(sysexPayload + nSysexPayload, payload, nBytes);
+    nSysexPayload += nBytes;
+    if (nSysexChunks < sizeof(sysexMarkers))
+        sysexMarkers[nSysexChunks] = markers;
+    ++nSysexChunks;
+}
+
+static void testSysExChunks()
+{
+    startTest(2);
+    usbhMIDI.setAppOnSysExChunk(onSysExChunk);
+    nSysexPayload = 0;
+    nSysexChunks = 0;
+    sysexChunkTooLong = false;
+
+    // F0, 100 payload bytes, F7 on cable 1: 34 packets in three bulk transfers
+    uint8_t packets[34][4];
+    uint8_t payload = 0;
+    packets[0][0] = 0x14;
+    packets[0][1] = 0xF0;
+    packets[0][2] = payload++;
+    packets[0][3] = payload++;
+    for (unsigned idx = 1; idx < 33; idx++) {
+        packets[idx][0] = 0x14;
+        for (unsigned byte = 1; byte < 4; byte++)
+            packets[idx][byte] = payload++;
+    }
+    packets[33][0] = 0x17;
+    packets[33][1] = payload++;
+    packets[33][2] = payload++;
+    packets[33][3] = 0xF7;
+    sim_usb_midi_host_send_to_host(testDevAddr, packets[0], 34);
+    sendNoteOn(testDevAddr, 1, 60);
+    while (sim_usb_midi_host_busy())
+        tuh_task();
+    bool inOrder = nSysexPayload == 100;
+    for (uint8_t idx = 0; idx < nSysexPayload; idx++)
+        inOrder = inOrder && sysexPayload[idx] == idx;
+    check(inOrder && !sysexChunkTooLong, "the payload arrives in order in chunks");
+    check(nSysexChunks == 3 && sysexMarkers[0] == EZ_USB_MIDI_HOST_SysExChunker::Start && sysexMarkers[1] == 0 &&
+        sysexMarkers[2] == EZ_USB_MIDI_HOST_SysExChunker::End, "chunks carry start, continue and end markers");
+    check(usbhMIDI.getCableCounters(testDevAddr, 1)->rxBytes.get() == 3, "SysEx bytes never reach the MIDI IN FIFO");
+    readAllUntilIdle();
+    check(nRxNotes == 1 && rxNotes[0].note == 60, "other messages still reach the MIDI Library");
+
+    // A Note On in the middle of a SysEx message ends it
+    nSysexChunks = 0;
+    nSysexPayload = 0;
+    sim_usb_midi_host_send_to_host(testDevAddr, packets[0], 2);
+    sendNoteOn(testDevAddr, 1, 61);
+    tuh_task();
+    check(nSysexChunks == 1 && nSysexPayload == 5 && sysexMarkers[0] == (EZ_USB_MIDI_HOST_SysExChunker::Start |
+        EZ_USB_MIDI_HOST_SysExChunker::End | EZ_USB_MIDI_HOST_SysExChunker::Abort), "an interrupted message ends with the abort marker");
+    usbhMIDI.unsetAppOnSysExChunk();
+    endTest();
+}
+
+static uint8_t txSysex[1100];
+static unsigned nTxSysex;
+static unsigned nTxClocks;
+static uint32_t sysexProgressSent;
+static EZ_USB_MIDI_HOST_SysExStatus sysexProgressStatus;
+static unsigned nSysexProgress;
+
+static unsigned nTxOtherPackets;
+static unsigned txClockPosition; //!< the number of other packets before the last clock
+
+static void onTxSysExPacket(uint8_t, const uint8_t packet[4], void*)
+{
+    if (packet[1] == 0xF8) {
+        ++nTxClocks;
+        txClockPosition = nTxOtherPackets;
+        return;
+    }
+    ++nTxOtherPackets;
+    for (uint8_t idx = 0; idx < EZ_USB_MIDI_HOST_Packet::getMidiLength(packet) && nTxSysex < sizeof(txSysex); idx++)
+        txSysex[nTxSysex++] = packet[1 + idx];
+}
+
+static void onSysExProgress(uint8_t devAddr, uint8_t cable, uint32_t nSent, EZ_USB_MIDI_HOST_SysExStatus status, void* context)
+{
+    if (devAddr == testDevAddr && cable == 0 && context == &nSysexProgress) {
+        sysexProgressSent = nSent;
+        sysexProgressStatus = status;
+        ++nSysexProgress;
+    }
+}
+
+static uint16_t generateSysEx(uint8_t* buffer, uint16_t maxBytes, void* context)
+{
+    unsigned* nLeft = static_cast<unsigned*>(context);
+    uint16_t nBytes = 0;
+    while (nBytes < maxBytes && nBytes < 7 && *nLeft != 0) {
+        buffer[nBytes++] = *nLeft & 0x7f;
+        --*nLeft;
+    }
+    return nBytes;
+}
+
+static void startBulkSysExCapture()
+{
+    nTxSysex = 0;
+    nTxClocks = 0;
+    nTxOtherPackets = 0;
+    nSysexProgress = 0;
+    sim_usb_midi_host_set_tx_sink(onTxSysExPacket, nullptr);
+}
+
+static void flushUntilIdle(EZ_USB_MIDI_HOST_Device<TestSettings>* dev)
+{
+    while (dev->isSendingSysEx() || sim_usb_midi_host_busy()) {
+        usbhMIDI.writeFlushAll();
+        tuh_task();
+    }
+}
+
+// A transport stages each MIDI Library message and writes it to
+// the stream in one driver call
+static void testStagedWrites()
+{
+    startTest(1);
+    auto dev = usbhMIDI.getDevFromDevAddr(testDevAddr);
+    EZ_USB_MIDI_HOST_Transport<TestSettings> transport;
+    transport.setConfiguration(testDevAddr, 0, true, true);
+    auto& counters = transport.getCounters();
+
+    // One message, one tuh_midi_stream_write()
+    uint64_t nWrites = sim_usb_midi_host_get_stream_writes(testDevAddr);
+    static const uint8_t noteOn[3] = {0x90, 60, 0x7f};
+    check(transport.beginTransmission(0x90), "a message starts");
+    for (uint8_t byte : noteOn)
+        transport.write(byte);
+    check(sim_usb_midi_host_get_stream_writes(testDevAddr) == nWrites, "nothing is written before endTransmission()");
+    transport.endTransmission();
+    check(sim_usb_midi_host_get_stream_writes(testDevAddr) == nWrites + 1 && !transport.outOverflow() &&
+        counters.txBytes.get() == 3, "endTransmission() writes the message in one driver call");
+    flushUntilIdle(dev);
+
+    // A SysEx message longer than the 48 byte staging buffer goes out in
+    // chunks that end on a packet boundary
+    startBulkSysExCapture();
+    nWrites = sim_usb_midi_host_get_stream_writes(testDevAddr);
+    check(transport.beginTransmission(0xF0), "a SysEx message starts");
+    transport.write(0xF0);
+    for (uint8_t idx = 0; idx < 100; idx++) {
+        transport.write(idx);
+        if (idx == 47)
+            check(tuh_midi_stream_flush(testDevAddr) == 16 * 4, "the first chunk is whole packets");
+    }
+    transport.write(0xF7);
+    transport.endTransmission();
+    check(sim_usb_midi_host_get_stream_writes(testDevAddr) == nWrites + 3, "102 bytes take three driver calls");
+    flushUntilIdle(dev);
+    bool same = nTxSysex == 102 && txSysex[0] == 0xF0 && txSysex[101] == 0xF7;
+    for (unsigned idx = 0; same && idx < 100; idx++)
+        same = txSysex[idx + 1] == idx;
+    check(same && nTxOtherPackets == 34, "the chunks join into one message of full packets");
+    sim_usb_midi_host_set_tx_sink(nullptr, nullptr);
+
+    // The overflow flag covers the whole message: fill the driver transmit
+    // FIFO to one packet short, then write a message that takes two
+    unsigned nFit = 0;
+    while (tuh_midi_can_write_stream(testDevAddr)) {
+        transport.beginTransmission(0x90);
+        for (uint8_t byte : noteOn)
+            transport.write(byte);
+        transport.endTransmission();
+        ++nFit;
+    }
+    flushUntilIdle(dev);
+    for (unsigned idx = 1; idx < nFit; idx++) {
+        transport.beginTransmission(0x90);
+        for (uint8_t byte : noteOn)
+            transport.write(byte);
+        transport.endTransmission();
+    }
+    static const uint8_t sysex[6] = {0xF0, 1, 2, 3, 4, 0xF7};
+    uint32_t rejectedBefore = counters.txRejectedBytes.get();
+    check(transport.beginTransmission(0xF0), "one packet of room starts a message");
+    for (uint8_t byte : sysex)
+        transport.write(byte);
+    transport.endTransmission();
+    check(transport.outOverflow() && counters.txRejectedBytes.get() - rejectedBefore == 3,
+        "a message that does not fit sets the overflow flag");
+    flushUntilIdle(dev);
+    transport.beginTransmission(0x90);
+    for (uint8_t byte : noteOn)
+        transport.write(byte);
+    transport.endTransmission();
+    check(!transport.outOverflow(), "the next message that fits clears it");
+    endTest();
+}
+
+static void testBulkSysEx()
+{
+    startTest(1);
+    auto dev = usbhMIDI.getDevFromDevAddr(testDevAddr);
+    auto intf = usbhMIDI.getInterfaceFromDeviceAndCable(testDevAddr, 0);
+    static uint8_t payload[1000];
+    for (unsigned idx = 0; idx < sizeof(payload); idx++)
+        payload[idx] = idx & 0x7f;
+
+    // A message 6 times longer than the driver transmit FIFO
+    startBulkSysExCapture();
+    check(!dev->sendSysEx(1, payload, sizeof(payload)), "no SysEx to a missing cable");
+    check(dev->sendSysEx(0, payload, sizeof(payload), onSysExProgress, &nSysexProgress) &&
+        !dev->sendSysEx(0, payload, sizeof(payload)), "one SysEx message at a time");
+    usbhMIDI.writeFlushAll();
+    intf->sendNoteOn(60, 0x7f, 1);
+    intf->sendRealTime(MIDI_NAMESPACE::Clock);
+    flushUntilIdle(dev);
+    bool same = nTxSysex == sizeof(payload) + 2 && txSysex[0] == 0xF0 && txSysex[nTxSysex - 1] == 0xF7;
+    for (unsigned idx = 0; same && idx < sizeof(payload); idx++)
+        same = txSysex[idx + 1] == payload[idx];
+    check(same, "the whole message goes out");
+    check(nSysexProgress > 2 && sysexProgressStatus == SysExDone && sysexProgressSent == sizeof(payload),
+        "progress is reported until the message is done");
+    check(nTxClocks == 1 && usbhMIDI.getCableCounters(testDevAddr, 0)->txRejectedMessages.get() == 1,
+        "only real-time messages may cut into the message");
+
+    // A generator supplies the payload
+    startBulkSysExCapture();
+    unsigned nLeft = 200;
+    check(dev->sendSysEx(0, generateSysEx, onSysExProgress, &nLeft) && dev->isSendingSysEx(), "start a generated message");
+    flushUntilIdle(dev);
+    check(nTxSysex == 202 && txSysex[1] == (200 & 0x7f) && txSysex[201] == 0xF7, "a generator supplies the payload");
+
+    // Unplugging the device aborts the message
+    startBulkSysExCapture();
+    dev->sendSysEx(0, payload, sizeof(payload), onSysExProgress, &nSysexProgress);
+    usbhMIDI.writeFlushAll();
+    sim_usb_midi_host_set_tx_sink(nullptr, nullptr);
+    endTest();
+    check(sysexProgressStatus == SysExAborted && sysexProgressSent == 47, "disconnecting aborts the message");
+}
+
+static void testPriorityLane()
+{
+    startTest(2);
+    auto dev = usbhMIDI.getDevFromDevAddr(testDevAddr);
+    auto intf = usbhMIDI.getInterfaceFromDeviceAndCable(testDevAddr, 1);
+    auto cable1 = usbhMIDI.getCableCounters(testDevAddr, 1);
+    startBulkSysExCapture();
+
+    // The driver transmit FIFO holds 44 packets; the clock still gets in
+    for (uint8_t note = 0; note < 50; note++)
+        intf->sendNoteOn(note, 0x7f, 1);
+    intf->sendRealTime(MIDI_NAMESPACE::Clock);
+    check(cable1->txRejectedMessages.get() == 6 && cable1->txBytes.get() == 44 * 3 + 1,
+        "real-time messages do not need room in the transmit FIFO");
+    // Cable 0 starts a bulk message; the clock goes ahead of its first part
+    static const uint8_t payload[100] = {0};
+    dev->sendSysEx(0, payload, sizeof(payload));
+    flushUntilIdle(dev);
+    check(nTxClocks == 1 && txClockPosition == 44, "the clock goes out ahead of everything not yet in the FIFO");
+    sim_usb_midi_host_set_tx_sink(nullptr, nullptr);
+
+    // A device whose transmit FIFO is full does not hold up another device's lane
+    const uint8_t otherDevAddr = 2;
+    sim_usb_midi_host_plug(otherDevAddr, 1, 1, 0xcafe, 0x4002, nullptr, nullptr, nullptr);
+    tuh_task();
+    auto counters = usbhMIDI.getDeviceCounters(testDevAddr);
+    uint32_t txPacketsBefore = counters->txPackets.get();
+    for (uint8_t note = 0; note < 44; note++)
+        intf->sendNoteOn(note, 0x7f, 1);
+    intf->sendRealTime(MIDI_NAMESPACE::Clock);
+    usbhMIDI.getInterfaceFromDeviceAndCable(otherDevAddr, 0)->sendRealTime(MIDI_NAMESPACE::Clock);
+    usbhMIDI.writeFlushAll();
+    check(usbhMIDI.getDeviceCounters(otherDevAddr)->txPackets.get() == 1, "each device has its own priority lane");
+    flushUntilIdle(dev);
+    check(counters->txPackets.get() - txPacketsBefore == 44 + 1, "the full device's clock waits for room");
+    sim_usb_midi_host_unplug(otherDevAddr);
+    endTest();
+}
+
+struct PriorityNotesSettings : public TestSettings
+{
+    static const bool TxPriorityNotes = true;
+};
+
+// A note on the priority lane must not pass a pitch bend or
+// controller value the coalescer is still holding for the same cable
+static void testPriorityNotesAfterCoalesced()
+{
+    startTest(1);
+    auto dev = usbhMIDI.getDevFromDevAddr(testDevAddr);
+    EZ_USB_MIDI_HOST_Transport<PriorityNotesSettings> transport;
+    EZ_USB_MIDI_HOST_Transport<PriorityNotesSettings>::PriorityLane lane;
+    transport.setConfiguration(testDevAddr, 0, true, true);
+    transport.setPriorityLane(&lane);
+    static const uint8_t pitchBend[3] = {0xE0, 0x00, 0x50};
+    static const uint8_t noteOn[3] = {0x90, 60, 0x7f};
+
+    transport.beginTransmission(0xE0);
+    for (uint8_t byte : pitchBend)
+        transport.write(byte);
+    transport.endTransmission();
+    transport.beginTransmission(0x90);
+    for (uint8_t byte : noteOn)
+        transport.write(byte);
+    transport.endTransmission();
+    check(lane.count() == 0, "a note waits behind a coalesced pitch bend");
+    nTxPackets = 0;
+    sim_usb_midi_host_set_tx_sink(onTxPacket, nullptr);
+    flushUntilIdle(dev);
+    sim_usb_midi_host_set_tx_sink(nullptr, nullptr);
+    check(nTxPackets == 2 && txPackets[0].packet[1] == 0xE0 && txPackets[1].packet[1] == 0x90,
+        "the pitch bend goes out first");
+
+    // With nothing coalesced, the note takes the lane
+    transport.beginTransmission(0x90);
+    for (uint8_t byte : noteOn)
+        transport.write(byte);
+    transport.endTransmission();
+    check(lane.count() == 1, "a note takes the lane when nothing waits");
+    endTest();
+}
+
+static void sendRealTime(uint8_t status, uint32_t timeUs)
+{
+    uint8_t packet[4] = {0x0F, status, 0, 0};
+    sim_usb_midi_host_set_time_us(timeUs);
+    sim_usb_midi_host_send_to_host(testDevAddr, packet, 1);
+    tuh_task();
+}
+
+static void testRxClockAnalysis()
+{
+    startTest(1);
+    const uint32_t interval = 20833; // 120 BPM
+    uint32_t now = 1000;
+    for (unsigned idx = 0; idx < 10; idx++, now += interval)
+        sendRealTime(0xF8, now);
+    auto clock = usbhMIDI.getRxClock(testDevAddr, 0);
+    check(clock != nullptr && usbhMIDI.getRxClock(testDevAddr, 1) == nullptr, "one clock analyzer per MIDI IN cable");
+    check(clock->hasTempo() && clock->getBpmX100() == 12000 && clock->getIntervalUs() == interval, "steady clocks give the tempo");
+    check(clock->getLastJitterUs() == 0 && clock->getDropCount() == 0 && clock->getBurstCount() == 0, "steady clocks have no jitter");
+
+    // The analyzer sees clocks at arrival, even if nothing reads them or a filter drops them
+    usbhMIDI.setInFilter(testDevAddr, 0, EZ_USB_MIDI_HOST_Packet::Clock, 0);
+    sendRealTime(0xF8, now + 400);
+    check(clock->getClockCount() == 11 && clock->getLastJitterUs() == 400, "a late clock shows its jitter");
+    now += interval;
+    sendRealTime(0xF8, now);
+    check(clock->getLastJitterUs() < 0 && clock->getMaxJitterUs() >= 400, "the next clock makes up for it");
+    now += 2 * interval;
+    sendRealTime(0xF8, now);
+    now += interval;
+    sendRealTime(0xF8, now);
+    check(clock->getDropCount() == 1 && clock->getLastJitterUs() > -100 && clock->getLastJitterUs() < 100,
+        "a missing clock counts as a drop");
+    sendRealTime(0xF8, now + 100);
+    check(clock->getBurstCount() == 1, "an extra clock counts as a burst");
+    now += interval;
+    sendRealTime(0xF8, now);
+    check(clock->getBurstCount() == 1 && clock->getLastClockUs() == now, "the clock after a burst is on time");
+    // A late clock arriving with the next one is a burst, not a drop
+    now += 2 * interval;
+    sendRealTime(0xF8, now);
+    sendRealTime(0xF8, now);
+    now += interval;
+    sendRealTime(0xF8, now);
+    check(clock->getDropCount() == 1 && clock->getBurstCount() == 2, "a late clock is not a drop");
+    usbhMIDI.setInFilter(testDevAddr, 0, 0, 0);
+
+    // Stop pauses the clock without counting drops
+    sendRealTime(0xFC, now + 100);
+    now += 100 * interval;
+    sendRealTime(0xFA, now);
+    sendRealTime(0xF8, now);
+    now += interval;
+    sendRealTime(0xF8, now);
+    check(clock->getDropCount() == 1 && clock->getBpmX100() >= 11990 && clock->getBpmX100() <= 12010,
+        "stopping keeps the tempo");
+
+    // A new tempo takes over after a few clocks
+    for (unsigned idx = 0; idx < 40; idx++) {
+        now += interval / 2;
+        sendRealTime(0xF8, now);
+    }
+    check(clock->getBpmX100() >= 23990 && clock->getBpmX100() <= 24010, "the analyzer follows a tempo change");
+    readAllUntilIdle();
+    usbhMIDI.resetRxClock(testDevAddr);
+    check(!clock->hasTempo() && clock->getClockCount() == 0, "reset clears the analyzer");
+
+    // A clock that pauses for minutes without a Stop restarts the timing
+    // instead of overflowing the tempo
+    EZ_USB_MIDI_HOST_ClockAnalyzer analyzer;
+    analyzer.onClock(0);
+    analyzer.onClock(150000000);
+    check(!analyzer.hasTempo(), "a pause of minutes sets no tempo");
+    now = 300000000;
+    for (unsigned idx = 0; idx < 10; idx++, now += interval)
+        analyzer.onClock(now);
+    check(analyzer.getBpmX100() >= 11990 && analyzer.getBpmX100() <= 12010, "the clock after a pause sets the tempo");
+    now += 200000000;
+    analyzer.onClock(now);
+    analyzer.onClock(now + interval);
+    check(analyzer.getBpmX100() >= 11990 && analyzer.getBpmX100() <= 12010 && analyzer.getDropCount() == 0,
+        "a long pause keeps the tempo");
+    endTest();
+}
+
+int main()
+{
+    usbhMIDI.setAppOnStringsReady(onStringsReady);
+    check(usbhMIDI.begin(0, onConnect, onDisconnect), "begin() registers the object");
+    testRxTimestamps();
+    testRawPackets();
+    testMessageAvailable();
+    testMessageCallback();
+    testLatencyHistograms();
+    testCounters();
+    testInterfacePool();
+    testStrings();
+    testStringArena();
+    testDeviceAddresses();
+    testRootPorts();
+    testRoutes();
+    testInFilters();
+    testInOverflowPolicies();
+    testReadAllDrain();
+    testService();
+    testTxCoalescing();
+    testSysExChunks();
+    testStagedWrites();
+    testBulkSysEx();
+    testPriorityLane();
+    testPriorityNotesAfterCoalesced();
+    testRxClockAnalysis();
+    printf("%s\r\n", failures == 0 ? "PASS" : "FAIL");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,136 @@
+/*
+ * @file tusb.h
+ * @brief Linux stand-in for the parts of the TinyUSB host API that the
+ *        EZ_USB_MIDI_HOST library and the usb_midi_host application driver use
+ *
+ * This file is only used by the host_sim build. It lets the library
+ * compile and run on a Linux PC so that the receive, transmit and
+ * hot-plug paths can be profiled without an RP2040. Only the functions
+ * and types the library actually references are provided.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/// max device support (excluding hub device); the host_sim CMakeLists.txt
+/// normally sets this so the benchmark can exercise large device counts
+#ifndef CFG_TUH_DEVICE_MAX
+#define CFG_TUH_DEVICE_MAX 4
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+  XFER_RESULT_SUCCESS = 0,
+  XFER_RESULT_FAILED,
+  XFER_RESULT_STALLED,
+  XFER_RESULT_TIMEOUT,
+  XFER_RESULT_INVALID
+} xfer_result_t;
+
+//--------------------------------------------------------------------+
+// Descriptors and transfers
+//--------------------------------------------------------------------+
+typedef struct __attribute__((packed)) {
+  uint8_t  bLength;
+  uint8_t  bDescriptorType;
+  uint16_t bcdUSB;
+  uint8_t  bDeviceClass;
+  uint8_t  bDeviceSubClass;
+  uint8_t  bDeviceProtocol;
+  uint8_t  bMaxPacketSize0;
+  uint16_t idVendor;
+  uint16_t idProduct;
+  uint16_t bcdDevice;
+  uint8_t  iManufacturer;
+  uint8_t  iProduct;
+  uint8_t  iSerialNumber;
+  uint8_t  bNumConfigurations;
+} tusb_desc_device_t;
+
+typedef struct tuh_xfer_s tuh_xfer_t;
+typedef void (*tuh_xfer_cb_t)(tuh_xfer_t* xfer);
+
+struct tuh_xfer_s {
+  uint8_t daddr;
+  uint8_t ep_addr;
+  xfer_result_t result;
+  uint32_t actual_len;
+  uint32_t buflen;
+  uint8_t* buffer;
+  tuh_xfer_cb_t complete_cb;
+  uintptr_t user_data;
+};
+
+//--------------------------------------------------------------------+
+// FIFO
+//--------------------------------------------------------------------+
+typedef struct {
+  uint8_t* buffer;       //!< buffer pointer
+  uint16_t depth;        //!< max items
+  uint16_t item_size;    //!< size of each item in bytes
+  bool overwritable;     //!< overwrite the oldest item when full
+  uint16_t rd_idx;       //!< read index in the range [0, 2*depth)
+  uint16_t wr_idx;       //!< write index in the range [0, 2*depth)
+} tu_fifo_t;
+
+bool tu_fifo_config(tu_fifo_t* f, void* buffer, uint16_t depth, uint16_t item_size, bool overwritable);
+bool tu_fifo_clear(tu_fifo_t* f);
+uint16_t tu_fifo_count(tu_fifo_t* f);
+uint16_t tu_fifo_remaining(tu_fifo_t* f);
+bool tu_fifo_empty(tu_fifo_t* f);
+bool tu_fifo_full(tu_fifo_t* f);
+bool tu_fifo_peek(tu_fifo_t* f, void* p_buffer);
+bool tu_fifo_read(tu_fifo_t* f, void* p_buffer);
+uint16_t tu_fifo_read_n(tu_fifo_t* f, void* p_buffer, uint16_t n);
+bool tu_fifo_write(tu_fifo_t* f, const void* p_data);
+uint16_t tu_fifo_write_n(tu_fifo_t* f, const void* p_data, uint16_t n);
+
+//--------------------------------------------------------------------+
+// Host stack
+//--------------------------------------------------------------------+
+bool tuh_init(uint8_t rhport);
+void tuh_task(void);
+bool tuh_mounted(uint8_t daddr);
+bool tuh_vid_pid_get(uint8_t daddr, uint16_t* vid, uint16_t* pid);
+bool tuh_descriptor_get_device_local(uint8_t daddr, tusb_desc_device_t* desc_device);
+/// Like TinyUSB, only one control transfer is in flight at a time; returns
+/// false if the control pipe is busy. complete_cb runs from a later tuh_task().
+bool tuh_descriptor_get_string(uint8_t daddr, uint8_t index, uint16_t language_id, void* buffer, uint16_t len,
+                               tuh_xfer_cb_t complete_cb, uintptr_t user_data);
+
+//--------------------------------------------------------------------+
+// Timer
+//--------------------------------------------------------------------+
+/// Stands in for the RP2040 time_us_32() microsecond timer; see usb_midi_host_sim.h
+uint32_t sim_usb_midi_host_time_us(void);
+
+#ifdef __cplusplus
+}
+#endif
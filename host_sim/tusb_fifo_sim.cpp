@@ -0,0 +1,137 @@
+/*
+ * @file tusb_fifo_sim.cpp
+ * @brief Linux stand-in for the TinyUSB tu_fifo implementation
+ *
+ * Like the TinyUSB version, the read and write indices run from 0 to
+ * 2*depth-1 so that a full FIFO can be told apart from an empty one
+ * without a separate count. There is no mutex; the host_sim build runs
+ * the USB stack and the application in the same thread.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <cstring>
+#include "tusb.h"
+
+static uint16_t advance_index(uint16_t depth, uint16_t idx, uint16_t offset)
+{
+  uint32_t next = idx + offset;
+  // index wraps at 2*depth so that full and empty can be distinguished
+  if (next >= 2u * depth)
+    next -= 2u * depth;
+  return static_cast<uint16_t>(next);
+}
+
+static uint16_t index_to_offset(uint16_t depth, uint16_t idx)
+{
+  return idx >= depth ? idx - depth : idx;
+}
+
+extern "C" bool tu_fifo_config(tu_fifo_t* f, void* buffer, uint16_t depth, uint16_t item_size, bool overwritable)
+{
+  if (depth > 0x8000)
+    return false;
+  f->buffer = static_cast<uint8_t*>(buffer);
+  f->depth = depth;
+  f->item_size = item_size;
+  f->overwritable = overwritable;
+  f->rd_idx = 0;
+  f->wr_idx = 0;
+  return true;
+}
+
+extern "C" bool tu_fifo_clear(tu_fifo_t* f)
+{
+  f->rd_idx = 0;
+  f->wr_idx = 0;
+  return true;
+}
+
+extern "C" uint16_t tu_fifo_count(tu_fifo_t* f)
+{
+  uint16_t count = f->wr_idx >= f->rd_idx ? f->wr_idx - f->rd_idx : 2 * f->depth - (f->rd_idx - f->wr_idx);
+  return count > f->depth ? f->depth : count;
+}
+
+extern "C" uint16_t tu_fifo_remaining(tu_fifo_t* f)
+{
+  return f->depth - tu_fifo_count(f);
+}
+
+extern "C" bool tu_fifo_empty(tu_fifo_t* f)
+{
+  return f->wr_idx == f->rd_idx;
+}
+
+extern "C" bool tu_fifo_full(tu_fifo_t* f)
+{
+  return tu_fifo_count(f) == f->depth;
+}
+
+extern "C" bool tu_fifo_peek(tu_fifo_t* f, void* p_buffer)
+{
+  if (tu_fifo_empty(f))
+    return false;
+  memcpy(p_buffer, f->buffer + index_to_offset(f->depth, f->rd_idx) * f->item_size, f->item_size);
+  return true;
+}
+
+extern "C" uint16_t tu_fifo_read_n(tu_fifo_t* f, void* p_buffer, uint16_t n)
+{
+  uint16_t count = tu_fifo_count(f);
+  if (n > count)
+    n = count;
+  uint8_t* dest = static_cast<uint8_t*>(p_buffer);
+  for (uint16_t idx = 0; idx < n; idx++) {
+    memcpy(dest, f->buffer + index_to_offset(f->depth, f->rd_idx) * f->item_size, f->item_size);
+    dest += f->item_size;
+    f->rd_idx = advance_index(f->depth, f->rd_idx, 1);
+  }
+  return n;
+}
+
+extern "C" bool tu_fifo_read(tu_fifo_t* f, void* p_buffer)
+{
+  return tu_fifo_read_n(f, p_buffer, 1) == 1;
+}
+
+extern "C" uint16_t tu_fifo_write_n(tu_fifo_t* f, const void* p_data, uint16_t n)
+{
+  const uint8_t* src = static_cast<const uint8_t*>(p_data);
+  uint16_t nWritten = 0;
+  for (; nWritten < n; nWritten++) {
+    if (tu_fifo_full(f)) {
+      if (!f->overwritable)
+        break;
+      f->rd_idx = advance_index(f->depth, f->rd_idx, 1);
+    }
+    memcpy(f->buffer + index_to_offset(f->depth, f->wr_idx) * f->item_size, src, f->item_size);
+    src += f->item_size;
+    f->wr_idx = advance_index(f->depth, f->wr_idx, 1);
+  }
+  return nWritten;
+}
+
+extern "C" bool tu_fifo_write(tu_fifo_t* f, const void* p_data)
+{
+  return tu_fifo_write_n(f, p_data, 1) == 1;
+}
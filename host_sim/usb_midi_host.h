@@ -0,0 +1,65 @@
+/*
+ * @file usb_midi_host.h
+ * @brief Linux stand-in for the usb_midi_host application driver API
+ *
+ * This file is only used by the host_sim build. The declarations match
+ * the usb_midi_host library so that EZ_USB_MIDI_HOST compiles unchanged.
+ * The implementation in usb_midi_host_sim.cpp models the driver's receive
+ * and transmit FIFOs and its stream encoder and decoder; the simulated bus
+ * is controlled through the functions in usb_midi_host_sim.h.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#pragma once
+
+#include "tusb.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//--------------------------------------------------------------------+
+// Application API
+//--------------------------------------------------------------------+
+void tuh_midih_define_limits(size_t max_rx_buf, size_t max_tx_buf, uint8_t max_cables);
+bool tuh_midi_configured(uint8_t dev_addr);
+uint8_t tuh_midi_get_num_tx_cables(uint8_t dev_addr);
+uint8_t tuh_midi_get_num_rx_cables(uint8_t dev_addr);
+bool tuh_midi_packet_read(uint8_t dev_addr, uint8_t packet[4]);
+bool tuh_midi_packet_write(uint8_t dev_addr, uint8_t const packet[4]);
+uint32_t tuh_midi_stream_write(uint8_t dev_addr, uint8_t cable_num, uint8_t const* p_buffer, uint32_t bufsize);
+uint32_t tuh_midi_stream_read(uint8_t dev_addr, uint8_t* p_cable_num, uint8_t* p_buffer, uint16_t bufsize);
+uint32_t tuh_midi_stream_flush(uint8_t dev_addr);
+bool tuh_midi_can_write_stream(uint8_t dev_addr);
+
+//--------------------------------------------------------------------+
+// Callbacks (weak is optional)
+//--------------------------------------------------------------------+
+void tuh_midi_mount_cb(uint8_t dev_addr, uint8_t in_ep, uint8_t out_ep, uint8_t num_cables_rx, uint16_t num_cables_tx);
+void tuh_midi_umount_cb(uint8_t dev_addr, uint8_t instance);
+void tuh_midi_rx_cb(uint8_t dev_addr, uint32_t num_packets);
+void tuh_midi_tx_cb(uint8_t dev_addr);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,665 @@
+/*
+ * @file usb_midi_host_sim.cpp
+ * @brief Simulated USB bus and usb_midi_host application driver for Linux
+ *
+ * The driver half of this file follows the usb_midi_host library: each
+ * mounted device has a byte-wide receive FIFO and a byte-wide transmit
+ * FIFO, the stream write function encodes MIDI bytes into 4-byte USB MIDI
+ * packets and the stream read function decodes packets back into bytes for
+ * one virtual cable at a time. The bus half stands in for the USB hardware.
+ * Hot-plug events and IN transfers are queued by the sim_usb_midi_host_*()
+ * functions and completed by tuh_task(), which is also where the mount,
+ * unmount and receive callbacks run. An OUT transfer started by
+ * tuh_midi_stream_flush() carries at most one full speed bulk packet and
+ * stays busy until the next tuh_task().
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+#include "usb_midi_host_sim.h"
+#include "host/hcd.h"
+
+namespace {
+const uint8_t MIDI_STATUS_SYSEX_START = 0xF0;
+const uint8_t MIDI_STATUS_SYSEX_END = 0xF7;
+const uint8_t MIDI_CIN_SYSEX_START = 0x4;
+const uint8_t MIDI_CIN_SYSEX_END_1BYTE = 0x5;
+const uint8_t MIDI_CIN_SYSCOM_2BYTE = 0x2;
+const uint8_t MIDI_CIN_SYSCOM_3BYTE = 0x3;
+
+struct StreamState {
+  uint8_t buffer[4];
+  uint8_t index;
+  uint8_t total;
+};
+
+struct SimDevice {
+  bool attached;    // a plug event has been queued and no unplug since
+  bool mounted;     // the mount callback has been called
+  uint8_t rhport;   // the root port the device is attached to
+  uint8_t numCablesRx;
+  uint8_t numCablesTx;
+  uint16_t vid;
+  uint16_t pid;
+  std::string manufacturer;
+  std::string product;
+  std::string serial;
+  std::deque<uint32_t> pendingIn;   // packets the device has not yet sent
+  std::vector<uint8_t> rxBuffer;
+  tu_fifo_t rxFifo;
+  std::vector<uint8_t> txBuffer;
+  tu_fifo_t txFifo;
+  StreamState streamWrite;
+  uint16_t inSysex;  // bitmap of cables with a SysEx message in progress
+  bool outBusy;
+  uint64_t txPackets;
+  uint64_t rxDropped;
+  uint64_t streamWrites;
+};
+
+struct BusEvent {
+  bool plug;
+  uint8_t devAddr;
+};
+
+// The one control transfer TinyUSB allows in flight at a time
+struct ControlXfer {
+  bool busy;
+  uint8_t index;
+  uint16_t len;
+  tuh_xfer_t xfer;
+};
+
+SimDevice simDevices[CFG_TUH_DEVICE_MAX + 1]; // index 0 is never used
+std::deque<BusEvent> busEvents;
+ControlXfer controlXfer;
+size_t rxBufsize = 64;
+size_t txBufsize = 64;
+sim_usb_midi_tx_sink_t txSink = nullptr;
+void* txSinkContext = nullptr;
+bool timeStopped = false;
+uint32_t stoppedTimeUs = 0;
+uint32_t timeStepUs = 0;
+
+SimDevice* getMountedDevice(uint8_t devAddr)
+{
+  if (devAddr == 0 || devAddr > CFG_TUH_DEVICE_MAX || !simDevices[devAddr].mounted)
+    return nullptr;
+  return simDevices + devAddr;
+}
+
+// Return the driver state of a device to the unmounted state
+void clearDevice(SimDevice& dev)
+{
+  dev.mounted = false;
+  dev.inSysex = 0;
+  dev.outBusy = false;
+  dev.streamWrite.index = 0;
+  dev.streamWrite.total = 0;
+  dev.streamWrite.buffer[0] = 0;
+}
+
+void mountDevice(uint8_t devAddr)
+{
+  SimDevice& dev = simDevices[devAddr];
+  dev.rxBuffer.assign(rxBufsize, 0);
+  tu_fifo_config(&dev.rxFifo, dev.rxBuffer.data(), static_cast<uint16_t>(rxBufsize), 1, false);
+  dev.txBuffer.assign(txBufsize, 0);
+  tu_fifo_config(&dev.txFifo, dev.txBuffer.data(), static_cast<uint16_t>(txBufsize), 1, false);
+  dev.mounted = true;
+  tuh_midi_mount_cb(devAddr, 0x81, 0x01, dev.numCablesRx, dev.numCablesTx);
+}
+
+void unmountDevice(uint8_t devAddr)
+{
+  SimDevice& dev = simDevices[devAddr];
+  bool wasMounted = dev.mounted;
+  clearDevice(dev);
+  // Like TinyUSB, drop the device's control transfer without calling back
+  if (controlXfer.busy && controlXfer.xfer.daddr == devAddr)
+    controlXfer.busy = false;
+  if (wasMounted)
+    tuh_midi_umount_cb(devAddr, 0);
+}
+
+// Move one bulk IN transfer worth of packets to the receive FIFO
+void completeInTransfer(uint8_t devAddr, SimDevice& dev)
+{
+  uint32_t nPackets = 0;
+  for (uint8_t idx = 0; idx < SIM_USB_MIDI_PACKETS_PER_XFER && !dev.pendingIn.empty(); idx++) {
+    uint32_t word = dev.pendingIn.front();
+    dev.pendingIn.pop_front();
+    uint8_t packet[4];
+    memcpy(packet, &word, sizeof(packet));
+    // like the driver, skip all-zero padding packets
+    if (word == 0)
+      continue;
+    if (tu_fifo_remaining(&dev.rxFifo) < 4) {
+      ++dev.rxDropped;
+      continue;
+    }
+    tu_fifo_write_n(&dev.rxFifo, packet, 4);
+    ++nPackets;
+  }
+  if (nPackets != 0)
+    tuh_midi_rx_cb(devAddr, nPackets);
+}
+
+// String descriptor indices of the manufacturer, product and serial strings
+const uint8_t manufacturerIndex = 1;
+const uint8_t productIndex = 2;
+const uint8_t serialIndex = 3;
+
+// Convert one of the device's ASCII strings to a USB string descriptor.
+// String descriptor 0 is the list of supported language IDs: US English only
+xfer_result_t getStringDescriptor(SimDevice& dev, uint8_t index, void* buffer, uint16_t len)
+{
+  uint16_t* desc = static_cast<uint16_t*>(buffer);
+  if (len < 4)
+    return XFER_RESULT_FAILED;
+  if (index == 0) {
+    desc[0] = (0x03 << 8) | 4;
+    desc[1] = 0x0409;
+    return XFER_RESULT_SUCCESS;
+  }
+  const std::string& str = index == manufacturerIndex ? dev.manufacturer : index == productIndex ? dev.product :
+    index == serialIndex ? dev.serial : std::string();
+  if (str.empty())
+    return XFER_RESULT_STALLED;
+  size_t nChars = str.size();
+  size_t maxChars = len / 2 - 1;
+  if (nChars > maxChars)
+    nChars = maxChars;
+  if (nChars > 126)
+    nChars = 126; // bLength is a single byte
+  desc[0] = static_cast<uint16_t>((0x03 << 8) | (2 + 2 * nChars));
+  for (size_t idx = 0; idx < nChars; idx++) {
+    desc[idx + 1] = static_cast<uint8_t>(str[idx]);
+  }
+  return XFER_RESULT_SUCCESS;
+}
+} // namespace
+
+//--------------------------------------------------------------------+
+// Simulation control
+//--------------------------------------------------------------------+
+void sim_usb_midi_host_reset()
+{
+  for (auto& dev : simDevices) {
+    clearDevice(dev);
+    dev.attached = false;
+    dev.pendingIn.clear();
+    dev.txPackets = 0;
+    dev.rxDropped = 0;
+    dev.streamWrites = 0;
+  }
+  busEvents.clear();
+  controlXfer.busy = false;
+  timeStopped = false;
+  timeStepUs = 0;
+}
+
+bool sim_usb_midi_host_plug(uint8_t dev_addr, uint8_t num_cables_rx, uint8_t num_cables_tx,
+                            uint16_t vid, uint16_t pid, const char* manufacturer,
+                            const char* product, const char* serial)
+{
+  if (dev_addr == 0 || dev_addr > CFG_TUH_DEVICE_MAX || simDevices[dev_addr].attached)
+    return false;
+  SimDevice& dev = simDevices[dev_addr];
+  dev.attached = true;
+  dev.rhport = 0;
+  dev.numCablesRx = num_cables_rx;
+  dev.numCablesTx = num_cables_tx;
+  dev.vid = vid;
+  dev.pid = pid;
+  dev.manufacturer = manufacturer != nullptr ? manufacturer : "";
+  dev.product = product != nullptr ? product : "";
+  dev.serial = serial != nullptr ? serial : "";
+  busEvents.push_back({true, dev_addr});
+  return true;
+}
+
+bool sim_usb_midi_host_set_rhport(uint8_t dev_addr, uint8_t rhport)
+{
+  if (dev_addr == 0 || dev_addr > CFG_TUH_DEVICE_MAX || !simDevices[dev_addr].attached)
+    return false;
+  simDevices[dev_addr].rhport = rhport;
+  return true;
+}
+
+void sim_usb_midi_host_unplug(uint8_t dev_addr)
+{
+  if (dev_addr == 0 || dev_addr > CFG_TUH_DEVICE_MAX || !simDevices[dev_addr].attached)
+    return;
+  simDevices[dev_addr].attached = false;
+  simDevices[dev_addr].pendingIn.clear();
+  busEvents.push_back({false, dev_addr});
+}
+
+uint32_t sim_usb_midi_host_send_to_host(uint8_t dev_addr, const uint8_t* packets, uint32_t num_packets)
+{
+  if (dev_addr == 0 || dev_addr > CFG_TUH_DEVICE_MAX || !simDevices[dev_addr].attached)
+    return 0;
+  SimDevice& dev = simDevices[dev_addr];
+  for (uint32_t idx = 0; idx < num_packets; idx++) {
+    uint32_t word;
+    memcpy(&word, packets + 4 * idx, sizeof(word));
+    dev.pendingIn.push_back(word);
+  }
+  return num_packets;
+}
+
+void sim_usb_midi_host_set_tx_sink(sim_usb_midi_tx_sink_t sink, void* context)
+{
+  txSink = sink;
+  txSinkContext = context;
+}
+
+uint64_t sim_usb_midi_host_get_tx_packets(uint8_t dev_addr)
+{
+  return (dev_addr == 0 || dev_addr > CFG_TUH_DEVICE_MAX) ? 0 : simDevices[dev_addr].txPackets;
+}
+
+uint64_t sim_usb_midi_host_get_stream_writes(uint8_t dev_addr)
+{
+  return (dev_addr == 0 || dev_addr > CFG_TUH_DEVICE_MAX) ? 0 : simDevices[dev_addr].streamWrites;
+}
+
+uint64_t sim_usb_midi_host_get_rx_dropped(uint8_t dev_addr)
+{
+  return (dev_addr == 0 || dev_addr > CFG_TUH_DEVICE_MAX) ? 0 : simDevices[dev_addr].rxDropped;
+}
+
+void sim_usb_midi_host_set_time_us(uint32_t time_us)
+{
+  timeStopped = true;
+  stoppedTimeUs = time_us;
+}
+
+void sim_usb_midi_host_set_time_step_us(uint32_t step_us)
+{
+  timeStepUs = step_us;
+}
+
+extern "C" uint32_t sim_usb_midi_host_time_us(void)
+{
+  if (timeStopped) {
+    uint32_t now = stoppedTimeUs;
+    stoppedTimeUs += timeStepUs;
+    return now;
+  }
+  auto now = std::chrono::steady_clock::now().time_since_epoch();
+  return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(now).count());
+}
+
+bool sim_usb_midi_host_busy()
+{
+  if (!busEvents.empty())
+    return true;
+  for (uint8_t devAddr = 1; devAddr <= CFG_TUH_DEVICE_MAX; devAddr++) {
+    SimDevice& dev = simDevices[devAddr];
+    if (dev.mounted && (!dev.pendingIn.empty() || dev.outBusy || !tu_fifo_empty(&dev.txFifo)))
+      return true;
+  }
+  return false;
+}
+
+//--------------------------------------------------------------------+
+// Host stack
+//--------------------------------------------------------------------+
+extern "C" bool tuh_init(uint8_t rhport)
+{
+  (void)rhport;
+  return true;
+}
+
+extern "C" void tuh_task(void)
+{
+  while (!busEvents.empty()) {
+    BusEvent event = busEvents.front();
+    busEvents.pop_front();
+    if (event.plug)
+      mountDevice(event.devAddr);
+    else
+      unmountDevice(event.devAddr);
+  }
+  if (controlXfer.busy) {
+    // One control transfer completes per call
+    controlXfer.busy = false;
+    tuh_xfer_t xfer = controlXfer.xfer;
+    SimDevice* dev = getMountedDevice(xfer.daddr);
+    xfer.result = dev != nullptr ? getStringDescriptor(*dev, controlXfer.index, xfer.buffer, controlXfer.len) : XFER_RESULT_FAILED;
+    xfer.actual_len = xfer.result == XFER_RESULT_SUCCESS ? (xfer.buffer[0] & 0xff) : 0;
+    xfer.complete_cb(&xfer);
+  }
+  for (uint8_t devAddr = 1; devAddr <= CFG_TUH_DEVICE_MAX; devAddr++) {
+    SimDevice& dev = simDevices[devAddr];
+    if (!dev.mounted)
+      continue;
+    if (dev.outBusy) {
+      dev.outBusy = false;
+      tuh_midi_tx_cb(devAddr);
+    }
+    // Like the driver, only start a bulk IN transfer if the whole transfer
+    // fits in the receive FIFO; until then, the device gets NAKs
+    if (dev.mounted && !dev.pendingIn.empty() &&
+        tu_fifo_remaining(&dev.rxFifo) >= 4 * SIM_USB_MIDI_PACKETS_PER_XFER)
+      completeInTransfer(devAddr, dev);
+  }
+}
+
+extern "C" void hcd_devtree_get_info(uint8_t dev_addr, hcd_devtree_info_t* devtree_info)
+{
+  SimDevice* dev = getMountedDevice(dev_addr);
+  devtree_info->rhport = dev != nullptr ? dev->rhport : 0;
+  devtree_info->hub_addr = 0;
+  devtree_info->hub_port = 0;
+  devtree_info->speed = 1; // full speed
+}
+
+extern "C" bool tuh_mounted(uint8_t daddr)
+{
+  return getMountedDevice(daddr) != nullptr;
+}
+
+extern "C" bool tuh_vid_pid_get(uint8_t daddr, uint16_t* vid, uint16_t* pid)
+{
+  SimDevice* dev = getMountedDevice(daddr);
+  if (dev == nullptr)
+    return false;
+  *vid = dev->vid;
+  *pid = dev->pid;
+  return true;
+}
+
+extern "C" bool tuh_descriptor_get_device_local(uint8_t daddr, tusb_desc_device_t* desc_device)
+{
+  SimDevice* dev = getMountedDevice(daddr);
+  if (dev == nullptr)
+    return false;
+  memset(desc_device, 0, sizeof(*desc_device));
+  desc_device->bLength = sizeof(*desc_device);
+  desc_device->bDescriptorType = 0x01;
+  desc_device->bcdUSB = 0x0200;
+  desc_device->bMaxPacketSize0 = 64;
+  desc_device->idVendor = dev->vid;
+  desc_device->idProduct = dev->pid;
+  desc_device->iManufacturer = dev->manufacturer.empty() ? 0 : manufacturerIndex;
+  desc_device->iProduct = dev->product.empty() ? 0 : productIndex;
+  desc_device->iSerialNumber = dev->serial.empty() ? 0 : serialIndex;
+  desc_device->bNumConfigurations = 1;
+  return true;
+}
+
+extern "C" bool tuh_descriptor_get_string(uint8_t daddr, uint8_t index, uint16_t language_id, void* buffer, uint16_t len,
+                                          tuh_xfer_cb_t complete_cb, uintptr_t user_data)
+{
+  (void)language_id;
+  if (controlXfer.busy || getMountedDevice(daddr) == nullptr || complete_cb == nullptr)
+    return false;
+  controlXfer.busy = true;
+  controlXfer.index = index;
+  controlXfer.len = len;
+  controlXfer.xfer = {};
+  controlXfer.xfer.daddr = daddr;
+  controlXfer.xfer.buflen = len;
+  controlXfer.xfer.buffer = static_cast<uint8_t*>(buffer);
+  controlXfer.xfer.complete_cb = complete_cb;
+  controlXfer.xfer.user_data = user_data;
+  return true;
+}
+
+//--------------------------------------------------------------------+
+// usb_midi_host application API
+//--------------------------------------------------------------------+
+extern "C" void tuh_midih_define_limits(size_t max_rx_buf, size_t max_tx_buf, uint8_t max_cables)
+{
+  (void)max_cables;
+  rxBufsize = max_rx_buf;
+  txBufsize = max_tx_buf;
+}
+
+extern "C" bool tuh_midi_configured(uint8_t dev_addr)
+{
+  return getMountedDevice(dev_addr) != nullptr;
+}
+
+extern "C" uint8_t tuh_midi_get_num_tx_cables(uint8_t dev_addr)
+{
+  SimDevice* dev = getMountedDevice(dev_addr);
+  return dev != nullptr ? dev->numCablesTx : 0;
+}
+
+extern "C" uint8_t tuh_midi_get_num_rx_cables(uint8_t dev_addr)
+{
+  SimDevice* dev = getMountedDevice(dev_addr);
+  return dev != nullptr ? dev->numCablesRx : 0;
+}
+
+extern "C" bool tuh_midi_packet_read(uint8_t dev_addr, uint8_t packet[4])
+{
+  SimDevice* dev = getMountedDevice(dev_addr);
+  if (dev == nullptr || tu_fifo_count(&dev->rxFifo) < 4)
+    return false;
+  return tu_fifo_read_n(&dev->rxFifo, packet, 4) == 4;
+}
+
+extern "C" bool tuh_midi_packet_write(uint8_t dev_addr, uint8_t const packet[4])
+{
+  SimDevice* dev = getMountedDevice(dev_addr);
+  if (dev == nullptr || tu_fifo_remaining(&dev->txFifo) < 4)
+    return false;
+  return tu_fifo_write_n(&dev->txFifo, packet, 4) == 4;
+}
+
+extern "C" uint32_t tuh_midi_stream_write(uint8_t dev_addr, uint8_t cable_num, uint8_t const* buffer, uint32_t bufsize)
+{
+  SimDevice* dev = getMountedDevice(dev_addr);
+  if (dev == nullptr || cable_num >= dev->numCablesTx)
+    return 0;
+  ++dev->streamWrites;
+  StreamState* stream = &dev->streamWrite;
+  uint32_t idx = 0;
+  while (idx < bufsize && tu_fifo_remaining(&dev->txFifo) >= 4) {
+    uint8_t const data = buffer[idx++];
+    bool inSysex = (stream->buffer[0] & 0x0f) == MIDI_CIN_SYSEX_START;
+    if (stream->index == 0) {
+      // New event packet
+      uint8_t const msg = data >> 4;
+      stream->index = 2;
+      stream->buffer[1] = data;
+      if (inSysex) {
+        if (data == MIDI_STATUS_SYSEX_END) {
+          stream->buffer[0] = static_cast<uint8_t>((cable_num << 4) | MIDI_CIN_SYSEX_END_1BYTE);
+          stream->total = 2;
+        }
+        else {
+          stream->total = 4;
+        }
+      }
+      else if ((msg >= 0x8 && msg <= 0xB) || msg == 0xE) {
+        // Channel Voice Messages
+        stream->buffer[0] = static_cast<uint8_t>((cable_num << 4) | msg);
+        stream->total = 4;
+      }
+      else if (msg == 0xC || msg == 0xD) {
+        // Channel Voice Messages, two-byte variants (Program Change and Channel Pressure)
+        stream->buffer[0] = static_cast<uint8_t>((cable_num << 4) | msg);
+        stream->total = 3;
+      }
+      else if (msg == 0xF) {
+        // System message
+        if (data == MIDI_STATUS_SYSEX_START) {
+          stream->buffer[0] = MIDI_CIN_SYSEX_START;
+          stream->total = 4;
+        }
+        else if (data == 0xF1 || data == 0xF3) {
+          stream->buffer[0] = MIDI_CIN_SYSCOM_2BYTE;
+          stream->total = 3;
+        }
+        else if (data == 0xF2) {
+          stream->buffer[0] = MIDI_CIN_SYSCOM_3BYTE;
+          stream->total = 4;
+        }
+        else {
+          stream->buffer[0] = MIDI_CIN_SYSEX_END_1BYTE;
+          stream->total = 2;
+        }
+        stream->buffer[0] |= static_cast<uint8_t>(cable_num << 4);
+      }
+      else {
+        // Pack individual bytes if we don't support packing them into words.
+        stream->buffer[0] = static_cast<uint8_t>((cable_num << 4) | 0xf);
+        stream->buffer[2] = 0;
+        stream->buffer[3] = 0;
+        stream->index = 2;
+        stream->total = 2;
+      }
+    }
+    else {
+      // On-going (buffering) packet
+      stream->buffer[stream->index] = data;
+      stream->index++;
+      // See if this byte ends a SysEx.
+      if (inSysex && data == MIDI_STATUS_SYSEX_END) {
+        stream->buffer[0] = static_cast<uint8_t>((cable_num << 4) | (MIDI_CIN_SYSEX_START + (stream->index - 1)));
+        stream->total = stream->index;
+      }
+    }
+
+    // Send out packet
+    if (stream->index == stream->total) {
+      // zeroes unused bytes
+      for (uint8_t jdx = stream->total; jdx < 4; jdx++)
+        stream->buffer[jdx] = 0;
+      tu_fifo_write_n(&dev->txFifo, stream->buffer, 4);
+      // complete current event packet, reset stream
+      stream->index = 0;
+      stream->total = 0;
+    }
+  }
+  return idx;
+}
+
+extern "C" uint32_t tuh_midi_stream_read(uint8_t dev_addr, uint8_t* p_cable_num, uint8_t* p_buffer, uint16_t bufsize)
+{
+  SimDevice* dev = getMountedDevice(dev_addr);
+  if (dev == nullptr || tu_fifo_count(&dev->rxFifo) < 4)
+    return 0;
+  uint32_t bytesBuffered = 0;
+  uint8_t packet[4];
+  tu_fifo_peek(&dev->rxFifo, packet);
+  *p_cable_num = (packet[0] >> 4) & 0xf;
+  // stop at the first packet for a different cable or that might not fit
+  while (bytesBuffered + 3 <= bufsize && tu_fifo_count(&dev->rxFifo) >= 4) {
+    tu_fifo_peek(&dev->rxFifo, packet);
+    if (((packet[0] >> 4) & 0xf) != *p_cable_num)
+      break;
+    tu_fifo_read_n(&dev->rxFifo, packet, 4);
+    uint8_t nBytes = 0;
+    if (*p_cable_num < dev->numCablesRx) {
+      // ignore the CIN field; too many devices out there encode this wrong
+      uint8_t status = packet[1];
+      uint16_t cableBit = static_cast<uint16_t>(1u << *p_cable_num);
+      if (status <= 0x7f || status == MIDI_STATUS_SYSEX_START) {
+        if (status == MIDI_STATUS_SYSEX_START)
+          dev->inSysex |= cableBit;
+        // only add the packet contents if it is part of a sysex message
+        if (dev->inSysex & cableBit) {
+          for (uint8_t idx = 1; idx < 4 && nBytes == 0; idx++) {
+            if (packet[idx] == MIDI_STATUS_SYSEX_END) {
+              dev->inSysex &= ~cableBit;
+              nBytes = idx;
+            }
+          }
+          if (nBytes == 0)
+            nBytes = 3;
+        }
+      }
+      else if (status < MIDI_STATUS_SYSEX_START) {
+        // channel message
+        nBytes = ((status & 0xf0) == 0xC0 || (status & 0xf0) == 0xD0) ? 2 : 3;
+        dev->inSysex &= ~cableBit;
+      }
+      else if (status < 0xF8) {
+        switch (status) {
+          case 0xF1:
+          case 0xF3:
+            nBytes = 2;
+            break;
+          case 0xF2:
+            nBytes = 3;
+            break;
+          case 0xF6:
+          case MIDI_STATUS_SYSEX_END:
+            nBytes = 1;
+            break;
+          default:
+            break;
+        }
+        dev->inSysex &= ~cableBit;
+      }
+      else {
+        // Real-time messages may be inserted into a sysex message
+        nBytes = 1;
+      }
+    }
+    for (uint8_t idx = 1; idx <= nBytes; idx++) {
+      *p_buffer++ = packet[idx];
+    }
+    bytesBuffered += nBytes;
+  }
+  return bytesBuffered;
+}
+
+extern "C" uint32_t tuh_midi_stream_flush(uint8_t dev_addr)
+{
+  SimDevice* dev = getMountedDevice(dev_addr);
+  if (dev == nullptr || dev->outBusy || tu_fifo_empty(&dev->txFifo))
+    return 0;
+  uint32_t nBytes = 0;
+  uint8_t packet[4];
+  for (uint8_t idx = 0; idx < SIM_USB_MIDI_PACKETS_PER_XFER && tu_fifo_read_n(&dev->txFifo, packet, 4) == 4; idx++) {
+    if (txSink != nullptr)
+      txSink(dev_addr, packet, txSinkContext);
+    ++dev->txPackets;
+    nBytes += 4;
+  }
+  dev->outBusy = true;
+  return nBytes;
+}
+
+extern "C" bool tuh_midi_can_write_stream(uint8_t dev_addr)
+{
+  SimDevice* dev = getMountedDevice(dev_addr);
+  return dev != nullptr && tu_fifo_remaining(&dev->txFifo) >= 4;
+}
+
+extern "C" __attribute__((weak)) void tuh_midi_tx_cb(uint8_t dev_addr)
+{
+  (void)dev_addr;
+}
@@ -0,0 +1,109 @@
+/*
+ * @file usb_midi_host_sim.h
+ * @brief Control interface for the simulated USB bus used by the host_sim build
+ *
+ * The simulated bus plays the role of the USB hardware. Calls to these
+ * functions only queue work; as on real hardware, the mount, unmount and
+ * receive callbacks run from inside tuh_task(). Every OUT transfer that
+ * tuh_midi_stream_flush() starts is delivered to the transmit sink, if
+ * one is registered, and counted.
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2024 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#pragma once
+
+#include "usb_midi_host.h"
+
+/// The number of 4-byte USB MIDI packets in one full speed bulk transfer
+#define SIM_USB_MIDI_PACKETS_PER_XFER 16
+
+/// Called once for every USB MIDI packet the host sends to a simulated device
+typedef void (*sim_usb_midi_tx_sink_t)(uint8_t dev_addr, const uint8_t packet[4], void* context);
+
+/// @brief Return the simulated bus to the power-on state. All devices are
+/// removed without calling the unmount callback and all counters are cleared.
+void sim_usb_midi_host_reset();
+
+/// @brief Queue a device attach. The mount callback runs on the next tuh_task()
+/// @param dev_addr the USB device address to assign; 1 to CFG_TUH_DEVICE_MAX inclusive
+/// @param num_cables_rx the number of virtual MIDI cables the host receives from
+/// @param num_cables_tx the number of virtual MIDI cables the host transmits to
+/// @param vid the Vendor ID the device reports
+/// @param pid the Product ID the device reports
+/// @param manufacturer the manufacturer string descriptor or nullptr if none
+/// @param product the product string descriptor or nullptr if none
+/// @param serial the serial number string descriptor or nullptr if none
+/// @return false if dev_addr is out of range or already in use
+bool sim_usb_midi_host_plug(uint8_t dev_addr, uint8_t num_cables_rx, uint8_t num_cables_tx,
+                            uint16_t vid, uint16_t pid, const char* manufacturer,
+                            const char* product, const char* serial);
+
+/// @brief Attach a device plugged in with sim_usb_midi_host_plug() to another
+/// root port. Call it before the tuh_task() that mounts the device.
+/// @param dev_addr the USB device address of the device
+/// @param rhport the root port; devices are on root port 0 by default
+/// @return false if dev_addr is not plugged in
+bool sim_usb_midi_host_set_rhport(uint8_t dev_addr, uint8_t rhport);
+
+/// @brief Queue a device detach. The unmount callback runs on the next tuh_task()
+/// @param dev_addr the USB device address of the device to remove
+void sim_usb_midi_host_unplug(uint8_t dev_addr);
+
+/// @brief Queue USB MIDI packets as if the device had sent them. tuh_task()
+/// moves them to the driver receive FIFO one bulk transfer at a time and
+/// calls tuh_midi_rx_cb() after each transfer. As on real hardware, a
+/// transfer only happens when the receive FIFO has room for all of it.
+/// @param dev_addr the USB device address of the sending device
+/// @param packets points to num_packets 4-byte USB MIDI event packets
+/// @param num_packets the number of packets to queue
+/// @return the number of packets queued; 0 if the device is not plugged in
+uint32_t sim_usb_midi_host_send_to_host(uint8_t dev_addr, const uint8_t* packets, uint32_t num_packets);
+
+/// @brief Register a function to observe every packet the host transmits
+/// @param sink the observer or nullptr to only count packets
+/// @param context passed to the sink unchanged
+void sim_usb_midi_host_set_tx_sink(sim_usb_midi_tx_sink_t sink, void* context);
+
+/// @return the total number of packets the host has transmitted to dev_addr
+uint64_t sim_usb_midi_host_get_tx_packets(uint8_t dev_addr);
+
+/// @return the number of tuh_midi_stream_write() calls for dev_addr
+uint64_t sim_usb_midi_host_get_stream_writes(uint8_t dev_addr);
+
+/// @return the number of received packets dropped because the driver
+/// receive FIFO of dev_addr was full
+uint64_t sim_usb_midi_host_get_rx_dropped(uint8_t dev_addr);
+
+/// @brief Stop the simulated microsecond timer at time_us. Until the next
+/// sim_usb_midi_host_reset(), sim_usb_midi_host_time_us() returns time_us
+/// instead of following the PC's clock, so tests can predict time stamps.
+void sim_usb_midi_host_set_time_us(uint32_t time_us);
+
+/// @brief Make the stopped timer move step_us forward after each
+/// sim_usb_midi_host_time_us() call, as if the code between two calls took
+/// that long; 0 (the default after sim_usb_midi_host_reset()) keeps it still
+void sim_usb_midi_host_set_time_step_us(uint32_t step_us);
+
+/// @return true if any device still has queued receive data, unsent data in
+/// the driver transmit FIFO or an OUT transfer tuh_task() has not yet completed
+bool sim_usb_midi_host_busy();